@@ -0,0 +1,636 @@
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "instructions.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BATCH_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define BATCH_HAVE_AVX2 0
+#endif
+
+/*
+ * The quirks of instructions.c that affect the instructions run
+ * column-wise here. The fuzzer checks the two stay in agreement.
+ */
+struct quirks {
+    bool shift_vy;
+    bool vf_reset;
+    bool legacy_flags;
+};
+
+static const struct quirks profile_quirks[PROFILE_COUNT] = {
+    [PROFILE_DEFAULT] = { .shift_vy = false, .vf_reset = false, .legacy_flags = true },
+    [PROFILE_CHIP8] = { .shift_vy = true, .vf_reset = true, .legacy_flags = false },
+    [PROFILE_SCHIP] = { .shift_vy = false, .vf_reset = false, .legacy_flags = false },
+    [PROFILE_XOCHIP] = { .shift_vy = true, .vf_reset = false, .legacy_flags = false },
+};
+
+enum alu_op {
+    ALU_LOAD,
+    ALU_ADD,
+    ALU_OR,
+    ALU_AND,
+    ALU_XOR,
+    ALU_ADD_CARRY,
+    ALU_SUB,
+    ALU_SUBN,
+    ALU_SHR,
+    ALU_SHL,
+    ALU_EQ,
+    ALU_NE
+};
+
+/*
+ * One byte-column operation over the lanes selected by batch->mask:
+ * dst = a op b (b is the immediate when NULL), with the flag written to
+ * `flag` when set. Comparisons write 0xFF/0 into batch->cond instead.
+ */
+struct alu {
+    enum alu_op op;
+    uint8_t *dst;
+    const uint8_t *a;
+    const uint8_t *b;
+    uint8_t imm;
+    uint8_t *flag;
+    bool flag_first;
+    bool strict;
+};
+
+static void alu_scalar(const struct alu *alu, const uint8_t *mask, uint8_t *cond, size_t lanes) {
+    for (size_t l = 0; l < lanes; ++l) {
+        if (!mask[l]) {
+            if (!alu->dst) {
+                cond[l] = 0;
+            }
+            continue;
+        }
+
+        uint8_t a = alu->a[l];
+        uint8_t b = alu->b ? alu->b[l] : alu->imm;
+        uint8_t result = 0;
+        uint8_t flag = 0;
+
+        switch (alu->op) {
+            case ALU_LOAD:
+                result = b;
+                break;
+            case ALU_ADD:
+                result = a + b;
+                break;
+            case ALU_OR:
+                result = a | b;
+                break;
+            case ALU_AND:
+                result = a & b;
+                break;
+            case ALU_XOR:
+                result = a ^ b;
+                break;
+            case ALU_ADD_CARRY:
+                result = a + b;
+                flag = a > UINT8_MAX - b;
+                break;
+            case ALU_SUB:
+                result = a - b;
+                flag = alu->strict ? a > b : a >= b;
+                break;
+            case ALU_SUBN:
+                result = b - a;
+                flag = alu->strict ? b > a : b >= a;
+                break;
+            case ALU_SHR:
+                result = a >> 1;
+                flag = LSB(a);
+                break;
+            case ALU_SHL:
+                result = a << 1;
+                flag = MSB(a);
+                break;
+            case ALU_EQ:
+                result = a == b;
+                break;
+            case ALU_NE:
+                result = a != b;
+                break;
+        }
+
+        if (!alu->dst) {
+            cond[l] = result ? 0xFF : 0;
+        } else if (alu->flag && alu->flag_first) {
+            alu->flag[l] = flag;
+            alu->dst[l] = result;
+        } else {
+            alu->dst[l] = result;
+            if (alu->flag) {
+                alu->flag[l] = flag;
+            }
+        }
+    }
+}
+
+static void tick_scalar(uint8_t *timer, const uint8_t *mask, size_t lanes) {
+    for (size_t l = 0; l < lanes; ++l) {
+        if (mask[l]) {
+            timer[l] = timer[l] > TIMER_TICKS_PER_FRAME ? timer[l] - TIMER_TICKS_PER_FRAME : 0;
+        }
+    }
+}
+
+#if BATCH_HAVE_AVX2
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i load_column(const uint8_t *column) {
+    return _mm256_load_si256((const __m256i *) column);
+}
+
+static inline AVX2 void store_masked(uint8_t *column, __m256i value, __m256i mask) {
+    __m256i old = load_column(column);
+    _mm256_store_si256((__m256i *) column, _mm256_blendv_epi8(old, value, mask));
+}
+
+static inline AVX2 __m256i greater(__m256i a, __m256i b) {
+    return _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(a, b), a), _mm256_set1_epi8(-1));
+}
+
+static inline AVX2 __m256i greater_or_equal(__m256i a, __m256i b) {
+    return _mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a);
+}
+
+static AVX2 void alu_avx2(const struct alu *alu, const uint8_t *mask, uint8_t *cond, size_t lanes) {
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i all = _mm256_set1_epi8(-1);
+    const __m256i imm = _mm256_set1_epi8(alu->imm);
+
+    for (size_t l = 0; l < lanes; l += BATCH_BLOCK) {
+        __m256i m = load_column(&mask[l]);
+        __m256i a = load_column(&alu->a[l]);
+        __m256i b = alu->b ? load_column(&alu->b[l]) : imm;
+        __m256i result = _mm256_setzero_si256();
+        __m256i flag = _mm256_setzero_si256();
+
+        switch (alu->op) {
+            case ALU_LOAD:
+                result = b;
+                break;
+            case ALU_ADD:
+                result = _mm256_add_epi8(a, b);
+                break;
+            case ALU_OR:
+                result = _mm256_or_si256(a, b);
+                break;
+            case ALU_AND:
+                result = _mm256_and_si256(a, b);
+                break;
+            case ALU_XOR:
+                result = _mm256_xor_si256(a, b);
+                break;
+            case ALU_ADD_CARRY:
+                result = _mm256_add_epi8(a, b);
+                flag = _mm256_and_si256(greater(a, _mm256_xor_si256(b, all)), ones);
+                break;
+            case ALU_SUB:
+                result = _mm256_sub_epi8(a, b);
+                flag = _mm256_and_si256(alu->strict ? greater(a, b) : greater_or_equal(a, b), ones);
+                break;
+            case ALU_SUBN:
+                result = _mm256_sub_epi8(b, a);
+                flag = _mm256_and_si256(alu->strict ? greater(b, a) : greater_or_equal(b, a), ones);
+                break;
+            case ALU_SHR:
+                result = _mm256_and_si256(_mm256_srli_epi16(a, 1), _mm256_set1_epi8(0x7F));
+                flag = _mm256_and_si256(a, ones);
+                break;
+            case ALU_SHL:
+                result = _mm256_add_epi8(a, a);
+                flag = _mm256_and_si256(_mm256_srli_epi16(a, 7), ones);
+                break;
+            case ALU_EQ:
+                result = _mm256_cmpeq_epi8(a, b);
+                break;
+            case ALU_NE:
+                result = _mm256_xor_si256(_mm256_cmpeq_epi8(a, b), all);
+                break;
+        }
+
+        if (!alu->dst) {
+            _mm256_store_si256((__m256i *) &cond[l], _mm256_and_si256(result, m));
+        } else if (alu->flag && alu->flag_first) {
+            store_masked(&alu->flag[l], flag, m);
+            store_masked(&alu->dst[l], result, m);
+        } else {
+            store_masked(&alu->dst[l], result, m);
+            if (alu->flag) {
+                store_masked(&alu->flag[l], flag, m);
+            }
+        }
+    }
+}
+
+static AVX2 void tick_avx2(uint8_t *timer, const uint8_t *mask, size_t lanes) {
+    const __m256i ticks = _mm256_set1_epi8(TIMER_TICKS_PER_FRAME);
+
+    for (size_t l = 0; l < lanes; l += BATCH_BLOCK) {
+        __m256i value = load_column(&timer[l]);
+        store_masked(&timer[l], _mm256_subs_epu8(value, ticks), load_column(&mask[l]));
+    }
+}
+
+#endif
+
+static void run_alu(struct batch *batch, const struct alu *alu) {
+#if BATCH_HAVE_AVX2
+    if (batch->use_avx2) {
+        alu_avx2(alu, batch->mask, batch->cond, batch->lanes);
+        return;
+    }
+#endif
+    alu_scalar(alu, batch->mask, batch->cond, batch->lanes);
+}
+
+static void tick_timer(struct batch *batch, uint8_t *timer) {
+#if BATCH_HAVE_AVX2
+    if (batch->use_avx2) {
+        tick_avx2(timer, batch->mask, batch->lanes);
+        return;
+    }
+#endif
+    tick_scalar(timer, batch->mask, batch->lanes);
+}
+
+static void *alloc_column(size_t lanes, size_t size) {
+    return aligned_alloc(BATCH_BLOCK, lanes * size);
+}
+
+/*
+ * Copies the column registers into the lane's VM.
+ */
+static void load_lane(struct batch *batch, size_t lane) {
+    struct chip8 *vm = &batch->vms[lane];
+
+    for (int r = 0; r < 16; ++r) {
+        vm->reg_v[r] = batch->reg_v[r][lane];
+    }
+    vm->reg_dt = batch->reg_dt[lane];
+    vm->reg_st = batch->reg_st[lane];
+    vm->reg_i = batch->reg_i[lane];
+    vm->pc = batch->pc[lane];
+}
+
+static void store_lane(struct batch *batch, size_t lane) {
+    const struct chip8 *vm = &batch->vms[lane];
+
+    batch->live[lane] = vm->error || vm->awaiting_input ? 0 : 0xFF;
+    batch->written_pages |= vm->owned_pages;
+    for (int r = 0; r < 16; ++r) {
+        batch->reg_v[r][lane] = vm->reg_v[r];
+    }
+    batch->reg_dt[lane] = vm->reg_dt;
+    batch->reg_st[lane] = vm->reg_st;
+    batch->reg_i[lane] = vm->reg_i;
+    batch->pc[lane] = vm->pc;
+}
+
+void batch_init(struct batch *batch, struct rom_image *image, size_t count,
+        enum quirk_profile profile) {
+    memset(batch, 0, sizeof(*batch));
+    batch->count = count;
+    batch->image = image;
+    batch->prog_mem_end = PROG_MEM_START + image->program_size;
+    if (batch->prog_mem_end > RAM_SIZE - 1) {
+        batch->prog_mem_end = RAM_SIZE - 1;
+    }
+    batch->lanes = (count + BATCH_BLOCK - 1) / BATCH_BLOCK * BATCH_BLOCK;
+    batch->profile = profile < PROFILE_COUNT ? profile : PROFILE_DEFAULT;
+    batch->cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+#if BATCH_HAVE_AVX2
+    batch->use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    for (int r = 0; r < 16; ++r) {
+        batch->reg_v[r] = alloc_column(batch->lanes, sizeof(uint8_t));
+    }
+    batch->reg_dt = alloc_column(batch->lanes, sizeof(uint8_t));
+    batch->reg_st = alloc_column(batch->lanes, sizeof(uint8_t));
+    batch->reg_i = alloc_column(batch->lanes, sizeof(uint16_t));
+    batch->pc = alloc_column(batch->lanes, sizeof(uint16_t));
+    batch->live = alloc_column(batch->lanes, sizeof(uint8_t));
+    batch->instruction = alloc_column(batch->lanes, sizeof(uint16_t));
+    batch->pending = alloc_column(batch->lanes, sizeof(uint8_t));
+    batch->mask = alloc_column(batch->lanes, sizeof(uint8_t));
+    batch->cond = alloc_column(batch->lanes, sizeof(uint8_t));
+    batch->vms = calloc(count, sizeof(struct chip8));
+
+    // Padding lanes are never selected; keep their columns defined.
+    for (int r = 0; r < 16; ++r) {
+        memset(batch->reg_v[r], 0, batch->lanes);
+    }
+    memset(batch->reg_dt, 0, batch->lanes);
+    memset(batch->reg_st, 0, batch->lanes);
+    memset(batch->live, 0, batch->lanes);
+    memset(batch->pending, 0, batch->lanes);
+    memset(batch->mask, 0, batch->lanes);
+
+    for (size_t l = 0; l < count; ++l) {
+        vm_init_shared(&batch->vms[l], image);
+        batch->vms[l].profile = batch->profile;
+        store_lane(batch, l);
+    }
+}
+
+void batch_free(struct batch *batch) {
+    for (size_t l = 0; l < batch->count; ++l) {
+        vm_release(&batch->vms[l]);
+    }
+    for (int r = 0; r < 16; ++r) {
+        free(batch->reg_v[r]);
+    }
+    free(batch->reg_dt);
+    free(batch->reg_st);
+    free(batch->reg_i);
+    free(batch->pc);
+    free(batch->live);
+    free(batch->instruction);
+    free(batch->pending);
+    free(batch->mask);
+    free(batch->cond);
+    free(batch->vms);
+    memset(batch, 0, sizeof(*batch));
+}
+
+bool batch_fork_lane(struct batch *batch, size_t lane, struct chip8 *vm) {
+    if (vm->image != batch->image) {
+        return false;
+    }
+    vm_release(&batch->vms[lane]);
+    vm_fork(&batch->vms[lane], vm);
+    batch->vms[lane].profile = batch->profile;
+    store_lane(batch, lane);
+    return true;
+}
+
+void batch_set_keypad(struct batch *batch, size_t lane, uint16_t keypad) {
+    load_lane(batch, lane);
+    vm_set_keypad(&batch->vms[lane], keypad);
+    store_lane(batch, lane);
+}
+
+struct chip8 *batch_vm(struct batch *batch, size_t lane) {
+    load_lane(batch, lane);
+    return &batch->vms[lane];
+}
+
+/*
+ * Checks whether every live lane is at the same PC in code no lane has
+ * written to. If so, fetches the instruction from the shared image and
+ * selects all live lanes.
+ */
+static bool select_converged(struct batch *batch, uint16_t *instruction) {
+    uint16_t pc = 0;
+    uint16_t diverged = 0;
+    size_t l = 0;
+
+    while (l < batch->count && !batch->live[l]) {
+        ++l;
+    }
+    if (l == batch->count) {
+        return false;
+    }
+    pc = batch->pc[l];
+    for (; l < batch->count; ++l) {
+        diverged |= (batch->pc[l] ^ pc) & -(uint16_t) (batch->live[l] & 1);
+    }
+    uint16_t code_pages = 1 << (pc / RAM_PAGE_SIZE) | 1 << ((pc + 1) / RAM_PAGE_SIZE);
+    if (diverged || (batch->written_pages & code_pages)) {
+        return false;
+    }
+
+    *instruction = batch->image->ram[pc] << 8 | batch->image->ram[pc + 1];
+    for (l = 0; l < batch->count; ++l) {
+        batch->mask[l] = batch->live[l];
+        batch->pc[l] += batch->live[l] & 2;
+    }
+    return true;
+}
+
+/*
+ * Fetches the next instruction of every live lane from its own pages.
+ */
+static void fetch(struct batch *batch) {
+    for (size_t l = 0; l < batch->count; ++l) {
+        batch->pending[l] = batch->live[l];
+        if (batch->pending[l]) {
+            const struct chip8 *vm = &batch->vms[l];
+            uint16_t pc = batch->pc[l];
+            batch->instruction[l] = vm_read(vm, pc) << 8 | vm_read(vm, pc + 1);
+        }
+    }
+}
+
+/*
+ * Masks the pending lanes that are at the same PC and instruction as
+ * `lead` and advances their PC past the instruction.
+ */
+static void select_group(struct batch *batch, size_t lead) {
+    uint16_t pc = batch->pc[lead];
+    uint16_t instruction = batch->instruction[lead];
+
+    for (size_t l = 0; l < batch->count; ++l) {
+        bool member = batch->pending[l] && batch->pc[l] == pc &&
+            batch->instruction[l] == instruction;
+        batch->mask[l] = member ? 0xFF : 0;
+        if (member) {
+            batch->pending[l] = 0;
+            batch->pc[l] += 2;
+        }
+    }
+}
+
+static void skip_on_cond(struct batch *batch) {
+    for (size_t l = 0; l < batch->count; ++l) {
+        batch->pc[l] += batch->cond[l] & 2;
+    }
+}
+
+static void run_group_scalar(struct batch *batch, uint16_t instruction) {
+    for (size_t l = 0; l < batch->count; ++l) {
+        if (batch->mask[l]) {
+            load_lane(batch, l);
+            run_instruction_with_profile(&batch->vms[l], batch->profile, instruction);
+            store_lane(batch, l);
+        }
+    }
+}
+
+/*
+ * Describes `instruction` as a column operation. Returns false for the
+ * instructions left to the scalar interpreter.
+ */
+static bool column_op(struct batch *batch, uint16_t instruction, struct alu *alu) {
+    const struct quirks *quirks = &profile_quirks[batch->profile];
+    uint8_t x = REG_1(instruction);
+    uint8_t y = REG_2(instruction);
+
+    *alu = (struct alu) {
+        .dst = batch->reg_v[x],
+        .a = batch->reg_v[x],
+        .imm = LOW_BYTE(instruction),
+        .flag_first = quirks->legacy_flags,
+        .strict = quirks->legacy_flags
+    };
+
+    switch (HIGH_NIBBLE(instruction)) {
+        case 3:
+        case 4:
+            alu->op = HIGH_NIBBLE(instruction) == 3 ? ALU_EQ : ALU_NE;
+            alu->dst = NULL;
+            return true;
+        case 5:
+        case 9:
+            alu->op = HIGH_NIBBLE(instruction) == 5 ? ALU_EQ : ALU_NE;
+            alu->dst = NULL;
+            alu->b = batch->reg_v[y];
+            return LOW_NIBBLE(instruction) == 0;
+        case 6:
+            alu->op = ALU_LOAD;
+            return true;
+        case 7:
+            alu->op = ALU_ADD;
+            return true;
+        case 8:
+            alu->b = batch->reg_v[y];
+            alu->flag = batch->reg_v[0xF];
+            switch (LOW_NIBBLE(instruction)) {
+                case 0:
+                    alu->op = ALU_LOAD;
+                    alu->flag = NULL;
+                    return true;
+                case 1:
+                case 2:
+                case 3:
+                    alu->op = LOW_NIBBLE(instruction) == 1 ? ALU_OR :
+                        LOW_NIBBLE(instruction) == 2 ? ALU_AND : ALU_XOR;
+                    alu->flag = quirks->vf_reset ? batch->reg_v[0xF] : NULL;
+                    alu->flag_first = false;
+                    return true;
+                case 4:
+                    alu->op = ALU_ADD_CARRY;
+                    return true;
+                case 5:
+                    alu->op = ALU_SUB;
+                    return true;
+                case 6:
+                case 0xE:
+                    alu->op = LOW_NIBBLE(instruction) == 6 ? ALU_SHR : ALU_SHL;
+                    alu->a = quirks->shift_vy ? batch->reg_v[y] : batch->reg_v[x];
+                    return true;
+                case 7:
+                    alu->op = ALU_SUBN;
+                    return true;
+                default:
+                    return false;
+            }
+        case 0xF:
+            alu->op = ALU_LOAD;
+            alu->b = batch->reg_dt;
+            return LOW_BYTE(instruction) == 0x07;
+        default:
+            return false;
+    }
+}
+
+static void run_group(struct batch *batch, uint16_t instruction) {
+    struct alu alu;
+
+    switch (HIGH_NIBBLE(instruction)) {
+        case 1:
+            for (size_t l = 0; l < batch->count; ++l) {
+                if (batch->mask[l]) {
+                    batch->pc[l] = MEM_ADDR(instruction);
+                }
+            }
+            return;
+        case 0xA:
+            for (size_t l = 0; l < batch->count; ++l) {
+                if (batch->mask[l]) {
+                    batch->reg_i[l] = MEM_ADDR(instruction);
+                }
+            }
+            return;
+    }
+    if ((instruction & 0xF0FF) == 0xF01E) {
+        const uint8_t *v = batch->reg_v[REG_1(instruction)];
+        for (size_t l = 0; l < batch->count; ++l) {
+            if (batch->mask[l]) {
+                batch->reg_i[l] += v[l];
+            }
+        }
+        return;
+    }
+
+    if (!column_op(batch, instruction, &alu)) {
+        run_group_scalar(batch, instruction);
+        return;
+    }
+    run_alu(batch, &alu);
+    if (!alu.dst) {
+        skip_on_cond(batch);
+    }
+}
+
+static void check_bounds(struct batch *batch) {
+    uint16_t span = batch->prog_mem_end - PROG_MEM_START;
+    uint8_t out = 0;
+
+    for (size_t l = 0; l < batch->count; ++l) {
+        out |= ((uint16_t) (batch->pc[l] - PROG_MEM_START) >= span) & batch->mask[l];
+    }
+    if (!out) {
+        return;
+    }
+    for (size_t l = 0; l < batch->count; ++l) {
+        if (batch->mask[l] && (uint16_t) (batch->pc[l] - PROG_MEM_START) >= span) {
+            batch->vms[l].error = ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS;
+            batch->live[l] = 0;
+        }
+    }
+}
+
+void batch_run_cycles(struct batch *batch, int cycles) {
+    uint16_t instruction;
+
+    for (int cycle = 0; cycle < cycles; ++cycle) {
+        if (select_converged(batch, &instruction)) {
+            run_group(batch, instruction);
+            check_bounds(batch);
+            continue;
+        }
+
+        fetch(batch);
+        bool ran = false;
+        for (size_t lead = 0; lead < batch->count; ++lead) {
+            if (batch->pending[lead]) {
+                instruction = batch->instruction[lead];
+                select_group(batch, lead);
+                run_group(batch, instruction);
+                check_bounds(batch);
+                ran = true;
+            }
+        }
+        if (!ran) {
+            break;
+        }
+    }
+}
+
+void batch_run_frame(struct batch *batch) {
+    batch_run_cycles(batch, batch->cycles_per_frame);
+
+    for (size_t l = 0; l < batch->count; ++l) {
+        batch->mask[l] = batch->vms[l].awaiting_input ? 0 : 0xFF;
+    }
+    tick_timer(batch, batch->reg_dt);
+    tick_timer(batch, batch->reg_st);
+}
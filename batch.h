@@ -0,0 +1,91 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "machine.h"
+
+/* Lanes are padded to whole AVX2 registers of byte columns. */
+#define BATCH_BLOCK 32
+
+/*
+ * Many VMs running one ROM image in lockstep under one quirk profile.
+ *
+ * The hot registers (V0-VF, I, PC, DT, ST) are stored column-wise, one
+ * array per register indexed by lane. Each cycle the lanes are grouped
+ * by (PC, instruction); register and skip instructions run for a whole
+ * group at once with AVX2 (or plain loops on CPUs without it), and
+ * everything else runs per lane through the regular interpreter on the
+ * lane's struct chip8, which also holds its stack, keypad, random state,
+ * framebuffer and copy-on-write RAM pages.
+ *
+ * While every running lane is at the same PC in code no lane has written
+ * to, the instruction is fetched once from the shared image and the
+ * lanes' structs are not touched at all.
+ *
+ * The columns are authoritative for the hot registers; batch_vm() copies
+ * them into the lane's struct before returning it.
+ */
+struct batch {
+    size_t count;
+    size_t lanes;
+    struct rom_image *image;
+    enum quirk_profile profile;
+    int cycles_per_frame;
+    bool use_avx2;
+    uint16_t prog_mem_end;
+    // Pages any lane holds a private copy of.
+    uint16_t written_pages;
+
+    uint8_t *reg_v[16];
+    uint8_t *reg_dt;
+    uint8_t *reg_st;
+    uint16_t *reg_i;
+    uint16_t *pc;
+
+    struct chip8 *vms;
+    // 0xFF for lanes without an error or pending Fx0A.
+    uint8_t *live;
+
+    // Per-cycle scratch columns.
+    uint16_t *instruction;
+    uint8_t *pending;
+    uint8_t *mask;
+    uint8_t *cond;
+};
+
+/*
+ * Starts `count` lanes on `image`. Uses AVX2 when the CPU has it.
+ */
+void batch_init(struct batch *batch, struct rom_image *image, size_t count,
+        enum quirk_profile profile);
+
+void batch_free(struct batch *batch);
+
+/*
+ * Replaces a lane with a fork of `vm` (see vm_fork()). Returns false if
+ * `vm` was not started from the batch's image.
+ */
+bool batch_fork_lane(struct batch *batch, size_t lane, struct chip8 *vm);
+
+void batch_set_keypad(struct batch *batch, size_t lane, uint16_t keypad);
+
+/*
+ * Runs up to `cycles` instructions on every lane; lanes stop early on an
+ * error or a pending Fx0A, as with run_cycles().
+ */
+void batch_run_cycles(struct batch *batch, int cycles);
+
+/*
+ * Runs one frame on every lane, as vm_run_frame() does.
+ */
+void batch_run_frame(struct batch *batch);
+
+/*
+ * Returns the lane's VM with its registers brought up to date. Changes
+ * made through the pointer are not seen by the batch.
+ */
+struct chip8 *batch_vm(struct batch *batch, size_t lane);
+
+#endif
@@ -0,0 +1,352 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include "machine.h"
+#include "instructions.h"
+#include "batch.h"
+#include "native.h"
+#include "perfctr.h"
+#include "telemetry.h"
+
+/*
+ * Benchmark harness with hardware performance counters. 'bench rom'
+ * runs the ROM for a number of frames on each engine and reports, per
+ * emulated instruction, the wall time and the host's cycles,
+ * instructions, branch misses and L1d read misses, plus IPC and the
+ * branch miss rate:
+ *
+ *   interpreter   the per-profile switch from dispatch.h
+ *   batch         the lockstep engine, per lane instruction (-l lanes)
+ *   native        a shared object from 'recompile' (-n rom.so)
+ *
+ * 'bench -F' runs synthetic kernels instead: a loop of one instruction
+ * family followed by a jump back, so the counters can be pinned on a
+ * family of opcodes rather than a ROM's mix.
+ *
+ * Counters come from perf_event_open(2); where they are unavailable
+ * (no PMU, perf_event_paranoid too high) only the times are reported.
+ */
+
+#define DEFAULT_FRAMES 20000
+#define DEFAULT_LANES 64
+#define KERNEL_LENGTH 128
+// Kernels have no frame structure; long frames keep per-frame work out of the numbers.
+#define KERNEL_CYCLES_PER_FRAME 1000
+
+struct engine_result {
+    uint64_t instructions;
+    uint64_t ns;
+    struct perf_sample counters;
+};
+
+/*
+ * A loop body of KERNEL_LENGTH instructions taken round-robin from
+ * `pattern`.
+ */
+struct family {
+    const char *name;
+    const uint16_t *pattern;
+    size_t length;
+};
+
+// Skips compare against values the registers really hold, so about half
+// of them are taken and the host's branch predictor has work to do.
+static const uint16_t pattern_cls[] = { 0x00E0 };
+static const uint16_t pattern_load[] = { 0x6012, 0x6134, 0x6256, 0x6378 };
+static const uint16_t pattern_add[] = { 0x7001, 0x7103, 0x7205, 0x7307 };
+static const uint16_t pattern_alu[] = {
+    0x8010, 0x8121, 0x8232, 0x8303, 0x8014, 0x8125, 0x8236, 0x8307, 0x801E
+};
+static const uint16_t pattern_skip[] = { 0x7001, 0x3001, 0x4101, 0x5010, 0x9120 };
+static const uint16_t pattern_index[] = { 0xA300, 0xF01E, 0xF129, 0xA2F0 };
+static const uint16_t pattern_draw[] = { 0xA000, 0xD015, 0x7005, 0xD125 };
+static const uint16_t pattern_memory[] = { 0xA400, 0xF033, 0xF355, 0xF365 };
+static const uint16_t pattern_random[] = { 0xC0FF, 0xC10F, 0xC2F0 };
+static const uint16_t pattern_timers[] = { 0xF015, 0xF007, 0xF118, 0xF107 };
+static const uint16_t pattern_keys[] = { 0xE09E, 0xE1A1 };
+
+static const struct family families[] = {
+    { "cls", pattern_cls, sizeof(pattern_cls) / sizeof(uint16_t) },
+    { "ld vx,kk", pattern_load, sizeof(pattern_load) / sizeof(uint16_t) },
+    { "add vx,kk", pattern_add, sizeof(pattern_add) / sizeof(uint16_t) },
+    { "alu 8xyn", pattern_alu, sizeof(pattern_alu) / sizeof(uint16_t) },
+    { "skips", pattern_skip, sizeof(pattern_skip) / sizeof(uint16_t) },
+    { "index", pattern_index, sizeof(pattern_index) / sizeof(uint16_t) },
+    { "drw", pattern_draw, sizeof(pattern_draw) / sizeof(uint16_t) },
+    { "bcd/ld [i]", pattern_memory, sizeof(pattern_memory) / sizeof(uint16_t) },
+    { "rnd", pattern_random, sizeof(pattern_random) / sizeof(uint16_t) },
+    { "timers", pattern_timers, sizeof(pattern_timers) / sizeof(uint16_t) },
+    { "keys", pattern_keys, sizeof(pattern_keys) / sizeof(uint16_t) },
+};
+
+#define FAMILY_COUNT (sizeof(families) / sizeof(families[0]))
+
+static struct perf_counters counters;
+static bool have_counters;
+
+static void sample(struct perf_sample *sample) {
+    if (have_counters) {
+        perf_counters_read(&counters, sample);
+    } else {
+        memset(sample, 0, sizeof(*sample));
+    }
+}
+
+static void finish(struct engine_result *result, const struct perf_sample *before,
+        uint64_t start) {
+    struct perf_sample after;
+
+    sample(&after);
+    result->ns = telemetry_now() - start;
+    perf_sample_delta(before, &after, &result->counters);
+}
+
+static void run_interpreter(struct chip8 *vm, uint32_t frames, struct engine_result *result) {
+    struct perf_sample before;
+    uint64_t keys = 1;
+
+    memset(result, 0, sizeof(*result));
+    sample(&before);
+    uint64_t start = telemetry_now();
+    for (uint32_t frame = 0; frame < frames && !vm->error; ++frame) {
+        if (frame % KEYPAD_SCRIPT_PERIOD == 0) {
+            vm_set_keypad(vm, scripted_keypad(&keys, frame));
+        }
+        result->instructions += run_cycles(vm, vm->cycles_per_frame);
+        vm_end_frame(vm);
+    }
+    finish(result, &before, start);
+}
+
+/*
+ * Lanes that stop partway through a frame are counted for the whole
+ * frame, so the count is an upper bound once lanes start failing.
+ */
+static void run_batch(struct batch *batch, uint32_t frames, struct engine_result *result) {
+    struct perf_sample before;
+    uint64_t keys = 1;
+
+    memset(result, 0, sizeof(*result));
+    sample(&before);
+    uint64_t start = telemetry_now();
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+        size_t live = 0;
+        for (size_t lane = 0; lane < batch->count; ++lane) {
+            live += batch->live[lane] != 0;
+        }
+        if (live == 0) {
+            break;
+        }
+        if (frame % KEYPAD_SCRIPT_PERIOD == 0) {
+            uint16_t keypad = scripted_keypad(&keys, frame);
+            for (size_t lane = 0; lane < batch->count; ++lane) {
+                batch_set_keypad(batch, lane, keypad);
+            }
+        }
+        batch_run_frame(batch);
+        result->instructions += live * batch->cycles_per_frame;
+    }
+    finish(result, &before, start);
+}
+
+static void print_header(void) {
+    printf("%-12s %-11s %12s %9s %9s %9s %6s %9s %10s\n", "engine", "workload",
+            "instructions", "ns/instr", "cyc/instr", "ins/instr", "IPC", "br-miss%",
+            "L1d/1k");
+}
+
+static void print_count(const struct engine_result *result, enum perf_counter counter) {
+    if (result->counters.valid[counter] && result->instructions) {
+        printf(" %9.2f", (double) result->counters.values[counter] / result->instructions);
+    } else {
+        printf(" %9s", "n/a");
+    }
+}
+
+static void print_result(const char *engine, const char *workload,
+        const struct engine_result *result) {
+    double ipc = perf_ratio(&result->counters, PERF_INSTRUCTIONS, PERF_CYCLES);
+    double misses = perf_ratio(&result->counters, PERF_BRANCH_MISSES, PERF_BRANCHES);
+
+    printf("%-12s %-11s %12" PRIu64 " %9.2f", engine, workload, result->instructions,
+            result->instructions ? (double) result->ns / result->instructions : 0.0);
+    print_count(result, PERF_CYCLES);
+    print_count(result, PERF_INSTRUCTIONS);
+    if (ipc >= 0) {
+        printf(" %6.2f", ipc);
+    } else {
+        printf(" %6s", "n/a");
+    }
+    if (misses >= 0) {
+        printf(" %9.2f", misses * 100);
+    } else {
+        printf(" %9s", "n/a");
+    }
+    if (result->counters.valid[PERF_L1D_MISSES] && result->instructions) {
+        printf(" %10.2f\n",
+                result->counters.values[PERF_L1D_MISSES] * 1000.0 / result->instructions);
+    } else {
+        printf(" %10s\n", "n/a");
+    }
+}
+
+static void bench_image(const char *workload, const uint8_t *program, size_t size,
+        enum quirk_profile profile, int cycles_per_frame, uint32_t frames, size_t lanes,
+        const struct native_program *native) {
+    struct rom_image *image = rom_image_create(program, size);
+    struct engine_result result;
+    struct chip8 vm;
+
+    vm_init_shared(&vm, image);
+    vm.profile = profile;
+    vm.cycles_per_frame = cycles_per_frame;
+    vm_seed_random(&vm, 1);
+    run_interpreter(&vm, frames, &result);
+    print_result("interpreter", workload, &result);
+    vm_release(&vm);
+
+    if (native) {
+        vm_init_shared(&vm, image);
+        vm.profile = profile;
+        vm.cycles_per_frame = cycles_per_frame;
+        vm_seed_random(&vm, 1);
+        if (!native_attach(&vm, native)) {
+            printf("The shared object was translated from another ROM or profile.\n");
+            exit(1);
+        }
+        run_interpreter(&vm, frames, &result);
+        print_result("native", workload, &result);
+        vm_release(&vm);
+    }
+
+    if (lanes) {
+        struct batch batch;
+        batch_init(&batch, image, lanes, profile);
+        batch.cycles_per_frame = cycles_per_frame;
+        run_batch(&batch, frames, &result);
+        print_result("batch", workload, &result);
+        batch_free(&batch);
+    }
+
+    rom_image_release(image);
+}
+
+static void bench_families(enum quirk_profile profile, int cycles_per_frame, uint32_t frames,
+        size_t lanes) {
+    uint8_t program[KERNEL_LENGTH * 2 + 4];
+
+    for (size_t f = 0; f < FAMILY_COUNT; ++f) {
+        const struct family *family = &families[f];
+        for (size_t i = 0; i < KERNEL_LENGTH; ++i) {
+            uint16_t instruction = family->pattern[i % family->length];
+            program[2 * i] = instruction >> 8;
+            program[2 * i + 1] = instruction & 0xFF;
+        }
+        // JP 0x200, twice so a skip at the end of the body lands on one.
+        for (size_t i = KERNEL_LENGTH; i < KERNEL_LENGTH + 2; ++i) {
+            program[2 * i] = 0x12;
+            program[2 * i + 1] = 0x00;
+        }
+        bench_image(family->name, program, sizeof(program), profile, cycles_per_frame, frames,
+                lanes, NULL);
+    }
+}
+
+void print_usage(void) {
+    puts("Usage: bench [-q profile] [-c cycles] [-f frames] [-l lanes] [-n rom.so] rom");
+    puts("       bench -F [-q profile] [-c cycles] [-f frames] [-l lanes]");
+}
+
+int main(int argc, char **argv) {
+    enum quirk_profile profile = PROFILE_DEFAULT;
+    const char *library = NULL;
+    uint32_t frames = DEFAULT_FRAMES;
+    size_t lanes = DEFAULT_LANES;
+    int cycles_per_frame = 0;
+    bool synthetic = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q:c:f:l:n:F")) != -1) {
+        switch (opt) {
+            case 'q':
+                if (!parse_profile(optarg, &profile)) {
+                    printf("Unknown quirk profile %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'c':
+                cycles_per_frame = atoi(optarg);
+                break;
+            case 'f':
+                frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                lanes = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                library = optarg;
+                break;
+            case 'F':
+                synthetic = true;
+                break;
+            default:
+                print_usage();
+                exit(1);
+        }
+    }
+    if (!synthetic && optind >= argc) {
+        print_usage();
+        exit(0);
+    }
+
+    have_counters = perf_counters_open(&counters);
+    if (!have_counters) {
+        printf("Hardware counters unavailable (%s); reporting times only.\n",
+                strerror(counters.error));
+    } else if (counters.open_count < PERF_COUNTER_COUNT) {
+        for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+            if (counters.slots[i] < 0) {
+                printf("Counter %s unavailable.\n", perf_counter_name(i));
+            }
+        }
+    }
+    print_header();
+
+    if (synthetic) {
+        bench_families(profile, cycles_per_frame > 0 ? cycles_per_frame : KERNEL_CYCLES_PER_FRAME,
+                frames, lanes);
+    } else {
+        struct native_program *native = NULL;
+        uint8_t program[RAM_SIZE - PROG_MEM_START];
+        FILE *fp = fopen(argv[optind], "r");
+        if (fp == NULL) {
+            printf("Cannot open file %s.\n", argv[optind]);
+            exit(1);
+        }
+        size_t size = fread(program, 1, sizeof(program), fp);
+        fclose(fp);
+
+        if (library) {
+            native = malloc(sizeof(struct native_program));
+            if (!native_load(native, library)) {
+                exit(1);
+            }
+        }
+        bench_image(argv[optind], program, size, profile,
+                cycles_per_frame > 0 ? cycles_per_frame : DEFAULT_CYCLES_PER_FRAME, frames, lanes,
+                native);
+        if (native) {
+            native_unload(native);
+            free(native);
+        }
+    }
+
+    if (have_counters) {
+        perf_counters_close(&counters);
+    }
+    return 0;
+}
@@ -0,0 +1,400 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cfg.h"
+#include "instructions.h"
+
+enum cfg_kind cfg_classify(uint16_t instruction) {
+    switch (HIGH_NIBBLE(instruction)) {
+        case 0:
+            if (instruction == CLS) {
+                return CFG_NEXT;
+            }
+            return instruction == RET ? CFG_RETURN : CFG_INVALID;
+        case 1:
+            return CFG_JUMP;
+        case 2:
+            return CFG_CALL;
+        case 3:
+        case 4:
+            return CFG_SKIP;
+        case 5:
+        case 9:
+            return LOW_NIBBLE(instruction) == 0 ? CFG_SKIP : CFG_INVALID;
+        case 8:
+            return LOW_NIBBLE(instruction) <= 7 || LOW_NIBBLE(instruction) == 0xE ?
+                CFG_NEXT : CFG_INVALID;
+        case 0xB:
+            return CFG_COMPUTED;
+        case 0xE:
+            return LOW_BYTE(instruction) == 0x9E || LOW_BYTE(instruction) == 0xA1 ?
+                CFG_SKIP : CFG_INVALID;
+        case 0xF:
+            switch (LOW_BYTE(instruction)) {
+                case 0x07:
+                case 0x15:
+                case 0x18:
+                case 0x1E:
+                case 0x29:
+                case 0x65:
+                    return CFG_NEXT;
+                case 0x0A:
+                    return CFG_WAIT;
+                case 0x33:
+                case 0x55:
+                    return CFG_STORE;
+                default:
+                    return CFG_INVALID;
+            }
+        default:
+            return CFG_NEXT;
+    }
+}
+
+static uint16_t fetch(const uint8_t *ram, uint16_t address) {
+    return ram[address] << 8 | ram[address + 1];
+}
+
+struct worklist {
+    uint16_t addresses[RAM_SIZE];
+    size_t count;
+    bool entries[RAM_SIZE];
+};
+
+static void visit(struct cfg *cfg, struct worklist *work, uint16_t address,
+        uint16_t start, uint16_t end, bool leader) {
+    if (address < start || address >= end) {
+        return;
+    }
+    if (leader) {
+        cfg->flags[address] |= CFG_LEADER;
+    }
+    if (!(cfg->flags[address] & CFG_INSTRUCTION)) {
+        cfg->flags[address] |= CFG_INSTRUCTION | CFG_CODE;
+        cfg->flags[address + 1] |= CFG_CODE;
+        work->addresses[work->count++] = address;
+    }
+}
+
+static void trace(struct cfg *cfg, struct worklist *work, const uint8_t *ram,
+        uint16_t entry, uint16_t start, uint16_t end) {
+    work->count = 0;
+    visit(cfg, work, entry, start, end, true);
+    while (work->count > 0) {
+        uint16_t address = work->addresses[--work->count];
+        uint16_t instruction = fetch(ram, address);
+        uint16_t next = address + 2;
+
+        switch (cfg_classify(instruction)) {
+            case CFG_NEXT:
+                visit(cfg, work, next, start, end, false);
+                break;
+            case CFG_SKIP:
+                visit(cfg, work, next, start, end, true);
+                visit(cfg, work, next + 2, start, end, true);
+                break;
+            case CFG_JUMP:
+                visit(cfg, work, MEM_ADDR(instruction), start, end, true);
+                break;
+            case CFG_CALL:
+                if (MEM_ADDR(instruction) >= start && MEM_ADDR(instruction) < end) {
+                    work->entries[MEM_ADDR(instruction)] = true;
+                }
+                visit(cfg, work, MEM_ADDR(instruction), start, end, true);
+                visit(cfg, work, next, start, end, true);
+                break;
+            case CFG_RETURN:
+                break;
+            case CFG_COMPUTED:
+                cfg->computed_jumps = true;
+                break;
+            case CFG_WAIT:
+            case CFG_STORE:
+            case CFG_INVALID:
+                visit(cfg, work, next, start, end, true);
+                break;
+        }
+    }
+}
+
+static void add_block(struct cfg *cfg, size_t *capacity, struct cfg_block block) {
+    if (cfg->block_count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        cfg->blocks = realloc(cfg->blocks, *capacity * sizeof(struct cfg_block));
+    }
+    cfg->blocks[cfg->block_count++] = block;
+}
+
+static void link_block(struct cfg_block *block, uint16_t instruction) {
+    switch (block->exit) {
+        case CFG_SKIP:
+            block->successors[block->successor_count++] = block->end;
+            block->successors[block->successor_count++] = block->end + 2;
+            break;
+        case CFG_JUMP:
+            block->successors[block->successor_count++] = MEM_ADDR(instruction);
+            break;
+        case CFG_CALL:
+            block->callee = MEM_ADDR(instruction);
+            block->successors[block->successor_count++] = block->end;
+            break;
+        case CFG_RETURN:
+        case CFG_COMPUTED:
+            break;
+        default:
+            block->successors[block->successor_count++] = block->end;
+    }
+}
+
+#define I_UNSET -1
+#define I_UNKNOWN -2
+
+/*
+ * The value of I after running `count` instructions of the block from
+ * `i`. Only Annn sets I to a known value; Fx1E, Fx29 and Fx65 (and Fx55
+ * under some quirks) leave it unknown.
+ */
+static int track_i(const struct cfg_block *block, const uint8_t *ram, int i, int count) {
+    uint16_t address = block->start;
+
+    for (int n = 0; n < count; ++n, address += 2) {
+        uint16_t instruction = fetch(ram, address);
+        if (HIGH_NIBBLE(instruction) == 0xA) {
+            i = MEM_ADDR(instruction);
+        } else if (HIGH_NIBBLE(instruction) == 0xF && (LOW_BYTE(instruction) == 0x1E ||
+                    LOW_BYTE(instruction) == 0x29 || LOW_BYTE(instruction) == 0x55 ||
+                    LOW_BYTE(instruction) == 0x65)) {
+            i = I_UNKNOWN;
+        }
+    }
+    return i;
+}
+
+static bool merge_i(int *into, int i) {
+    int merged = *into == I_UNSET ? i : *into == i ? i : I_UNKNOWN;
+    if (merged == *into) {
+        return false;
+    }
+    *into = merged;
+    return true;
+}
+
+/*
+ * Propagates I forwards along static edges until nothing changes, then
+ * records where each closing Fx33 or Fx55 stores. Subroutines and the
+ * instruction after a call start with I unknown.
+ */
+static void find_stores(struct cfg *cfg, const uint8_t *ram, uint16_t entry) {
+    int *i_in = malloc(cfg->block_count * sizeof(int) + 1);
+    size_t *stack = malloc(cfg->block_count * sizeof(size_t) + 1);
+    bool *queued = calloc(cfg->block_count + 1, sizeof(bool));
+    size_t depth = 0;
+    const struct cfg_block *first = cfg_block_at(cfg, entry);
+
+    for (size_t b = 0; b < cfg->block_count; ++b) {
+        i_in[b] = I_UNSET;
+    }
+    if (first) {
+        i_in[first - cfg->blocks] = I_UNKNOWN;
+        stack[depth++] = first - cfg->blocks;
+        queued[first - cfg->blocks] = true;
+    }
+    while (depth > 0) {
+        size_t b = stack[--depth];
+        const struct cfg_block *block = &cfg->blocks[b];
+        int i_out = track_i(block, ram, i_in[b], block->length);
+
+        queued[b] = false;
+        for (int n = 0; n < block->successor_count; ++n) {
+            const struct cfg_block *next = cfg_block_at(cfg, block->successors[n]);
+            int i = block->exit == CFG_CALL ? I_UNKNOWN : i_out;
+            if (next && merge_i(&i_in[next - cfg->blocks], i) && !queued[next - cfg->blocks]) {
+                queued[next - cfg->blocks] = true;
+                stack[depth++] = next - cfg->blocks;
+            }
+        }
+        const struct cfg_block *callee = block->exit == CFG_CALL ?
+            cfg_block_at(cfg, block->callee) : NULL;
+        if (callee && merge_i(&i_in[callee - cfg->blocks], I_UNKNOWN) &&
+                !queued[callee - cfg->blocks]) {
+            queued[callee - cfg->blocks] = true;
+            stack[depth++] = callee - cfg->blocks;
+        }
+    }
+
+    for (size_t b = 0; b < cfg->block_count; ++b) {
+        struct cfg_block *block = &cfg->blocks[b];
+        if (block->exit != CFG_STORE) {
+            continue;
+        }
+        uint16_t store = fetch(ram, block->end - 2);
+        int address = track_i(block, ram, i_in[b] == I_UNSET ? I_UNKNOWN : i_in[b], block->length - 1);
+
+        block->store_length = LOW_BYTE(store) == 0x33 ? 3 : REG_1(store) + 1;
+        if (address == I_UNKNOWN) {
+            block->store_address = CFG_UNKNOWN_STORE;
+            ++cfg->unknown_stores;
+            continue;
+        }
+        block->store_address = address;
+        for (int n = 0; n < block->store_length && address + n < RAM_SIZE; ++n) {
+            cfg->flags[address + n] |= CFG_WRITTEN;
+        }
+    }
+
+    free(i_in);
+    free(stack);
+    free(queued);
+}
+
+static void add_callee(struct cfg_function *function, uint16_t callee) {
+    for (size_t i = 0; i < function->callee_count; ++i) {
+        if (function->callees[i] == callee) {
+            return;
+        }
+    }
+    function->callees = realloc(function->callees, (function->callee_count + 1) * sizeof(uint16_t));
+    function->callees[function->callee_count++] = callee;
+}
+
+/*
+ * Walks the blocks of the subroutine at `entry`, stepping over calls.
+ */
+static void build_function(struct cfg *cfg, struct cfg_function *function, bool *seen, size_t *stack) {
+    size_t depth = 0;
+    long first = cfg_block_index(cfg, function->entry);
+
+    memset(seen, 0, cfg->block_count * sizeof(bool));
+    if (first < 0) {
+        return;
+    }
+    seen[first] = true;
+    stack[depth++] = first;
+    while (depth > 0) {
+        const struct cfg_block *block = &cfg->blocks[stack[--depth]];
+        ++function->block_count;
+        if (block->exit == CFG_CALL) {
+            add_callee(function, block->callee);
+        }
+        for (int i = 0; i < block->successor_count; ++i) {
+            const struct cfg_block *next = cfg_block_at(cfg, block->successors[i]);
+            if (next && !seen[next - cfg->blocks]) {
+                seen[next - cfg->blocks] = true;
+                stack[depth++] = next - cfg->blocks;
+            }
+        }
+    }
+}
+
+void cfg_build(struct cfg *cfg, const uint8_t *ram, uint16_t entry, uint16_t start, uint16_t end) {
+    struct worklist *work = calloc(1, sizeof(struct worklist));
+    size_t capacity = 0;
+
+    memset(cfg, 0, sizeof(*cfg));
+    if (end > RAM_SIZE - 1) {
+        end = RAM_SIZE - 1;
+    }
+    trace(cfg, work, ram, entry, start, end);
+    work->entries[entry] = true;
+
+    for (uint32_t leader = start; leader < end; ++leader) {
+        if (!(cfg->flags[leader] & CFG_LEADER)) {
+            continue;
+        }
+        struct cfg_block block = { leader, leader, 0, CFG_NEXT, { 0 }, 0, 0, CFG_NO_STORE, 0, false };
+        uint16_t address = leader;
+        uint16_t instruction = 0;
+
+        while (address < end && (cfg->flags[address] & CFG_INSTRUCTION) &&
+                (address == leader || !(cfg->flags[address] & CFG_LEADER))) {
+            instruction = fetch(ram, address);
+            enum cfg_kind kind = cfg_classify(instruction);
+            if (kind == CFG_INVALID) {
+                break;
+            }
+            address += 2;
+            ++block.length;
+            if (kind != CFG_NEXT) {
+                block.exit = kind;
+                break;
+            }
+        }
+        block.end = address;
+        if (block.length > 0) {
+            link_block(&block, instruction);
+            add_block(cfg, &capacity, block);
+        }
+    }
+
+    find_stores(cfg, ram, entry);
+    for (size_t i = 0; i < cfg->block_count; ++i) {
+        struct cfg_block *block = &cfg->blocks[i];
+        for (uint16_t address = block->start; address < block->end; ++address) {
+            block->written |= (cfg->flags[address] & CFG_WRITTEN) != 0;
+        }
+    }
+
+    bool *seen = malloc(cfg->block_count * sizeof(bool) + 1);
+    size_t *stack = malloc(cfg->block_count * sizeof(size_t) + 1);
+    for (uint32_t address = start; address < end; ++address) {
+        if (work->entries[address]) {
+            cfg->functions = realloc(cfg->functions, (cfg->function_count + 1) * sizeof(struct cfg_function));
+            struct cfg_function *function = &cfg->functions[cfg->function_count++];
+            *function = (struct cfg_function) { .entry = address };
+            build_function(cfg, function, seen, stack);
+        }
+    }
+    free(seen);
+    free(stack);
+    free(work);
+}
+
+const struct cfg_block *cfg_block_at(const struct cfg *cfg, uint16_t address) {
+    size_t low = 0;
+    size_t high = cfg->block_count;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (cfg->blocks[middle].start < address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low == cfg->block_count || cfg->blocks[low].start != address) {
+        return NULL;
+    }
+    return &cfg->blocks[low];
+}
+
+long cfg_block_index(const struct cfg *cfg, uint16_t address) {
+    size_t low = 0;
+    size_t high = cfg->block_count;
+
+    // Finds the last block starting at or before the address.
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (cfg->blocks[middle].start <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low == 0 || address >= cfg->blocks[low - 1].end) {
+        return -1;
+    }
+    return low - 1;
+}
+
+void cfg_free(struct cfg *cfg) {
+    for (size_t i = 0; i < cfg->function_count; ++i) {
+        free(cfg->functions[i].callees);
+    }
+    free(cfg->functions);
+    free(cfg->blocks);
+    cfg->functions = NULL;
+    cfg->function_count = 0;
+    cfg->blocks = NULL;
+    cfg->block_count = 0;
+}
@@ -0,0 +1,113 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "machine.h"
+
+/*
+ * Control-flow recovery for a program image. Instead of sweeping the
+ * image linearly, instructions are followed from the entry point along
+ * fallthroughs, skips, jumps and calls, so data between routines is not
+ * mistaken for code. Targets of RET and Bnnn are only known at run
+ * time and are not followed.
+ */
+
+/*
+ * How an instruction passes control on.
+ */
+enum cfg_kind {
+    CFG_NEXT,       // falls through
+    CFG_SKIP,       // 3xkk, 4xkk, 5xy0, 9xy0, Ex9E, ExA1
+    CFG_JUMP,       // 1nnn
+    CFG_CALL,       // 2nnn; the return site is followed too
+    CFG_RETURN,     // 00EE
+    CFG_COMPUTED,   // Bnnn
+    CFG_WAIT,       // Fx0A
+    CFG_STORE,      // Fx33 and Fx55, which may rewrite code
+    CFG_INVALID     // unknown or 0nnn; skipped by the interpreter
+};
+
+/*
+ * Per-address flags. CFG_CODE covers both bytes of every reachable
+ * instruction; program bytes without it are data. CFG_WRITTEN marks
+ * bytes a Fx33 or Fx55 with a statically known I may store to.
+ */
+#define CFG_INSTRUCTION 1
+#define CFG_LEADER 2
+#define CFG_CODE 4
+#define CFG_WRITTEN 8
+
+#define CFG_NO_STORE -1
+#define CFG_UNKNOWN_STORE -2
+
+/*
+ * A straight-line run of `length` instructions from `start` to `end`
+ * (exclusive). Only the last one may transfer control; a block also
+ * ends before the next leader and before an invalid instruction.
+ *
+ * Successors are the static intra-procedural edges: a call's successor
+ * is its return site, with the callee in `callee`. RET and Bnnn have
+ * none. Blocks ending in a store record the first address written
+ * (or CFG_UNKNOWN_STORE when I isn't the same constant on every static
+ * path there) and the number of bytes. `written` is set on blocks that overlap a known
+ * store target, i.e. code that may modify itself.
+ */
+struct cfg_block {
+    uint16_t start;
+    uint16_t end;
+    uint16_t length;
+    enum cfg_kind exit;
+    uint16_t successors[2];
+    int successor_count;
+    uint16_t callee;
+    int store_address;
+    uint8_t store_length;
+    bool written;
+};
+
+/*
+ * A subroutine: the entry point or a call target, with the blocks
+ * reachable from it without following calls and the subroutines it
+ * calls.
+ */
+struct cfg_function {
+    uint16_t entry;
+    size_t block_count;
+    uint16_t *callees;
+    size_t callee_count;
+};
+
+struct cfg {
+    uint8_t flags[RAM_SIZE];
+    struct cfg_block *blocks;
+    size_t block_count;
+    struct cfg_function *functions;
+    size_t function_count;
+    bool computed_jumps;
+    size_t unknown_stores;
+};
+
+enum cfg_kind cfg_classify(uint16_t instruction);
+
+/*
+ * Recovers the blocks reachable from `entry` in ram[start, end), the
+ * call graph and store targets. Blocks and functions are sorted by
+ * address.
+ */
+void cfg_build(struct cfg *cfg, const uint8_t *ram, uint16_t entry, uint16_t start, uint16_t end);
+
+/*
+ * Returns the block starting at `address`, or NULL.
+ */
+const struct cfg_block *cfg_block_at(const struct cfg *cfg, uint16_t address);
+
+/*
+ * Index of the block containing `address`, or -1.
+ */
+long cfg_block_index(const struct cfg *cfg, uint16_t address);
+
+void cfg_free(struct cfg *cfg);
+
+#endif
@@ -2,42 +2,354 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <time.h>
+#include <unistd.h>
 #include <SDL.h>
+#include "framering.h"
 #include "machine.h"
+#include "movie.h"
+#include "native.h"
+#include "romdb.h"
 #include "sdl_system.h"
 #include "screen.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "eventlog.h"
+#include "phosphor.h"
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        puts("Usage: chip8 path/to/rom");
+struct options {
+    const char *rom_filename;
+    const char *movie_filename;
+    const char *romdb_filename;
+    const char *ring_name;
+    const char *trace_filename;
+    const char *telemetry_filename;
+    const char *native_filename;
+    enum quirk_profile profile;
+    bool profile_set;
+    int cycles_per_frame;
+    bool print_info;
+    bool phosphor;
+};
+
+void print_usage(void) {
+    puts("Usage: chip8 [options] path/to/rom");
+    puts("  -q profile  quirk profile: default, chip8, schip or xochip");
+    puts("  -c cycles   instructions per 60 Hz frame");
+    puts("  -d romdb    ROM database (default $" ROMDB_ENV " or " ROMDB_DEFAULT_FILE ")");
+    puts("  -i          print the ROM's database line and exit");
+    puts("  -r movie    record every frame to a delta-encoded movie file");
+    puts("  -s name     export frames to the POSIX shared-memory ring /name");
+    puts("  -t trace    record an execution trace (decode with reader -t)");
+    puts("  -T file     append per-second stats as JSON lines to file (- for stdout)");
+    puts("  -P          blend frames with phosphor persistence against flicker");
+    puts("  -n rom.so   run the ROM's blocks translated by recompile");
+}
+
+void parse_options(int argc, char *argv[], struct options *options) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q:c:d:ir:s:t:T:Pn:")) != -1) {
+        switch (opt) {
+            case 'q':
+                if (!parse_profile(optarg, &options->profile)) {
+                    printf("Unknown quirk profile %s.\n", optarg);
+                    exit(1);
+                }
+                options->profile_set = true;
+                break;
+            case 'c':
+                options->cycles_per_frame = atoi(optarg);
+                break;
+            case 'd':
+                options->romdb_filename = optarg;
+                break;
+            case 'i':
+                options->print_info = true;
+                break;
+            case 'r':
+                options->movie_filename = optarg;
+                break;
+            case 's':
+                options->ring_name = optarg;
+                break;
+            case 't':
+                options->trace_filename = optarg;
+                break;
+            case 'T':
+                options->telemetry_filename = optarg;
+                break;
+            case 'P':
+                options->phosphor = true;
+                break;
+            case 'n':
+                options->native_filename = optarg;
+                break;
+            default:
+                print_usage();
+                exit(1);
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage();
         exit(0);
     }
+    options->rom_filename = argv[optind];
+
+    if (options->romdb_filename == NULL) {
+        options->romdb_filename = getenv(ROMDB_ENV);
+    }
+    if (options->romdb_filename == NULL) {
+        options->romdb_filename = ROMDB_DEFAULT_FILE;
+    }
+}
+
+/*
+ * Applies database settings for the loaded ROM, then any settings
+ * given on the command line.
+ */
+void configure_vm(struct chip8 *vm, const struct options *options) {
+    struct romdb db;
+
+    if (romdb_load(&db, options->romdb_filename)) {
+        const struct rom_info *info = romdb_lookup(&db, vm->rom_hash);
+        if (info) {
+            vm_apply_rom_info(vm, info);
+            if (info->keymap[0]) {
+                set_keymap(info->keymap);
+            }
+        }
+        romdb_free(&db);
+    }
+
+    if (options->profile_set) {
+        vm->profile = options->profile;
+    }
+    if (options->cycles_per_frame > 0) {
+        vm->cycles_per_frame = options->cycles_per_frame;
+    }
+}
+
+/*
+ * Attaches the translated ROM if it was built from this ROM and quirk
+ * profile; otherwise the interpreter runs it, as without -n.
+ */
+void attach_native(struct chip8 *vm, struct native_program *native, const char *filename) {
+    if (!native_load(native, filename)) {
+        printf("Running the interpreter instead.\n");
+    } else if (!native_attach(vm, native)) {
+        printf("%s was translated from another ROM or quirk profile; "
+                "running the interpreter instead.\n", filename);
+        native_unload(native);
+    }
+}
+
+static struct trace trace;
+static struct event_log events;
+static struct movie_writer movie;
+static struct frame_ring ring;
+
+/*
+ * VM errors end the program through exit(), and the trace leading up
+ * to them is the interesting part.
+ */
+static void close_trace(void) {
+    if (!trace_close(&trace)) {
+        printf("Error writing the execution trace.\n");
+    }
+}
+
+/*
+ * Also run on exit(), so the movie gets its index and the shared-memory
+ * object doesn't outlive the emulator.
+ */
+static void close_movie(void) {
+    movie_writer_close(&movie);
+}
+
+static void close_ring(void) {
+    frame_ring_close(&ring);
+}
+
+static void close_events(void) {
+    event_log_close(&events);
+}
+
+/*
+ * Charges one pass of the main loop to the telemetry phases. A pass in
+ * which the VM neither executed an instruction nor reached a frame
+ * boundary was spent waiting.
+ */
+void account_loop(struct telemetry *telemetry, const struct io_state *state,
+        uint64_t instructions, bool frame_done, uint64_t draw_ns, uint64_t times[3]) {
+    uint64_t vm_ns = times[2] - times[1] - draw_ns;
+
+    telemetry_add(telemetry, TELEMETRY_EVENTS, times[1] - times[0]);
+    telemetry_add(telemetry, TELEMETRY_DRAW, draw_ns);
+    telemetry_add(telemetry, instructions || frame_done ? TELEMETRY_VM : TELEMETRY_IDLE, vm_ns);
+    telemetry->instructions += instructions;
+    telemetry->frames += frame_done;
+    telemetry->audio_underruns = audio_underruns(state);
+    telemetry_update(telemetry, times[2]);
+}
+
+/*
+ * Input-to-display latency: from a key press to the presentation of the
+ * first changed frame after the program read that key (see
+ * vm_press_key()). vm_run() measures it when it draws the frame.
+ */
+static struct latency_histogram latency;
+
+static void note_latency(uint64_t ns, struct telemetry *telemetry) {
+    latency_record(&latency, ns);
+    if (telemetry) {
+        latency_record(&telemetry->latency, ns);
+    }
+}
+
+/*
+ * Runs at exit, including exits on VM errors.
+ */
+static void print_latency(void) {
+    const struct latency_histogram *histogram = &latency;
+    if (histogram->samples) {
+        printf("Input latency: %u samples, p50 %.1f ms, p99 %.1f ms\n", histogram->samples,
+                latency_percentile(histogram, 0.5) / 1e6, latency_percentile(histogram, 0.99) / 1e6);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct options options = { .profile = PROFILE_DEFAULT };
+    parse_options(argc, argv, &options);
 
     struct chip8 vm;
     struct io_state state;
+    bool recording = false;
+    bool exporting = false;
+    struct telemetry telemetry;
+    bool measuring = false;
+    static struct phosphor phosphor;
+    static struct native_program native;
 
     clock_t loop_start = clock();
     clock_t temp = 0;
     float dt = 1;
     int keypress = -1;
 
-    vm_init_with_rom(&vm, argv[1]);
+    vm_init_with_rom(&vm, options.rom_filename);
+    configure_vm(&vm, &options);
+    if (options.print_info) {
+        printf("%016" PRIx64 " %s %d\n", vm.rom_hash, profile_name(vm.profile), vm.cycles_per_frame);
+        vm_release(&vm);
+        exit(0);
+    }
+    if (options.native_filename) {
+        attach_native(&vm, &native, options.native_filename);
+    }
+
+    if (options.movie_filename) {
+        recording = movie_writer_open(&movie, options.movie_filename, MOVIE_DEFAULT_KEYFRAME_INTERVAL);
+        if (!recording) {
+            printf("Cannot open movie file %s.\n", options.movie_filename);
+            exit(1);
+        }
+        atexit(close_movie);
+    }
+    if (options.ring_name) {
+        char name[256];
+        snprintf(name, sizeof(name), "/%s", options.ring_name);
+        exporting = frame_ring_create(&ring, name, FRAME_RING_DEFAULT_SLOTS);
+        if (!exporting) {
+            printf("Cannot create shared-memory ring %s.\n", name);
+            exit(1);
+        }
+        atexit(close_ring);
+    }
+    if (options.trace_filename) {
+        if (!trace_open(&trace, options.trace_filename, vm.profile, TRACE_DEFAULT_CAPACITY)) {
+            printf("Cannot open trace file %s.\n", options.trace_filename);
+            exit(1);
+        }
+        vm.trace = &trace;
+        atexit(close_trace);
+    }
+    if (options.telemetry_filename) {
+        measuring = telemetry_open(&telemetry, options.telemetry_filename);
+        if (!measuring) {
+            printf("Cannot open telemetry file %s.\n", options.telemetry_filename);
+            exit(1);
+        }
+    }
+    if (event_log_open(&events, stderr, EVENT_LOG_DEFAULT_CAPACITY, EVENT_LOG_DEFAULT_RATE)) {
+        vm.events = &events;
+        atexit(close_events);
+    }
     init_io(&state, SCREEN_WIDTH_PX, SCREEN_HEIGHT_PX);
-    srand(time(NULL));
+    if (options.phosphor) {
+        phosphor_init(&phosphor, PHOSPHOR_DEFAULT_PERSISTENCE);
+        enable_phosphor(&state, &phosphor);
+    }
+    vm_seed_random(&vm, time(NULL));
+    atexit(print_latency);
 
+    uint64_t times[3] = { 0 };
+    if (measuring) {
+        times[2] = telemetry_now();
+    }
     while (!state.quit) {
+        uint64_t instructions = vm.instructions;
+        uint64_t draw_ns = state.draw_ns;
+
+        // Each pass starts where the last one ended, so the phases
+        // cover all of the wall-clock time.
+        times[0] = times[2];
         handle_events(&state, &keypress);
+        if (state.input_time) {
+            vm_press_key(&vm, state.input_key, state.input_time);
+        }
+        vm.keypad = read_keypad();
 
         if (keypress > -1 && vm.awaiting_input) {
             vm_receive_input(&vm, keypress);
         }
-        vm_run(&vm, dt, &state);
+        if (measuring) {
+            times[1] = telemetry_now();
+        }
+        bool frame_done = vm_run(&vm, dt, &state);
+        if (state.latency_ns) {
+            note_latency(state.latency_ns, measuring ? &telemetry : NULL);
+        }
+        if (frame_done && recording) {
+            movie_write_frame(&movie, &vm.screen);
+        }
+        if (frame_done && exporting) {
+            frame_ring_publish(&ring, &vm);
+        }
 
         temp = clock();
         dt = (temp - loop_start) / (CLOCKS_PER_SEC * 1.f);
         loop_start = temp;
+
+        if (measuring) {
+            times[2] = telemetry_now();
+            account_loop(&telemetry, &state, vm.instructions - instructions, frame_done,
+                    state.draw_ns - draw_ns, times);
+        }
+    }
+
+    if (measuring) {
+        telemetry_close(&telemetry);
+    }
+    if (state.phosphor && phosphor.frames) {
+        printf("Phosphor: %" PRIu64 " frames, mean %.1f us, max %.1f us, %" PRIu64
+                " over the %.0f us budget\n", phosphor.frames,
+                phosphor.total_ns / 1e3 / phosphor.frames, phosphor.max_ns / 1e3,
+                phosphor.over_budget, PHOSPHOR_BUDGET_NS / 1e3);
     }
 
+    vm_release(&vm);
+    native_unload(&native);
     quit_io(&state);
 }
@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "corpus.h"
+#include "machine.h"
+
+#define CORPUS_MAGIC "C8CA"
+#define CORPUS_VERSION 1
+#define CORPUS_HEADER_BYTES 16
+#define CORPUS_ENTRY_BYTES (16 + CORPUS_NAME_LEN)
+
+static void write_u16(FILE *fp, uint16_t value) {
+    fputc(value & 0xFF, fp);
+    fputc(value >> 8, fp);
+}
+
+static void write_u32(FILE *fp, uint32_t value) {
+    write_u16(fp, value & 0xFFFF);
+    write_u16(fp, value >> 16);
+}
+
+static void write_u64(FILE *fp, uint64_t value) {
+    write_u32(fp, value & 0xFFFFFFFF);
+    write_u32(fp, value >> 32);
+}
+
+static uint32_t get_u32(const uint8_t *bytes) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+static uint64_t get_u64(const uint8_t *bytes) {
+    return get_u32(bytes) | (uint64_t) get_u32(bytes + 4) << 32;
+}
+
+static const uint8_t *entry_at(const struct corpus *corpus, uint32_t index) {
+    return corpus->base + CORPUS_HEADER_BYTES + (size_t) index * CORPUS_ENTRY_BYTES;
+}
+
+static void decode_entry(const struct corpus *corpus, const uint8_t *entry,
+        struct corpus_rom *rom) {
+    rom->hash = get_u64(entry);
+    rom->data = corpus->base + get_u32(entry + 8);
+    rom->size = get_u32(entry + 12);
+    rom->name = (const char *) entry + 16;
+}
+
+/*
+ * Checks every index entry once so lookups can trust the mapping.
+ */
+static bool validate(const struct corpus *corpus) {
+    size_t data_start = CORPUS_HEADER_BYTES + (size_t) corpus->count * CORPUS_ENTRY_BYTES;
+    if (data_start > corpus->size) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < corpus->count; ++i) {
+        const uint8_t *entry = entry_at(corpus, i);
+        uint64_t offset = get_u32(entry + 8);
+        uint64_t length = get_u32(entry + 12);
+
+        if (offset < data_start || offset + length > corpus->size ||
+                length > RAM_SIZE - PROG_MEM_START ||
+                entry[16 + CORPUS_NAME_LEN - 1] != '\0' ||
+                (i > 0 && get_u64(entry) < get_u64(entry_at(corpus, i - 1)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool corpus_open(struct corpus *corpus, const char *const filename) {
+    struct stat st;
+
+    memset(corpus, 0, sizeof(*corpus));
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < CORPUS_HEADER_BYTES) {
+        close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    corpus->base = base;
+    corpus->size = st.st_size;
+
+    if (memcmp(corpus->base, CORPUS_MAGIC, 4) != 0 ||
+            (corpus->base[4] | corpus->base[5] << 8) != CORPUS_VERSION) {
+        corpus_close(corpus);
+        return false;
+    }
+    corpus->count = get_u32(corpus->base + 8);
+    if (!validate(corpus)) {
+        corpus_close(corpus);
+        return false;
+    }
+
+    return true;
+}
+
+bool corpus_get(const struct corpus *corpus, uint32_t index, struct corpus_rom *rom) {
+    if (index >= corpus->count) {
+        return false;
+    }
+    decode_entry(corpus, entry_at(corpus, index), rom);
+    return true;
+}
+
+bool corpus_find(const struct corpus *corpus, uint64_t hash, struct corpus_rom *rom) {
+    uint32_t low = 0;
+    uint32_t high = corpus->count;
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        uint64_t middle_hash = get_u64(entry_at(corpus, middle));
+        if (middle_hash < hash) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low == corpus->count || get_u64(entry_at(corpus, low)) != hash) {
+        return false;
+    }
+    decode_entry(corpus, entry_at(corpus, low), rom);
+    return true;
+}
+
+void corpus_close(struct corpus *corpus) {
+    if (corpus->base) {
+        munmap((void *) corpus->base, corpus->size);
+    }
+    corpus->base = NULL;
+    corpus->size = 0;
+    corpus->count = 0;
+}
+
+int corpus_compare_roms(const void *a, const void *b) {
+    uint64_t hash_a = ((const struct corpus_rom *) a)->hash;
+    uint64_t hash_b = ((const struct corpus_rom *) b)->hash;
+    return (hash_a > hash_b) - (hash_a < hash_b);
+}
+
+bool corpus_write(const char *const filename, struct corpus_rom *roms, size_t count) {
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    qsort(roms, count, sizeof(struct corpus_rom), corpus_compare_roms);
+
+    fwrite(CORPUS_MAGIC, 1, 4, fp);
+    write_u16(fp, CORPUS_VERSION);
+    write_u16(fp, 0);
+    write_u32(fp, count);
+    write_u32(fp, 0);
+
+    uint32_t offset = CORPUS_HEADER_BYTES + count * CORPUS_ENTRY_BYTES;
+    for (size_t i = 0; i < count; ++i) {
+        char name[CORPUS_NAME_LEN] = { 0 };
+        strncpy(name, roms[i].name, CORPUS_NAME_LEN - 1);
+
+        write_u64(fp, roms[i].hash);
+        write_u32(fp, offset);
+        write_u32(fp, roms[i].size);
+        fwrite(name, 1, CORPUS_NAME_LEN, fp);
+        offset += roms[i].size;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        fwrite(roms[i].data, 1, roms[i].size, fp);
+    }
+
+    bool ok = !ferror(fp);
+    return fclose(fp) == 0 && ok;
+}
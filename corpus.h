@@ -0,0 +1,59 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CORPUS_NAME_LEN 64
+
+/*
+ * ROM corpus archive layout (all integers little-endian):
+ *
+ *   header  "C8CA", u16 version, u16 reserved, u32 entry count,
+ *           u32 reserved
+ *   index   one 80 byte entry per ROM, sorted by hash: u64 hash_rom()
+ *           of the image, u32 data offset, u32 length, then the name
+ *           NUL-padded to CORPUS_NAME_LEN bytes
+ *   data    the ROM images
+ *
+ * The archive is mapped once; ROMs returned by the reader point into
+ * the mapping and stay valid until corpus_close().
+ */
+struct corpus_rom {
+    const char *name;
+    uint64_t hash;
+    const uint8_t *data;
+    size_t size;
+};
+
+struct corpus {
+    const uint8_t *base;
+    size_t size;
+    uint32_t count;
+};
+
+bool corpus_open(struct corpus *corpus, const char *const filename);
+
+bool corpus_get(const struct corpus *corpus, uint32_t index, struct corpus_rom *rom);
+
+/*
+ * Finds a ROM by image hash with a binary search of the index.
+ */
+bool corpus_find(const struct corpus *corpus, uint64_t hash, struct corpus_rom *rom);
+
+void corpus_close(struct corpus *corpus);
+
+/*
+ * qsort() comparison of two struct corpus_roms by hash, the archive's
+ * index order.
+ */
+int corpus_compare_roms(const void *a, const void *b);
+
+/*
+ * Writes an archive of `count` ROMs. Sorts `roms` by hash; names longer
+ * than CORPUS_NAME_LEN - 1 bytes are truncated.
+ */
+bool corpus_write(const char *const filename, struct corpus_rom *roms, size_t count);
+
+#endif
@@ -0,0 +1,259 @@
+#include <string.h>
+#include "debug.h"
+#include "instructions.h"
+
+static bool is_trap(const struct chip8 *vm, uint16_t address) {
+    return (vm_read(vm, address) << 8 | vm_read(vm, address + 1)) == BREAKPOINT;
+}
+
+static void arm(struct chip8 *vm, struct breakpoint *breakpoint) {
+    breakpoint->saved[0] = vm_read(vm, breakpoint->address);
+    breakpoint->saved[1] = vm_read(vm, breakpoint->address + 1);
+    vm_write(vm, breakpoint->address, BREAKPOINT >> 8);
+    vm_write(vm, breakpoint->address + 1, BREAKPOINT & 0xFF);
+}
+
+/*
+ * Puts the instruction back unless the program has stored over the
+ * trap since, in which case its bytes win.
+ */
+static void disarm(struct chip8 *vm, struct breakpoint *breakpoint) {
+    if (is_trap(vm, breakpoint->address)) {
+        vm_write(vm, breakpoint->address, breakpoint->saved[0]);
+        vm_write(vm, breakpoint->address + 1, breakpoint->saved[1]);
+    }
+}
+
+static struct breakpoint *find(struct debugger *debugger, uint16_t address) {
+    for (int i = 0; i < debugger->breakpoint_count; ++i) {
+        if (debugger->breakpoints[i].address == address) {
+            return &debugger->breakpoints[i];
+        }
+    }
+    return NULL;
+}
+
+void debugger_attach(struct debugger *debugger, struct chip8 *vm) {
+    memset(debugger, 0, sizeof(*debugger));
+    debugger->vm = vm;
+    debugger->cycles_left = vm->cycles_per_frame;
+    vm->watches = &debugger->watches;
+}
+
+void debugger_detach(struct debugger *debugger) {
+    while (debugger->breakpoint_count) {
+        debugger_clear_breakpoint(debugger, debugger->breakpoints[0].address);
+    }
+    debugger->watches.count = 0;
+    debugger->vm->watched_pages = 0;
+    debugger->vm->watches = NULL;
+    if (debugger->vm->error == ERROR_BREAKPOINT || debugger->vm->error == ERROR_WATCHPOINT) {
+        debugger->vm->error = NO_ERROR;
+    }
+}
+
+bool debugger_set_breakpoint(struct debugger *debugger, uint16_t address) {
+    struct chip8 *vm = debugger->vm;
+
+    if (address < PROG_MEM_START || address >= vm->prog_mem_end) {
+        return false;
+    }
+    if (find(debugger, address)) {
+        return true;
+    }
+    if (debugger->breakpoint_count == DEBUG_MAX_BREAKPOINTS) {
+        return false;
+    }
+    // Instructions may be misaligned, so a neighbour's trap can overlap.
+    for (int i = 0; i < debugger->breakpoint_count; ++i) {
+        uint16_t other = debugger->breakpoints[i].address;
+        if (other + 1 == address || address + 1 == other) {
+            return false;
+        }
+    }
+
+    struct breakpoint *breakpoint = &debugger->breakpoints[debugger->breakpoint_count++];
+    breakpoint->address = address;
+    arm(vm, breakpoint);
+    vm->breakpoints_armed = true;
+    return true;
+}
+
+bool debugger_clear_breakpoint(struct debugger *debugger, uint16_t address) {
+    struct breakpoint *breakpoint = find(debugger, address);
+    if (breakpoint == NULL) {
+        return false;
+    }
+
+    disarm(debugger->vm, breakpoint);
+    *breakpoint = debugger->breakpoints[--debugger->breakpoint_count];
+    debugger->vm->breakpoints_armed = debugger->breakpoint_count > 0;
+    return true;
+}
+
+const struct breakpoint *debugger_breakpoint_at(const struct debugger *debugger,
+        uint16_t address) {
+    return find((struct debugger *) debugger, address);
+}
+
+static void update_watched_pages(struct debugger *debugger) {
+    uint16_t pages = 0;
+
+    for (int i = 0; i < debugger->watches.count; ++i) {
+        const struct watchpoint *point = &debugger->watches.points[i];
+        for (int page = point->start / RAM_PAGE_SIZE;
+                page <= (point->start + point->length - 1) / RAM_PAGE_SIZE; ++page) {
+            pages |= 1 << page;
+        }
+    }
+    debugger->vm->watched_pages = pages;
+}
+
+bool debugger_watch(struct debugger *debugger, uint16_t start, uint16_t length, uint8_t access) {
+    struct watch_table *watches = &debugger->watches;
+
+    if (length == 0 || start + length > RAM_SIZE || !(access & (WATCH_READ | WATCH_WRITE)) ||
+            watches->count == MAX_WATCHPOINTS) {
+        return false;
+    }
+    watches->points[watches->count++] = (struct watchpoint) { start, length, access };
+    update_watched_pages(debugger);
+    return true;
+}
+
+bool debugger_unwatch(struct debugger *debugger, uint16_t start) {
+    struct watch_table *watches = &debugger->watches;
+
+    for (int i = 0; i < watches->count; ++i) {
+        if (watches->points[i].start == start) {
+            watches->points[i] = watches->points[--watches->count];
+            update_watched_pages(debugger);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t debugger_read(const struct debugger *debugger, uint16_t address) {
+    const struct chip8 *vm = debugger->vm;
+
+    for (int i = 0; i < debugger->breakpoint_count; ++i) {
+        const struct breakpoint *breakpoint = &debugger->breakpoints[i];
+        uint16_t offset = address - breakpoint->address;
+        if (offset < 2 && is_trap(vm, breakpoint->address)) {
+            return breakpoint->saved[offset];
+        }
+    }
+    return vm_read(vm, address);
+}
+
+/*
+ * Charges `executed` instructions to the current frame and closes it
+ * where vm_run_frame() would: after cycles_per_frame instructions or as
+ * soon as the VM waits for a key.
+ */
+static void account(struct debugger *debugger, int executed) {
+    struct chip8 *vm = debugger->vm;
+
+    debugger->cycles_left -= executed;
+    if (debugger->cycles_left <= 0 || vm->awaiting_input) {
+        vm_end_frame(vm);
+        debugger->cycles_left = vm->cycles_per_frame;
+        ++debugger->frame;
+    }
+}
+
+/*
+ * Sorts out a stop on the trap word. A BREAKPOINT word the debugger
+ * didn't write is part of the program and is skipped like any other
+ * 0nnn; for our own, the trap isn't charged as an instruction.
+ */
+static bool hit_breakpoint(struct debugger *debugger, int *executed) {
+    struct chip8 *vm = debugger->vm;
+
+    if (vm->error != ERROR_BREAKPOINT) {
+        return false;
+    }
+    if (find(debugger, vm->pc) == NULL) {
+        vm->error = NO_ERROR;
+        vm->pc += 2;
+        if (vm->pc >= vm->prog_mem_end) {
+            vm->error = ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS;
+        }
+        return false;
+    }
+    --*executed;
+    return true;
+}
+
+/*
+ * Runs the single instruction at pc with any breakpoint on it lifted.
+ */
+static int run_one(struct debugger *debugger) {
+    struct chip8 *vm = debugger->vm;
+    struct breakpoint *breakpoint = find(debugger, vm->pc);
+
+    if (breakpoint) {
+        disarm(vm, breakpoint);
+    }
+    int executed = run_cycles(vm, 1);
+    if (breakpoint) {
+        arm(vm, breakpoint);
+    }
+    hit_breakpoint(debugger, &executed);
+    return executed;
+}
+
+/*
+ * Clears a previous debugger stop. Returns false if the VM is stopped
+ * on a real error.
+ */
+static bool resume(struct chip8 *vm) {
+    if (vm->error == ERROR_BREAKPOINT || vm->error == ERROR_WATCHPOINT) {
+        vm->error = NO_ERROR;
+    }
+    return !vm->error;
+}
+
+enum debug_stop debugger_step(struct debugger *debugger) {
+    struct chip8 *vm = debugger->vm;
+
+    if (!resume(vm)) {
+        return DEBUG_ERROR;
+    }
+
+    account(debugger, run_one(debugger));
+    if (vm->error) {
+        return vm->error == ERROR_WATCHPOINT ? DEBUG_WATCHPOINT : DEBUG_ERROR;
+    }
+    return vm->awaiting_input ? DEBUG_WAITING : DEBUG_STEPPED;
+}
+
+enum debug_stop debugger_continue(struct debugger *debugger, uint64_t frames) {
+    struct chip8 *vm = debugger->vm;
+    uint64_t end = frames > UINT64_MAX - debugger->frame ? UINT64_MAX : debugger->frame + frames;
+
+    if (!resume(vm)) {
+        return DEBUG_ERROR;
+    }
+
+    if (find(debugger, vm->pc) && debugger->frame < end) {
+        account(debugger, run_one(debugger));
+    }
+    // Nothing runs while the VM waits for a key, so no frames would pass.
+    while (!vm->error && !vm->awaiting_input && debugger->frame < end) {
+        int executed = run_cycles(vm, debugger->cycles_left);
+        if (hit_breakpoint(debugger, &executed)) {
+            debugger->cycles_left -= executed;
+            return DEBUG_BREAKPOINT;
+        }
+        account(debugger, executed);
+    }
+    if (vm->error == ERROR_WATCHPOINT) {
+        return DEBUG_WATCHPOINT;
+    }
+    if (vm->error) {
+        return DEBUG_ERROR;
+    }
+    return vm->awaiting_input ? DEBUG_WAITING : DEBUG_FRAMES_DONE;
+}
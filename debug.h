@@ -0,0 +1,99 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "machine.h"
+
+#define DEBUG_MAX_BREAKPOINTS 64
+
+/*
+ * Breakpoints and single-stepping. Nothing is checked per instruction:
+ * arming a breakpoint writes the BREAKPOINT word over the instruction
+ * (on a private copy of its page), which the dispatcher turns into
+ * ERROR_BREAKPOINT with the pc left on it. Without armed breakpoints
+ * the VM runs exactly as it does without a debugger, and a translated
+ * program falls back to the interpreter only for the patched blocks.
+ *
+ * The patch is visible to the program itself: Fx65 over a breakpoint
+ * reads the trap word, and Fx33/Fx55 over one removes it. Reads through
+ * debugger_read() see the original bytes.
+ *
+ * Watchpoints go in the VM's watch table; the memory instructions only
+ * test the watched-page bitmap, so unwatched pages cost one AND.
+ * Translated code is bypassed while any page is watched.
+ */
+
+struct breakpoint {
+    uint16_t address;
+    uint8_t saved[2];
+};
+
+/*
+ * Frames are counted the way vm_run_frame() runs them, so stopping and
+ * resuming leaves the VM where an uninterrupted run would be.
+ */
+struct debugger {
+    struct chip8 *vm;
+    struct breakpoint breakpoints[DEBUG_MAX_BREAKPOINTS];
+    int breakpoint_count;
+    struct watch_table watches;
+    int cycles_left;
+    uint64_t frame;
+};
+
+enum debug_stop {
+    DEBUG_STEPPED,
+    DEBUG_BREAKPOINT,
+    DEBUG_WATCHPOINT,
+    DEBUG_FRAMES_DONE,
+    DEBUG_WAITING,
+    DEBUG_ERROR
+};
+
+void debugger_attach(struct debugger *debugger, struct chip8 *vm);
+
+/*
+ * Removes every breakpoint, restoring the original instructions, and
+ * every watchpoint.
+ */
+void debugger_detach(struct debugger *debugger);
+
+/*
+ * Fails for addresses outside program memory and when the table is full.
+ * Setting an existing breakpoint succeeds without change.
+ */
+bool debugger_set_breakpoint(struct debugger *debugger, uint16_t address);
+
+bool debugger_clear_breakpoint(struct debugger *debugger, uint16_t address);
+
+const struct breakpoint *debugger_breakpoint_at(const struct debugger *debugger,
+        uint16_t address);
+
+/*
+ * Stops after an instruction whose `access` (WATCH_READ, WATCH_WRITE or
+ * both) touches [start, start + length). Fails when the range leaves
+ * RAM or the table is full.
+ */
+bool debugger_watch(struct debugger *debugger, uint16_t start, uint16_t length, uint8_t access);
+
+bool debugger_unwatch(struct debugger *debugger, uint16_t start);
+
+/*
+ * A RAM byte as the program wrote it, without breakpoint patches.
+ */
+uint8_t debugger_read(const struct debugger *debugger, uint16_t address);
+
+/*
+ * Executes the instruction at pc, stepping over a breakpoint there.
+ */
+enum debug_stop debugger_step(struct debugger *debugger);
+
+/*
+ * Runs until a breakpoint is reached, a watchpoint fires, an error
+ * occurs, the VM waits for a key or `frames` frame boundaries have
+ * passed. A breakpoint at the current pc is stepped over first.
+ */
+enum debug_stop debugger_continue(struct debugger *debugger, uint64_t frames);
+
+#endif
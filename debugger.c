@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "debug.h"
+#include "disasm.h"
+#include "machine.h"
+
+/*
+ * Headless command-line debugger. Commands are read one per line from
+ * stdin; addresses and values are hex.
+ */
+
+#define LIST_DEFAULT_COUNT 8
+#define DUMP_DEFAULT_LENGTH 64
+
+void print_usage(void) {
+    puts("Usage: debugger [-q profile] [-k cycles] [-b address]... <filename>");
+}
+
+void print_help(void) {
+    puts("  b addr          set a breakpoint");
+    puts("  d addr          delete a breakpoint");
+    puts("  w addr len [rw] stop on reads (r) and/or writes (w, default) of a range");
+    puts("  u addr          delete the watchpoint starting at addr");
+    puts("  i               list breakpoints and watchpoints");
+    puts("  s [count]       step instructions");
+    puts("  c [frames]      continue to a breakpoint or for a number of frames");
+    puts("  r               registers");
+    puts("  m addr [len]    dump memory");
+    puts("  k               call stack");
+    puts("  l [addr] [n]    disassemble, from pc by default");
+    puts("  p keys          set the keypad bitmask");
+    puts("  q               quit");
+}
+
+static uint16_t read_word(const struct debugger *debugger, uint16_t address) {
+    return debugger_read(debugger, address) << 8 | debugger_read(debugger, address + 1);
+}
+
+/*
+ * Disassembles `count` words from `address`, marking breakpoints with
+ * '*' and the pc with '>'.
+ */
+void list(const struct debugger *debugger, uint16_t address, int count) {
+    char line[DISASM_LINE_MAX];
+
+    for (int i = 0; i < count && address < RAM_SIZE - 1; ++i, address += 2) {
+        char *end = format_instruction(line, read_word(debugger, address), address);
+        printf("%c%c %.*s", debugger_breakpoint_at(debugger, address) ? '*' : ' ',
+                address == debugger->vm->pc ? '>' : ' ', (int) (end - line), line);
+    }
+}
+
+void print_registers(const struct chip8 *vm, uint64_t frame) {
+    for (int i = 0; i < 16; ++i) {
+        printf("V%X=%02x%c", i, vm->reg_v[i], i % 8 == 7 ? '\n' : ' ');
+    }
+    printf("PC=%04x I=%04x SP=%x DT=%02x ST=%02x keypad=%04x frame=%" PRIu64 "%s\n",
+            vm->pc, vm->reg_i, vm->sp, vm->reg_dt, vm->reg_st, vm->keypad, frame,
+            vm->awaiting_input ? " (waiting for a key)" : "");
+}
+
+void dump_memory(const struct debugger *debugger, uint16_t address, unsigned length) {
+    for (unsigned i = 0; i < length && address + i < RAM_SIZE; ++i) {
+        if (i % 16 == 0) {
+            printf("%s%04x:", i ? "\n" : "", address + i);
+        }
+        printf(" %02x", debugger_read(debugger, address + i));
+    }
+    putchar('\n');
+}
+
+void print_stack(const struct chip8 *vm) {
+    if (vm->sp == 0) {
+        puts("empty");
+    }
+    for (int i = vm->sp - 1; i >= 0; --i) {
+        printf("#%d %04x\n", vm->sp - 1 - i, vm->stack[i]);
+    }
+}
+
+void report(const struct debugger *debugger, enum debug_stop stop) {
+    const struct chip8 *vm = debugger->vm;
+
+    switch (stop) {
+        case DEBUG_BREAKPOINT:
+            printf("Breakpoint at %04x\n", vm->pc);
+            break;
+        case DEBUG_WATCHPOINT:
+            printf("Watchpoint: %s %04x by\n",
+                    debugger->watches.hit.access == WATCH_READ ? "read of" : "write to",
+                    debugger->watches.hit.address);
+            list(debugger, debugger->watches.hit.pc, 1);
+            break;
+        case DEBUG_WAITING:
+            puts("Waiting for a key");
+            break;
+        case DEBUG_ERROR:
+            printf("Stopped with error %d at %04x\n", vm->error, vm->pc);
+            return;
+        default:
+            break;
+    }
+    list(debugger, vm->pc, 1);
+}
+
+static unsigned long argument(char **cursor, unsigned long fallback) {
+    char *end;
+    unsigned long value = strtoul(*cursor, &end, 16);
+
+    if (end == *cursor) {
+        return fallback;
+    }
+    *cursor = end;
+    return value;
+}
+
+int main(int argc, char **argv) {
+    enum quirk_profile profile = PROFILE_DEFAULT;
+    int cycles_per_frame = 0;
+    uint16_t breakpoints[DEBUG_MAX_BREAKPOINTS];
+    int breakpoint_count = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q:k:b:")) != -1) {
+        switch (opt) {
+            case 'q':
+                if (!parse_profile(optarg, &profile)) {
+                    printf("Unknown quirk profile %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'k':
+                cycles_per_frame = atoi(optarg);
+                break;
+            case 'b':
+                if (breakpoint_count < DEBUG_MAX_BREAKPOINTS) {
+                    breakpoints[breakpoint_count++] = strtoul(optarg, NULL, 16);
+                }
+                break;
+            default:
+                print_usage();
+                exit(1);
+        }
+    }
+    if (optind >= argc) {
+        print_usage();
+        exit(0);
+    }
+
+    struct chip8 vm;
+    struct debugger debugger;
+    char command[256];
+    bool interactive = isatty(STDIN_FILENO);
+
+    vm_init_with_rom(&vm, argv[optind]);
+    vm.profile = profile;
+    if (cycles_per_frame > 0) {
+        vm.cycles_per_frame = cycles_per_frame;
+    }
+    vm_seed_random(&vm, 1);
+    debugger_attach(&debugger, &vm);
+    for (int i = 0; i < breakpoint_count; ++i) {
+        if (!debugger_set_breakpoint(&debugger, breakpoints[i])) {
+            printf("Cannot set a breakpoint at %04x.\n", breakpoints[i]);
+        }
+    }
+    list(&debugger, vm.pc, 1);
+
+    for (;;) {
+        if (interactive) {
+            fputs("(chip8) ", stdout);
+            fflush(stdout);
+        }
+        if (fgets(command, sizeof(command), stdin) == NULL) {
+            break;
+        }
+
+        char *cursor = command + 1;
+        switch (command[0]) {
+            case 'b': {
+                uint16_t address = argument(&cursor, vm.pc);
+                if (!debugger_set_breakpoint(&debugger, address)) {
+                    printf("Cannot set a breakpoint at %04x.\n", address);
+                }
+                break;
+            }
+            case 'd': {
+                uint16_t address = argument(&cursor, vm.pc);
+                if (!debugger_clear_breakpoint(&debugger, address)) {
+                    printf("No breakpoint at %04x.\n", address);
+                }
+                break;
+            }
+            case 'w': {
+                uint16_t address = argument(&cursor, vm.reg_i);
+                uint16_t length = argument(&cursor, 1);
+                uint8_t access = (strchr(cursor, 'r') ? WATCH_READ : 0) |
+                    (strchr(cursor, 'w') ? WATCH_WRITE : 0);
+                if (!debugger_watch(&debugger, address, length, access ? access : WATCH_WRITE)) {
+                    printf("Cannot watch %04x.\n", address);
+                }
+                break;
+            }
+            case 'u': {
+                uint16_t address = argument(&cursor, vm.reg_i);
+                if (!debugger_unwatch(&debugger, address)) {
+                    printf("No watchpoint at %04x.\n", address);
+                }
+                break;
+            }
+            case 'i':
+                for (int i = 0; i < debugger.breakpoint_count; ++i) {
+                    list(&debugger, debugger.breakpoints[i].address, 1);
+                }
+                for (int i = 0; i < debugger.watches.count; ++i) {
+                    const struct watchpoint *point = &debugger.watches.points[i];
+                    printf("watch %04x-%04x %s%s\n", point->start, point->start + point->length - 1,
+                            point->access & WATCH_READ ? "r" : "", point->access & WATCH_WRITE ? "w" : "");
+                }
+                break;
+            case 's': {
+                unsigned long count = argument(&cursor, 1);
+                enum debug_stop stop = DEBUG_STEPPED;
+                for (unsigned long i = 0; i < count && stop == DEBUG_STEPPED; ++i) {
+                    stop = debugger_step(&debugger);
+                }
+                report(&debugger, stop);
+                break;
+            }
+            case 'c':
+                report(&debugger, debugger_continue(&debugger, argument(&cursor, UINT64_MAX)));
+                break;
+            case 'r':
+                print_registers(&vm, debugger.frame);
+                break;
+            case 'm': {
+                uint16_t address = argument(&cursor, vm.reg_i);
+                dump_memory(&debugger, address, argument(&cursor, DUMP_DEFAULT_LENGTH));
+                break;
+            }
+            case 'k':
+                print_stack(&vm);
+                break;
+            case 'l': {
+                uint16_t address = argument(&cursor, vm.pc);
+                list(&debugger, address, argument(&cursor, LIST_DEFAULT_COUNT));
+                break;
+            }
+            case 'p':
+                vm_set_keypad(&vm, argument(&cursor, 0));
+                break;
+            case 'q':
+                debugger_detach(&debugger);
+                vm_release(&vm);
+                return 0;
+            case '\n':
+                break;
+            default:
+                print_help();
+        }
+    }
+
+    debugger_detach(&debugger);
+    vm_release(&vm);
+    return 0;
+}
@@ -0,0 +1,270 @@
+#include <stddef.h>
+#include <string.h>
+#include "disasm.h"
+#include "instructions.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static const char *arithmetic_names[16] = {
+    "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+    NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL
+};
+
+static char *put_text(char *out, const char *text) {
+    size_t length = strlen(text);
+    memcpy(out, text, length);
+    return out + length;
+}
+
+static char *put_hex(char *out, unsigned value) {
+    int digits = 1;
+    while (digits < 4 && value >> (4 * digits)) {
+        ++digits;
+    }
+    for (int i = digits - 1; i >= 0; --i) {
+        *out++ = hex_digits[(value >> (4 * i)) & 0xF];
+    }
+    return out;
+}
+
+static char *put_hex_fixed(char *out, unsigned value, int digits) {
+    for (int i = digits - 1; i >= 0; --i) {
+        *out++ = hex_digits[(value >> (4 * i)) & 0xF];
+    }
+    return out;
+}
+
+static char *put_reg(char *out, unsigned reg) {
+    *out++ = 'V';
+    *out++ = hex_digits[reg];
+    return out;
+}
+
+static char *put_unsigned(char *out, unsigned value) {
+    char digits[10];
+    int count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (count) {
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+/*
+ * Operand shapes shared by several instructions.
+ */
+static void address_operand(struct disasm *out, const char *prefix, uint16_t instruction) {
+    char *p = put_text(out->operands, prefix);
+    *put_hex(p, MEM_ADDR(instruction)) = '\0';
+}
+
+static void reg_byte_operands(struct disasm *out, uint16_t instruction) {
+    char *p = put_reg(out->operands, REG_1(instruction));
+    p = put_text(p, ", ");
+    *put_hex(p, LOW_BYTE(instruction)) = '\0';
+}
+
+static void two_reg_operands(struct disasm *out, uint16_t instruction) {
+    char *p = put_reg(out->operands, REG_1(instruction));
+    p = put_text(p, ", ");
+    *put_reg(p, REG_2(instruction)) = '\0';
+}
+
+static void reg_operand(struct disasm *out, const char *prefix, uint16_t instruction,
+        const char *suffix) {
+    char *p = put_text(out->operands, prefix);
+    p = put_reg(p, REG_1(instruction));
+    *put_text(p, suffix) = '\0';
+}
+
+static void disassemble_f(uint16_t instruction, struct disasm *out) {
+    out->mnemonic = "LD";
+    switch (LOW_BYTE(instruction)) {
+        case 0x07:
+            reg_operand(out, "", instruction, ", DT");
+            break;
+        case 0x0A:
+            reg_operand(out, "", instruction, ", K");
+            break;
+        case 0x15:
+            reg_operand(out, "DT, ", instruction, "");
+            break;
+        case 0x18:
+            reg_operand(out, "ST, ", instruction, "");
+            break;
+        case 0x1E:
+            out->mnemonic = "ADD";
+            reg_operand(out, "I, ", instruction, "");
+            break;
+        case 0x29:
+            reg_operand(out, "F, ", instruction, "");
+            break;
+        case 0x33:
+            reg_operand(out, "B, ", instruction, "");
+            break;
+        case 0x55:
+            reg_operand(out, "[I], ", instruction, "");
+            break;
+        case 0x65:
+            reg_operand(out, "", instruction, ", [I]");
+            break;
+        default:
+            out->mnemonic = NULL;
+    }
+}
+
+void disassemble(uint16_t instruction, struct disasm *out) {
+    out->mnemonic = NULL;
+    out->operands[0] = '\0';
+
+    switch (HIGH_NIBBLE(instruction)) {
+        case 0:
+            if (instruction == CLS) {
+                out->mnemonic = "CLS";
+            } else if (instruction == RET) {
+                out->mnemonic = "RET";
+            } else {
+                out->mnemonic = "SYS";
+                address_operand(out, "", instruction);
+            }
+            break;
+        case 1:
+            out->mnemonic = "JP";
+            address_operand(out, "", instruction);
+            break;
+        case 2:
+            out->mnemonic = "CALL";
+            address_operand(out, "", instruction);
+            break;
+        case 3:
+            out->mnemonic = "SE";
+            reg_byte_operands(out, instruction);
+            break;
+        case 4:
+            out->mnemonic = "SNE";
+            reg_byte_operands(out, instruction);
+            break;
+        case 5:
+            if (LOW_NIBBLE(instruction) == 0) {
+                out->mnemonic = "SE";
+                two_reg_operands(out, instruction);
+            }
+            break;
+        case 6:
+            out->mnemonic = "LD";
+            reg_byte_operands(out, instruction);
+            break;
+        case 7:
+            out->mnemonic = "ADD";
+            reg_byte_operands(out, instruction);
+            break;
+        case 8:
+            out->mnemonic = arithmetic_names[LOW_NIBBLE(instruction)];
+            if (out->mnemonic) {
+                two_reg_operands(out, instruction);
+            }
+            break;
+        case 9:
+            if (LOW_NIBBLE(instruction) == 0) {
+                out->mnemonic = "SNE";
+                two_reg_operands(out, instruction);
+            }
+            break;
+        case 0xA:
+            out->mnemonic = "LD";
+            address_operand(out, "I, ", instruction);
+            break;
+        case 0xB:
+            out->mnemonic = "JP";
+            address_operand(out, "V0, ", instruction);
+            break;
+        case 0xC:
+            out->mnemonic = "RND";
+            reg_byte_operands(out, instruction);
+            break;
+        case 0xD: {
+            out->mnemonic = "DRW";
+            two_reg_operands(out, instruction);
+            char *p = out->operands + strlen(out->operands);
+            p = put_text(p, ", ");
+            *put_hex(p, LOW_NIBBLE(instruction)) = '\0';
+            break;
+        }
+        case 0xE:
+            if (LOW_BYTE(instruction) == 0x9E) {
+                out->mnemonic = "SKP";
+                reg_operand(out, "", instruction, "");
+            } else if (LOW_BYTE(instruction) == 0xA1) {
+                out->mnemonic = "SKNP";
+                reg_operand(out, "", instruction, "");
+            }
+            break;
+        case 0xF:
+            disassemble_f(instruction, out);
+            break;
+    }
+}
+
+char *format_instruction(char *out, uint16_t instruction, uint16_t address) {
+    struct disasm decoded;
+
+    disassemble(instruction, &decoded);
+    *out++ = '(';
+    out = put_hex_fixed(out, address, 4);
+    out = put_text(out, ") ");
+    out = put_hex_fixed(out, instruction, 4);
+    out = put_text(out, ": ");
+    if (decoded.mnemonic == NULL) {
+        out = put_text(out, "unknown instruction or byte of data");
+    } else {
+        out = put_text(out, decoded.mnemonic);
+        if (decoded.operands[0]) {
+            *out++ = ' ';
+            out = put_text(out, decoded.operands);
+        }
+    }
+    *out++ = '\n';
+    return out;
+}
+
+char *format_instruction_json(char *out, const char *file_json, uint16_t instruction,
+        uint16_t address) {
+    struct disasm decoded;
+
+    disassemble(instruction, &decoded);
+    out = put_text(out, "{\"file\":\"");
+    out = put_text(out, file_json);
+    out = put_text(out, "\",\"address\":");
+    out = put_unsigned(out, address);
+    out = put_text(out, ",\"opcode\":\"");
+    out = put_hex_fixed(out, instruction, 4);
+    if (decoded.mnemonic == NULL) {
+        out = put_text(out, "\",\"mnemonic\":null,\"operands\":null}\n");
+        return out;
+    }
+    out = put_text(out, "\",\"mnemonic\":\"");
+    out = put_text(out, decoded.mnemonic);
+    out = put_text(out, "\",\"operands\":\"");
+    out = put_text(out, decoded.operands);
+    out = put_text(out, "\"}\n");
+    return out;
+}
+
+char *json_escape(char *out, const char *text) {
+    for (const unsigned char *c = (const unsigned char *) text; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            *out++ = '\\';
+            *out++ = *c;
+        } else if (*c < 0x20) {
+            out = put_text(out, "\\u00");
+            out = put_hex_fixed(out, *c, 2);
+        } else {
+            *out++ = *c;
+        }
+    }
+    *out = '\0';
+    return out;
+}
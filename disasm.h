@@ -0,0 +1,41 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdint.h>
+
+/*
+ * Instruction decoding for the disassembler. Lines are formatted
+ * straight into the caller's buffer, so bulk output costs no stdio call
+ * per instruction. A text line needs at most DISASM_LINE_MAX bytes; a
+ * JSON line that much plus the escaped file name.
+ */
+
+#define DISASM_LINE_MAX 96
+
+struct disasm {
+    const char *mnemonic;   // NULL for words that aren't instructions
+    char operands[24];
+};
+
+void disassemble(uint16_t instruction, struct disasm *out);
+
+/*
+ * "(0200) 00e0: CLS\n". Returns the end of the line.
+ */
+char *format_instruction(char *out, uint16_t instruction, uint16_t address);
+
+/*
+ * {"file":...,"address":512,"opcode":"00e0","mnemonic":"CLS","operands":""}
+ * with `file_json` already escaped by json_escape(). Returns the end of
+ * the line.
+ */
+char *format_instruction_json(char *out, const char *file_json, uint16_t instruction,
+        uint16_t address);
+
+/*
+ * Writes `text` as the inside of a JSON string, NUL-terminated. Needs
+ * up to 6 bytes per input byte plus one. Returns the end.
+ */
+char *json_escape(char *out, const char *text);
+
+#endif
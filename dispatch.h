@@ -0,0 +1,415 @@
+/*
+ * Interpreter template, included by instructions.c once per quirk
+ * profile. Before each inclusion define PROFILE (the name suffix) and
+ * the quirk switches, all 0 or 1:
+ *
+ *   QUIRK_SHIFT_VY      8xy6/8xyE shift Vy into Vx instead of shifting Vx
+ *   QUIRK_INCREMENT_I   Fx55/Fx65 leave I pointing past the last register
+ *   QUIRK_JUMP_VX       Bxnn jumps to xnn + Vx instead of nnn + V0
+ *   QUIRK_CLIP_SPRITES  sprites are clipped at the screen edges instead
+ *                       of every pixel wrapping around
+ *   QUIRK_VF_RESET      8xy1/8xy2/8xy3 clear VF
+ *   QUIRK_LEGACY_FLAGS  8xyn write VF before the result (so VF as the
+ *                       destination loses the flag) and 8xy5/8xy7 only
+ *                       set VF on strictly greater operands
+ *
+ * Every quirk is resolved by the preprocessor, so each profile gets its
+ * own dispatch switch and fetch-execute loop with no runtime checks.
+ * The recompile tool includes it the same way in translated ROMs.
+ */
+
+#define PROFILE_CONCAT(name, profile) name##_##profile
+#define PROFILE_EXPAND(name, profile) PROFILE_CONCAT(name, profile)
+#define PROFILE_FN(name) PROFILE_EXPAND(name, PROFILE)
+
+#if QUIRK_LEGACY_FLAGS
+#define SET_RESULT_AND_FLAG(vm, reg, result, flag) \
+    (vm)->reg_v[0xF] = (flag); \
+    (vm)->reg_v[reg] = (result);
+#define NO_BORROW(minuend, subtrahend) ((minuend) > (subtrahend))
+#else
+#define SET_RESULT_AND_FLAG(vm, reg, result, flag) \
+    (vm)->reg_v[reg] = (result); \
+    (vm)->reg_v[0xF] = (flag);
+#define NO_BORROW(minuend, subtrahend) ((minuend) >= (subtrahend))
+#endif
+
+#define OP_VX_VY(op, vm, instruction) \
+    uint8_t reg1 = REG_1(instruction); \
+    uint8_t reg2 = REG_2(instruction); \
+    vm->reg_v[reg1] = vm->reg_v[reg1] op vm->reg_v[reg2];
+
+#if QUIRK_VF_RESET
+#define LOGIC_OP(op, vm, instruction) \
+    OP_VX_VY(op, vm, instruction) \
+    vm->reg_v[0xF] = 0;
+#else
+#define LOGIC_OP(op, vm, instruction) OP_VX_VY(op, vm, instruction)
+#endif
+
+#if QUIRK_SHIFT_VY
+#define SHIFT_SOURCE(instruction) REG_2(instruction)
+#else
+#define SHIFT_SOURCE(instruction) REG_1(instruction)
+#endif
+
+static inline void PROFILE_FN(or_vx_vy)(struct chip8 *vm, uint16_t instruction) {
+    LOGIC_OP(|, vm, instruction);
+}
+
+static inline void PROFILE_FN(and_vx_vy)(struct chip8 *vm, uint16_t instruction) {
+    LOGIC_OP(&, vm, instruction);
+}
+
+static inline void PROFILE_FN(xor_vx_vy)(struct chip8 *vm, uint16_t instruction) {
+    LOGIC_OP(^, vm, instruction);
+}
+
+static inline void PROFILE_FN(add_vx_vy)(struct chip8 *vm, uint16_t instruction) {
+    uint8_t reg1 = REG_1(instruction);
+    uint8_t reg2 = REG_2(instruction);
+    uint16_t result = vm->reg_v[reg1] + vm->reg_v[reg2];
+    uint8_t carry = vm->reg_v[reg1] > UINT8_MAX - vm->reg_v[reg2];
+
+    SET_RESULT_AND_FLAG(vm, reg1, LOW_BYTE(result), carry);
+}
+
+static inline void PROFILE_FN(sub_vx_vy)(struct chip8 *vm, uint16_t instruction) {
+    uint8_t reg1 = REG_1(instruction);
+    uint8_t reg2 = REG_2(instruction);
+
+    uint8_t result = (int8_t) vm->reg_v[reg1] - (int8_t) vm->reg_v[reg2];
+    uint8_t no_borrow = NO_BORROW(vm->reg_v[reg1], vm->reg_v[reg2]);
+    SET_RESULT_AND_FLAG(vm, reg1, result, no_borrow);
+}
+
+static inline void PROFILE_FN(subn_vx_vy)(struct chip8 *vm, uint16_t instruction) {
+    uint8_t reg1 = REG_1(instruction);
+    uint8_t reg2 = REG_2(instruction);
+
+    uint8_t result = (int8_t) vm->reg_v[reg2] - (int8_t) vm->reg_v[reg1];
+    uint8_t no_borrow = NO_BORROW(vm->reg_v[reg2], vm->reg_v[reg1]);
+    SET_RESULT_AND_FLAG(vm, reg1, result, no_borrow);
+}
+
+static inline void PROFILE_FN(shr_vx)(struct chip8 *vm, uint16_t instruction) {
+    uint8_t reg1 = REG_1(instruction);
+    uint8_t value = vm->reg_v[SHIFT_SOURCE(instruction)];
+
+    SET_RESULT_AND_FLAG(vm, reg1, value >> 1, LSB(value));
+}
+
+static inline void PROFILE_FN(shl_vx)(struct chip8 *vm, uint16_t instruction) {
+    uint8_t reg1 = REG_1(instruction);
+    uint8_t value = vm->reg_v[SHIFT_SOURCE(instruction)];
+
+    SET_RESULT_AND_FLAG(vm, reg1, (uint8_t) (value << 1), MSB(value));
+}
+
+static inline void PROFILE_FN(jp_v0_addr)(struct chip8 *vm, uint16_t instruction) {
+#if QUIRK_JUMP_VX
+    vm->pc = vm->reg_v[REG_1(instruction)] + MEM_ADDR(instruction);
+#else
+    vm->pc = vm->reg_v[0] + MEM_ADDR(instruction);
+#endif
+}
+
+static inline void PROFILE_FN(drw_vx_vy_n)(struct chip8 *vm, uint16_t instruction) {
+    int sprite_bytes = LOW_NIBBLE(instruction);
+    int x_coord = vm->reg_v[REG_1(instruction)];
+    int y_coord = vm->reg_v[REG_2(instruction)];
+    uint16_t start = vm->reg_i;
+    int i, j;
+    uint8_t byte;
+    uint8_t pixel;
+
+    if (start + sprite_bytes > RAM_SIZE) {
+        vm->error = ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS;
+        return;
+    }
+
+#if QUIRK_CLIP_SPRITES
+    x_coord %= SCREEN_WIDTH_PX;
+    y_coord %= SCREEN_HEIGHT_PX;
+    if (sprite_bytes > SCREEN_HEIGHT_PX - y_coord) {
+        sprite_bytes = SCREEN_HEIGHT_PX - y_coord;
+    }
+#endif
+    if (sprite_bytes > 0) {
+        vm_check_watch(vm, start, sprite_bytes, WATCH_READ);
+    }
+
+    vm->reg_v[0xF] = 0;
+    for (i = 0; i < sprite_bytes; ++i) {
+        byte = vm_read(vm, start + i);
+        for (j = 7; j >= 0; --j) {
+            pixel = LSB(byte);
+#if QUIRK_CLIP_SPRITES
+            if (x_coord + j >= SCREEN_WIDTH_PX) {
+                pixel = 0;
+            }
+#endif
+            if (xor_pixel(&vm->screen, x_coord + j, y_coord + i, pixel)) {
+                vm->reg_v[0xF] = 1;
+            }
+            byte >>= 1;
+        }
+    }
+}
+
+static inline void PROFILE_FN(ld_i_vx)(struct chip8 *vm, uint16_t instruction) {
+    uint8_t reg = REG_1(instruction);
+    uint16_t location = vm->reg_i;
+    uint8_t i;
+    if (location + reg >= RAM_SIZE) {
+        vm->error = ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS;
+        return;
+    }
+    vm_check_watch(vm, location, reg + 1, WATCH_WRITE);
+
+    for (i = 0; i <= reg; ++i) {
+        vm_write(vm, location++, vm->reg_v[i]);
+    }
+#if QUIRK_INCREMENT_I
+    vm->reg_i = location;
+#endif
+}
+
+static inline void PROFILE_FN(ld_vx_i)(struct chip8 *vm, uint16_t instruction) {
+    uint8_t reg = REG_1(instruction);
+    uint16_t location = vm->reg_i;
+    uint8_t i;
+    if (location + reg >= RAM_SIZE) {
+        vm->error = ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS;
+        return;
+    }
+    vm_check_watch(vm, location, reg + 1, WATCH_READ);
+
+    for (i = 0; i <= reg; ++i) {
+        vm->reg_v[i] = vm_read(vm, location++);
+    }
+#if QUIRK_INCREMENT_I
+    vm->reg_i = location;
+#endif
+}
+
+static inline void PROFILE_FN(run_8xyn)(struct chip8 *vm, uint16_t instruction) {
+    uint8_t optype = LOW_NIBBLE(instruction);
+
+    switch (optype) {
+        case 0:
+            run_ld_vx_vy(vm, instruction);
+            break;
+        case 1:
+            PROFILE_FN(or_vx_vy)(vm, instruction);
+            break;
+        case 2:
+            PROFILE_FN(and_vx_vy)(vm, instruction);
+            break;
+        case 3:
+            PROFILE_FN(xor_vx_vy)(vm, instruction);
+            break;
+        case 4:
+            PROFILE_FN(add_vx_vy)(vm, instruction);
+            break;
+        case 5:
+            PROFILE_FN(sub_vx_vy)(vm, instruction);
+            break;
+        case 6:
+            PROFILE_FN(shr_vx)(vm, instruction);
+            break;
+        case 7:
+            PROFILE_FN(subn_vx_vy)(vm, instruction);
+            break;
+        case 0xE:
+            PROFILE_FN(shl_vx)(vm, instruction);
+            break;
+        default:
+            vm_report(vm, EVENT_UNKNOWN_INSTRUCTION, vm->pc - 2, instruction);
+    }
+}
+
+static inline void PROFILE_FN(dispatch)(struct chip8 *vm, uint16_t instruction) {
+    uint16_t instruction_type = HIGH_NIBBLE(instruction);
+
+    switch (instruction_type) {
+        case 0:
+            switch (instruction) {
+                case CLS:
+                    run_cls(vm);
+                    break;
+                case RET:
+                    run_ret(vm);
+                    break;
+                case BREAKPOINT:
+                    if (vm->breakpoints_armed) {
+                        vm->pc -= 2;
+                        vm->error = ERROR_BREAKPOINT;
+                        break;
+                    }
+                    vm_report(vm, EVENT_UNKNOWN_INSTRUCTION, vm->pc - 2, instruction);
+                    break;
+                default:
+                    vm_report(vm, EVENT_UNKNOWN_INSTRUCTION, vm->pc - 2, instruction);
+            }
+            break;
+        case 1:
+            run_jp_addr(vm, instruction);
+            break;
+        case 2:
+            run_call_addr(vm, instruction);
+            break;
+        case 3:
+            run_se_vx_byte(vm, instruction);
+            break;
+        case 4:
+            run_sne_vx_byte(vm, instruction);
+            break;
+        case 5:
+            if (LOW_NIBBLE(instruction) == 0) {
+                run_se_vx_vy(vm, instruction);
+            } else {
+                vm_report(vm, EVENT_UNKNOWN_INSTRUCTION, vm->pc - 2, instruction);
+            }
+            break;
+        case 6:
+            run_ld_vx_byte(vm, instruction);
+            break;
+        case 7:
+            run_add_vx_byte(vm, instruction);
+            break;
+        case 8:
+            PROFILE_FN(run_8xyn)(vm, instruction);
+            break;
+        case 9:
+            if (LOW_NIBBLE(instruction) == 0) {
+                run_sne_vx_vy(vm, instruction);
+            } else {
+                vm_report(vm, EVENT_UNKNOWN_INSTRUCTION, vm->pc - 2, instruction);
+            }
+            break;
+        case 0xA:
+            run_ld_i_addr(vm, instruction);
+            break;
+        case 0xB:
+            PROFILE_FN(jp_v0_addr)(vm, instruction);
+            break;
+        case 0xC:
+            run_rnd_vx_byte(vm, instruction);
+            break;
+        case 0xD:
+            PROFILE_FN(drw_vx_vy_n)(vm, instruction);
+            break;
+        case 0xE:
+            switch (LOW_BYTE(instruction)) {
+                case 0x9E:
+                    run_skp_vx(vm, instruction);
+                    break;
+                case 0xA1:
+                    run_sknp_vx(vm, instruction);
+                    break;
+                default:
+                    vm_report(vm, EVENT_UNKNOWN_INSTRUCTION, vm->pc - 2, instruction);
+                    break;
+            }
+            break;
+        case 0xF:
+            switch (LOW_BYTE(instruction)) {
+                case 0x7:
+                    run_ld_vx_dt(vm, instruction);
+                    break;
+                case 0xA:
+                    run_ld_vx_k(vm, instruction);
+                    break;
+                case 0x15:
+                    run_ld_dt_vx(vm, instruction);
+                    break;
+                case 0x18:
+                    run_ld_st_vx(vm, instruction);
+                    break;
+                case 0x1E:
+                    run_add_i_vx(vm, instruction);
+                    break;
+                case 0x29:
+                    run_ld_f_vx(vm, instruction);
+                    break;
+                case 0x33:
+                    run_ld_b_vx(vm, instruction);
+                    break;
+                case 0x55:
+                    PROFILE_FN(ld_i_vx)(vm, instruction);
+                    break;
+                case 0x65:
+                    PROFILE_FN(ld_vx_i)(vm, instruction);
+                    break;
+                default:
+                    vm_report(vm, EVENT_UNKNOWN_INSTRUCTION, vm->pc - 2, instruction);
+                    break;
+            }
+            break;
+        default:
+            vm_report(vm, EVENT_UNKNOWN_INSTRUCTION, vm->pc - 2, instruction);
+    }
+}
+
+static int PROFILE_FN(run_cycles)(struct chip8 *vm, int cycles) {
+    int executed = 0;
+
+    while (executed < cycles && !vm->error && !vm->awaiting_input) {
+        uint16_t instruction = vm_read(vm, vm->pc) << 8 | vm_read(vm, vm->pc + 1);
+
+        vm->pc += 2;
+        PROFILE_FN(dispatch)(vm, instruction);
+
+        if (vm->pc < PROG_MEM_START || vm->pc >= vm->prog_mem_end) {
+            vm->error = ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS;
+        }
+        vm->instructions += !vm->error;
+        ++executed;
+    }
+
+    return executed;
+}
+
+/*
+ * run_cycles() that also records every instruction in vm->trace. Kept
+ * apart so the untraced loop pays nothing for tracing.
+ */
+static int PROFILE_FN(run_traced_cycles)(struct chip8 *vm, int cycles) {
+    int executed = 0;
+
+    while (executed < cycles && !vm->error && !vm->awaiting_input) {
+        uint16_t pc = vm->pc;
+        uint16_t instruction = vm_read(vm, pc) << 8 | vm_read(vm, pc + 1);
+
+        vm->pc += 2;
+        PROFILE_FN(dispatch)(vm, instruction);
+        if (vm->error != ERROR_BREAKPOINT) {
+            trace_record(vm->trace, vm, pc, instruction);
+        }
+
+        if (vm->pc < PROG_MEM_START || vm->pc >= vm->prog_mem_end) {
+            vm->error = ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS;
+        }
+        vm->instructions += !vm->error;
+        ++executed;
+    }
+
+    return executed;
+}
+
+#undef PROFILE_CONCAT
+#undef PROFILE_EXPAND
+#undef PROFILE_FN
+#undef SET_RESULT_AND_FLAG
+#undef NO_BORROW
+#undef OP_VX_VY
+#undef LOGIC_OP
+#undef SHIFT_SOURCE
+#undef PROFILE
+#undef QUIRK_SHIFT_VY
+#undef QUIRK_INCREMENT_I
+#undef QUIRK_JUMP_VX
+#undef QUIRK_CLIP_SPRITES
+#undef QUIRK_VF_RESET
+#undef QUIRK_LEGACY_FLAGS
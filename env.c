@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+#include "env.h"
+#include "screen.h"
+
+#define ENV_CHUNK 16
+
+struct env_step {
+    const size_t *handles;
+    const uint16_t *actions;
+    size_t n;
+    int frames;
+    uint8_t *obs_out;
+    enum obs_format format;
+    float *rewards;
+    bool *done;
+};
+
+size_t env_observation_size(enum obs_format format) {
+    return format == OBS_PACKED ? SCREEN_HEIGHT_PX * sizeof(uint64_t) :
+        SCREEN_WIDTH_PX * SCREEN_HEIGHT_PX;
+}
+
+uint8_t *env_alloc_observations(size_t count, enum obs_format format) {
+    return aligned_alloc(ENV_ALIGNMENT, count * env_observation_size(format));
+}
+
+static void write_observation(const struct screen *screen, enum obs_format format, uint8_t *out) {
+    for (int y = 0; y < SCREEN_HEIGHT_PX; ++y) {
+        uint64_t row = screen->rows[y];
+        if (format == OBS_PACKED) {
+            for (int i = 0; i < 8; ++i) {
+                *out++ = row >> (56 - 8 * i);
+            }
+        } else {
+            for (int x = 0; x < SCREEN_WIDTH_PX; ++x) {
+                *out++ = -(uint8_t) ((row >> (SCREEN_WIDTH_PX - 1 - x)) & 1);
+            }
+        }
+    }
+}
+
+static float watched_total(const struct env *env, const struct chip8 *vm) {
+    float total = 0;
+    for (size_t w = 0; w < env->watch_count; ++w) {
+        total += env->watches[w].weight * vm_read(vm, env->watches[w].address);
+    }
+    return total;
+}
+
+static void step_one(struct env *env, const struct env_step *step, size_t i) {
+    struct chip8 *vm = &env->vms[step->handles[i]];
+    float before = watched_total(env, vm);
+
+    vm_set_keypad(vm, step->actions[i]);
+    for (int frame = 0; frame < step->frames && !vm->error; ++frame) {
+        vm_run_frame(vm);
+    }
+
+    write_observation(&vm->screen, step->format,
+            step->obs_out + i * env_observation_size(step->format));
+    if (step->rewards) {
+        step->rewards[i] = watched_total(env, vm) - before;
+    }
+    if (step->done) {
+        step->done[i] = vm->error != NO_ERROR;
+    }
+}
+
+/*
+ * Claims chunks of the current step until none are left.
+ */
+static void run_chunks(struct env *env, const struct env_step *step) {
+    for (;;) {
+        size_t first = __atomic_fetch_add(&env->next_chunk, ENV_CHUNK, __ATOMIC_RELAXED);
+        if (first >= step->n) {
+            return;
+        }
+        size_t last = first + ENV_CHUNK < step->n ? first + ENV_CHUNK : step->n;
+        for (size_t i = first; i < last; ++i) {
+            step_one(env, step, i);
+        }
+    }
+}
+
+static void *worker(void *arg) {
+    struct env *env = arg;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&env->lock);
+    for (;;) {
+        while (env->generation == seen && !env->quit) {
+            pthread_cond_wait(&env->start, &env->lock);
+        }
+        if (env->quit) {
+            break;
+        }
+        seen = env->generation;
+        const struct env_step *step = env->step;
+        pthread_mutex_unlock(&env->lock);
+
+        run_chunks(env, step);
+
+        pthread_mutex_lock(&env->lock);
+        if (++env->finished == env->worker_count) {
+            pthread_cond_signal(&env->done);
+        }
+    }
+    pthread_mutex_unlock(&env->lock);
+
+    return NULL;
+}
+
+void env_init(struct env *env, struct rom_image *image, size_t count, int threads) {
+    memset(env, 0, sizeof(*env));
+    env->count = count;
+    env->image = image;
+    env->vms = calloc(count, sizeof(struct chip8));
+    for (size_t i = 0; i < count; ++i) {
+        vm_init_shared(&env->vms[i], image);
+    }
+
+    pthread_mutex_init(&env->lock, NULL);
+    pthread_cond_init(&env->start, NULL);
+    pthread_cond_init(&env->done, NULL);
+    env->worker_count = threads > 1 ? threads - 1 : 0;
+    env->workers = malloc(env->worker_count * sizeof(pthread_t));
+    for (int i = 0; i < env->worker_count; ++i) {
+        pthread_create(&env->workers[i], NULL, worker, env);
+    }
+}
+
+void env_free(struct env *env) {
+    pthread_mutex_lock(&env->lock);
+    env->quit = true;
+    pthread_cond_broadcast(&env->start);
+    pthread_mutex_unlock(&env->lock);
+    for (int i = 0; i < env->worker_count; ++i) {
+        pthread_join(env->workers[i], NULL);
+    }
+    pthread_mutex_destroy(&env->lock);
+    pthread_cond_destroy(&env->start);
+    pthread_cond_destroy(&env->done);
+
+    for (size_t i = 0; i < env->count; ++i) {
+        vm_release(&env->vms[i]);
+    }
+    free(env->vms);
+    free(env->watches);
+    free(env->workers);
+    memset(env, 0, sizeof(*env));
+}
+
+void env_add_watch(struct env *env, uint16_t address, float weight) {
+    env->watches = realloc(env->watches, (env->watch_count + 1) * sizeof(struct env_watch));
+    env->watches[env->watch_count++] = (struct env_watch) { address % RAM_SIZE, weight };
+}
+
+void env_reset(struct env *env, size_t handle, uint64_t seed) {
+    struct chip8 *vm = &env->vms[handle];
+    enum quirk_profile profile = vm->profile;
+    int cycles_per_frame = vm->cycles_per_frame;
+
+    vm_release(vm);
+    vm_init_shared(vm, env->image);
+    vm->profile = profile;
+    vm->cycles_per_frame = cycles_per_frame;
+    vm_seed_random(vm, seed);
+}
+
+void step_batch(struct env *env, const size_t *handles, const uint16_t *actions, size_t n,
+        int frames_per_step, uint8_t *obs_out, enum obs_format format,
+        float *rewards, bool *done) {
+    struct env_step step = {
+        handles, actions, n, frames_per_step, obs_out, format, rewards, done
+    };
+
+    env->next_chunk = 0;
+    if (env->worker_count == 0 || n <= ENV_CHUNK) {
+        run_chunks(env, &step);
+        return;
+    }
+
+    pthread_mutex_lock(&env->lock);
+    env->step = &step;
+    env->finished = 0;
+    ++env->generation;
+    pthread_cond_broadcast(&env->start);
+    pthread_mutex_unlock(&env->lock);
+
+    run_chunks(env, &step);
+
+    pthread_mutex_lock(&env->lock);
+    while (env->finished < env->worker_count) {
+        pthread_cond_wait(&env->done, &env->lock);
+    }
+    pthread_mutex_unlock(&env->lock);
+}
@@ -0,0 +1,95 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "machine.h"
+
+#define ENV_ALIGNMENT 64
+
+/*
+ * Observation layouts written by step_batch(), one slot per stepped VM:
+ *
+ *   OBS_PACKED  32 rows of 8 bytes, leftmost pixel in the high bit of the
+ *               row's first byte (256 bytes)
+ *   OBS_BYTES   one byte per pixel, 0 or 0xFF, row by row (2048 bytes)
+ *
+ * Both sizes are multiples of ENV_ALIGNMENT, so every slot of a buffer
+ * from env_alloc_observations() starts on its own cache line.
+ */
+enum obs_format {
+    OBS_PACKED,
+    OBS_BYTES
+};
+
+/*
+ * Reward hook: each step, a VM's reward is the sum over watches of
+ * weight * (byte after the step - byte before it).
+ */
+struct env_watch {
+    uint16_t address;
+    float weight;
+};
+
+struct env_step;
+
+/*
+ * A set of VMs stepped headlessly by a persistent thread pool. VMs are
+ * addressed by handle, their index in `vms`.
+ */
+struct env {
+    struct chip8 *vms;
+    size_t count;
+    struct rom_image *image;
+
+    struct env_watch *watches;
+    size_t watch_count;
+
+    pthread_t *workers;
+    int worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    int finished;
+    bool quit;
+    const struct env_step *step;
+    size_t next_chunk;
+};
+
+/*
+ * Starts `count` VMs on `image` with `threads` threads in total (the
+ * caller's thread included).
+ */
+void env_init(struct env *env, struct rom_image *image, size_t count, int threads);
+
+void env_free(struct env *env);
+
+void env_add_watch(struct env *env, uint16_t address, float weight);
+
+/*
+ * Restarts a VM from the image with the given random seed.
+ */
+void env_reset(struct env *env, size_t handle, uint64_t seed);
+
+size_t env_observation_size(enum obs_format format);
+
+/*
+ * Returns an ENV_ALIGNMENT-aligned buffer for `count` observations.
+ * Release with free().
+ */
+uint8_t *env_alloc_observations(size_t count, enum obs_format format);
+
+/*
+ * For each i < n: sets the keypad of VM handles[i] to actions[i], runs
+ * it for frames_per_step frames (see vm_run_frame()) and writes its
+ * screen to observation slot i of `obs_out`. Handles must be distinct.
+ * `rewards` and `done` (the VM stopped on an error) may be NULL.
+ */
+void step_batch(struct env *env, const size_t *handles, const uint16_t *actions, size_t n,
+        int frames_per_step, uint8_t *obs_out, enum obs_format format,
+        float *rewards, bool *done);
+
+#endif
@@ -0,0 +1,139 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "eventlog.h"
+#include "telemetry.h"
+
+#define EVENT_LOG_POLL_NANOSECONDS 1000000
+
+static const char *error_messages[] = {
+    [ERROR_STACK_OVERFLOW] = "Error: Stack overflow",
+    [ERROR_STACK_UNDERFLOW] = "Error: Stack underflow",
+    [ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS] = "Error: Out of bounds memory access",
+    [ERROR_BREAKPOINT] = "Breakpoint",
+    [ERROR_WATCHPOINT] = "Watchpoint hit",
+};
+
+void format_event(char *buffer, size_t size, const struct vm_event *event) {
+    const char *message = "Error: Unknown error";
+
+    switch (event->type) {
+        case EVENT_UNKNOWN_INSTRUCTION:
+            snprintf(buffer, size, "Skipping unknown instruction %04x at %03x (cycle %" PRIu64 ")",
+                    event->opcode, event->pc, event->cycle);
+            break;
+        case EVENT_ERROR:
+            if (event->error < sizeof(error_messages) / sizeof(error_messages[0]) &&
+                    error_messages[event->error]) {
+                message = error_messages[event->error];
+            }
+            snprintf(buffer, size, "%s at %04x (cycle %" PRIu64 ")", message, event->pc,
+                    event->cycle);
+            break;
+        default:
+            snprintf(buffer, size, "Unknown event %d at %03x", event->type, event->pc);
+    }
+}
+
+struct rate_window {
+    uint64_t start;
+    uint32_t written;
+    uint64_t suppressed;
+};
+
+static void report_suppressed(struct event_log *log, struct rate_window *window) {
+    if (window->suppressed) {
+        fprintf(log->out, "(%" PRIu64 " more events suppressed)\n", window->suppressed);
+    }
+}
+
+/*
+ * Errors end emulation, so they are always written.
+ */
+static void write_event(struct event_log *log, struct rate_window *window,
+        const struct vm_event *event) {
+    char line[128];
+    uint64_t now = telemetry_now();
+
+    if (now - window->start >= 1000000000ull) {
+        report_suppressed(log, window);
+        window->start = now;
+        window->written = 0;
+        window->suppressed = 0;
+    }
+
+    ++log->counts[event->type < EVENT_TYPE_COUNT ? event->type : EVENT_ERROR];
+    if (event->type != EVENT_ERROR && window->written >= log->rate) {
+        ++window->suppressed;
+        ++log->suppressed;
+        return;
+    }
+    format_event(line, sizeof(line), event);
+    fprintf(log->out, "%s\n", line);
+    ++window->written;
+    ++log->written;
+}
+
+static void *writer_thread(void *arg) {
+    struct event_log *log = arg;
+    const struct timespec poll = { 0, EVENT_LOG_POLL_NANOSECONDS };
+    struct rate_window window = { telemetry_now(), 0, 0 };
+
+    for (;;) {
+        // Read stop first: once it's set, head is final.
+        bool stop = __atomic_load_n(&log->stop, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = log->tail;
+
+        if (tail == head) {
+            if (stop) {
+                break;
+            }
+            fflush(log->out);
+            nanosleep(&poll, NULL);
+            continue;
+        }
+        for (; tail != head; ++tail) {
+            write_event(log, &window, &log->events[tail & log->mask]);
+        }
+        __atomic_store_n(&log->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    report_suppressed(log, &window);
+    fflush(log->out);
+    return NULL;
+}
+
+bool event_log_open(struct event_log *log, FILE *out, size_t capacity, uint32_t rate) {
+    size_t size = 1;
+
+    memset(log, 0, sizeof(*log));
+    while (size < capacity) {
+        size *= 2;
+    }
+    log->events = malloc(size * sizeof(struct vm_event));
+    log->mask = size - 1;
+    log->out = out;
+    log->rate = rate;
+    if (pthread_create(&log->thread, NULL, writer_thread, log) != 0) {
+        free(log->events);
+        return false;
+    }
+    return true;
+}
+
+void event_log_close(struct event_log *log) {
+    __atomic_store_n(&log->stop, true, __ATOMIC_RELEASE);
+    pthread_join(log->thread, NULL);
+
+    if (log->suppressed || log->dropped) {
+        fprintf(log->out, "Events: %" PRIu64 " unknown instructions, %" PRIu64 " errors; "
+                "%" PRIu64 " written, %" PRIu64 " suppressed, %" PRIu64 " dropped\n",
+                log->counts[EVENT_UNKNOWN_INSTRUCTION], log->counts[EVENT_ERROR],
+                log->written, log->suppressed, log->dropped);
+        fflush(log->out);
+    }
+    free(log->events);
+    log->events = NULL;
+}
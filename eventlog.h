@@ -0,0 +1,93 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "machine.h"
+
+#define EVENT_LOG_DEFAULT_CAPACITY 4096
+#define EVENT_LOG_DEFAULT_RATE 20
+
+/*
+ * Diagnostics from the VM: unknown instructions and errors. The VM
+ * appends events to a ring buffer and never waits; when the ring is full
+ * the event is counted as dropped. A background thread formats the
+ * events and writes at most `rate` of them per second, counting the rest
+ * as suppressed and reporting the count once the second is over.
+ *
+ * Errors end emulation and are never lost: the last slot of the ring is
+ * kept for them, they aren't rate limited, and vm_report() prints one
+ * to stderr itself if it still doesn't fit. Attach a log with
+ * vm->events = log. Without one, vm_report() prints errors to stderr
+ * and ignores the rest.
+ */
+
+/*
+ * `cycle` is vm->instructions when the event happened, i.e. how many
+ * instructions completed before it; `error` is the vm_error of an
+ * EVENT_ERROR.
+ */
+struct vm_event {
+    uint64_t cycle;
+    uint16_t pc;
+    uint16_t opcode;
+    uint8_t type;
+    uint8_t error;
+    uint16_t padding;
+};
+
+struct event_log {
+    struct vm_event *events;
+    uint64_t mask;
+    uint64_t head;          // written by the VM thread
+    uint64_t tail;          // written by the writer thread
+    uint64_t dropped;       // written by the VM thread
+    bool stop;
+    FILE *out;
+    uint32_t rate;
+
+    // Kept by the writer thread.
+    uint64_t counts[EVENT_TYPE_COUNT];
+    uint64_t written;
+    uint64_t suppressed;
+    pthread_t thread;
+};
+
+/*
+ * Starts the writer thread on `out`. `capacity` is rounded up to a
+ * power of two; `rate` is the most events written per second.
+ */
+bool event_log_open(struct event_log *log, FILE *out, size_t capacity, uint32_t rate);
+
+/*
+ * Writes the remaining events (subject to the rate limit), then a
+ * summary of the counters if any events were suppressed or dropped.
+ */
+void event_log_close(struct event_log *log);
+
+/*
+ * Returns false if the ring has no room for the event.
+ */
+static inline bool event_log_push(struct event_log *log, const struct vm_event *event) {
+    uint64_t head = log->head;
+    uint64_t room = event->type == EVENT_ERROR ? log->mask + 1 : log->mask;
+
+    if (head - __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE) >= room) {
+        if (event->type != EVENT_ERROR) {
+            ++log->dropped;
+        }
+        return false;
+    }
+    log->events[head & log->mask] = *event;
+    __atomic_store_n(&log->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * Formats an event as one line of text, without the newline.
+ */
+void format_event(char *buffer, size_t size, const struct vm_event *event);
+
+#endif
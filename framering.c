@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "framering.h"
+
+#define FRAME_RING_MAGIC "C8FR"
+#define FRAME_RING_VERSION 1
+
+/*
+ * Slot contents are read while the emulator may be rewriting them, so
+ * both sides go through relaxed atomics; the sequence counter and the
+ * fences around it decide whether a copy is kept.
+ */
+#define STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+static size_t ring_size(uint32_t slot_count) {
+    return sizeof(struct frame_ring_shared) + (size_t) slot_count * sizeof(struct frame_ring_slot);
+}
+
+bool frame_ring_create(struct frame_ring *ring, const char *const name, uint32_t slot_count) {
+    memset(ring, 0, sizeof(*ring));
+    if (slot_count == 0) {
+        return false;
+    }
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    size_t size = ring_size(slot_count);
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(name);
+        return false;
+    }
+
+    ring->shared = base;
+    ring->size = size;
+    ring->name = strdup(name);
+    ring->shared->version = FRAME_RING_VERSION;
+    ring->shared->slot_count = slot_count;
+    ring->shared->slot_size = sizeof(struct frame_ring_slot);
+    memcpy(ring->shared->magic, FRAME_RING_MAGIC, 4);
+
+    return true;
+}
+
+void frame_ring_publish(struct frame_ring *ring, const struct chip8 *vm) {
+    struct frame_ring_shared *shared = ring->shared;
+    uint64_t frame = shared->head;
+    struct frame_ring_slot *slot = &shared->slots[frame % shared->slot_count];
+
+    STORE(slot->sequence, 2 * frame + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    STORE(slot->frame, frame);
+    for (int y = 0; y < SCREEN_HEIGHT_PX; ++y) {
+        STORE(slot->rows[y], vm->screen.rows[y]);
+    }
+    STORE(slot->keypad, vm->keypad);
+    STORE(slot->delay_timer, vm->reg_dt);
+    STORE(slot->sound_timer, vm->reg_st);
+
+    __atomic_store_n(&slot->sequence, 2 * frame + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&shared->head, frame + 1, __ATOMIC_RELEASE);
+}
+
+void frame_ring_close(struct frame_ring *ring) {
+    if (ring->shared) {
+        munmap(ring->shared, ring->size);
+        shm_unlink(ring->name);
+    }
+    free(ring->name);
+    memset(ring, 0, sizeof(*ring));
+}
+
+bool frame_ring_open(struct frame_ring_reader *reader, const char *const name) {
+    struct stat st;
+
+    memset(reader, 0, sizeof(*reader));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct frame_ring_shared)) {
+        close(fd);
+        return false;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    reader->shared = base;
+    reader->size = st.st_size;
+
+    const struct frame_ring_shared *shared = reader->shared;
+    if (memcmp(shared->magic, FRAME_RING_MAGIC, 4) != 0 ||
+            shared->version != FRAME_RING_VERSION ||
+            shared->slot_size != sizeof(struct frame_ring_slot) ||
+            shared->slot_count == 0 ||
+            ring_size(shared->slot_count) > reader->size) {
+        frame_ring_reader_close(reader);
+        return false;
+    }
+
+    uint64_t head = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE);
+    reader->next = head ? head - 1 : 0;
+    return true;
+}
+
+bool frame_ring_read(struct frame_ring_reader *reader, struct frame_ring_frame *frame) {
+    const struct frame_ring_shared *shared = reader->shared;
+    uint32_t slot_count = shared->slot_count;
+
+    for (;;) {
+        uint64_t head = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE);
+        if (reader->next >= head) {
+            return false;
+        }
+        if (head - reader->next > slot_count) {
+            reader->dropped += head - slot_count - reader->next;
+            reader->next = head - slot_count;
+        }
+
+        const struct frame_ring_slot *slot = &shared->slots[reader->next % slot_count];
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (sequence != 2 * reader->next + 2) {
+            // The writer is reusing the slot for a later frame. Skip to
+            // the oldest one it can't be writing instead of waiting.
+            uint64_t oldest = head - slot_count + 1;
+            if (oldest <= reader->next) {
+                oldest = reader->next + 1;
+            }
+            reader->dropped += oldest - reader->next;
+            reader->next = oldest;
+            continue;
+        }
+
+        frame->frame = LOAD(slot->frame);
+        for (int y = 0; y < SCREEN_HEIGHT_PX; ++y) {
+            frame->rows[y] = LOAD(slot->rows[y]);
+        }
+        frame->keypad = LOAD(slot->keypad);
+        frame->delay_timer = LOAD(slot->delay_timer);
+        frame->sound_timer = LOAD(slot->sound_timer);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (LOAD(slot->sequence) == sequence) {
+            ++reader->next;
+            return true;
+        }
+    }
+}
+
+void frame_ring_reader_close(struct frame_ring_reader *reader) {
+    if (reader->shared) {
+        munmap((void *) reader->shared, reader->size);
+    }
+    memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,102 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "machine.h"
+
+#define FRAME_RING_DEFAULT_SLOTS 64
+
+/*
+ * Frame export through a POSIX shared-memory object, for local
+ * consumers that want frames without the SDL window:
+ *
+ *   header  "C8FR", u32 version, u32 slot count, u32 slot size,
+ *           u64 head (number of frames published)
+ *   slots   slot count fixed-size frame records
+ *
+ * Frame n goes to slot n % slot count. Each slot carries a sequence
+ * counter: odd while the emulator writes it, 2n + 2 once frame n is
+ * complete. The writer never waits for readers; a reader that falls
+ * more than a ring behind, or that finds its slot being rewritten,
+ * skips to the oldest frame still present and counts the rest as
+ * dropped.
+ */
+
+struct frame_ring_slot {
+    uint64_t sequence;
+    uint64_t frame;
+    uint64_t rows[SCREEN_HEIGHT_PX];
+    uint16_t keypad;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t padding[44];
+};
+
+struct frame_ring_shared {
+    char magic[4];
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint64_t head;
+    uint8_t padding[40];
+    struct frame_ring_slot slots[];
+};
+
+struct frame_ring {
+    struct frame_ring_shared *shared;
+    size_t size;
+    char *name;
+};
+
+struct frame_ring_reader {
+    const struct frame_ring_shared *shared;
+    size_t size;
+    uint64_t next;
+    uint64_t dropped;
+};
+
+/*
+ * One frame as seen by a reader.
+ */
+struct frame_ring_frame {
+    uint64_t frame;
+    uint64_t rows[SCREEN_HEIGHT_PX];
+    uint16_t keypad;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+};
+
+/*
+ * Creates (or replaces) the shared-memory object `name`, e.g. "/chip8".
+ */
+bool frame_ring_create(struct frame_ring *ring, const char *const name, uint32_t slot_count);
+
+/*
+ * Publishes the VM's screen, keypad and timers as the next frame.
+ */
+void frame_ring_publish(struct frame_ring *ring, const struct chip8 *vm);
+
+/*
+ * Unmaps and unlinks the object. Readers that still have it mapped
+ * keep their view.
+ */
+void frame_ring_close(struct frame_ring *ring);
+
+/*
+ * Maps an existing ring read-only. The reader starts at the newest
+ * published frame.
+ */
+bool frame_ring_open(struct frame_ring_reader *reader, const char *const name);
+
+/*
+ * Copies out the next unread frame. Returns false when the reader has
+ * caught up with the emulator. Frames lost to lapping are added to
+ * reader->dropped.
+ */
+bool frame_ring_read(struct frame_ring_reader *reader, struct frame_ring_frame *frame);
+
+void frame_ring_reader_close(struct frame_ring_reader *reader);
+
+#endif
@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "machine.h"
+#include "instructions.h"
+#include "batch.h"
+
+/*
+ * Differential fuzzing harness. An input is a register state followed
+ * by a ROM image:
+ *
+ *   V0-VF (16 bytes), I (2, big-endian), DT, ST, keypad (2), seed (8),
+ *   quirk profile (1), then up to RAM_SIZE - PROG_MEM_START bytes of
+ *   program
+ *
+ * Every engine in the table runs the same input for FUZZ_STEPS
+ * instructions and the full VM state must match the reference engine.
+ * Each engine also runs twice to catch nondeterminism.
+ *
+ * Build modes:
+ *   -DFUZZ_LIBFUZZER  libFuzzer entry point (see 'make fuzz-libfuzzer')
+ *   default           standalone: 'fuzz [-n runs] [-s seed]' generates
+ *                     inputs with a deterministic generator, 'fuzz file'
+ *                     replays one input (use 'fuzz -' under AFL)
+ */
+
+#define FUZZ_STATE_BYTES 31
+#define FUZZ_STEPS 512
+#define FUZZ_MAX_INPUT (FUZZ_STATE_BYTES + RAM_SIZE - PROG_MEM_START)
+#define DEFAULT_RUNS 10000
+#define FUZZ_BATCH_LANES 5
+
+struct engine {
+    const char *name;
+    void (*run)(struct chip8 *vm, int steps);
+};
+
+/*
+ * One instruction at a time through the generic profile switch, with
+ * its own fetch and bounds check.
+ */
+void run_reference(struct chip8 *vm, int steps) {
+    for (int i = 0; i < steps && !vm->error && !vm->awaiting_input; ++i) {
+        uint16_t instruction = vm_read(vm, vm->pc) << 8 | vm_read(vm, vm->pc + 1);
+        vm->pc += 2;
+        run_instruction_with_profile(vm, vm->profile, instruction);
+        if (vm->pc < PROG_MEM_START || vm->pc >= vm->prog_mem_end) {
+            vm->error = ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS;
+        }
+    }
+}
+
+/*
+ * The profile-specialized fetch-execute loops.
+ */
+void run_specialized(struct chip8 *vm, int steps) {
+    run_cycles(vm, steps);
+}
+
+/*
+ * Runs the input on lane 0 of a lockstep batch. The other lanes start
+ * from perturbed registers so that the lanes split into groups.
+ */
+void run_batch_lanes(struct chip8 *vm, int steps, bool avx2) {
+    struct batch batch;
+
+    batch_init(&batch, vm->image, FUZZ_BATCH_LANES, vm->profile);
+    batch.use_avx2 = batch.use_avx2 && avx2;
+    for (size_t lane = 0; lane < FUZZ_BATCH_LANES; ++lane) {
+        batch_fork_lane(&batch, lane, vm);
+        if (lane > 0) {
+            batch.reg_v[lane * 3 % 16][lane] ^= lane * 0x35;
+        }
+    }
+
+    batch_run_cycles(&batch, steps);
+
+    vm_release(vm);
+    vm_fork(vm, batch_vm(&batch, 0));
+    batch_free(&batch);
+}
+
+void run_batch(struct chip8 *vm, int steps) {
+    run_batch_lanes(vm, steps, true);
+}
+
+void run_batch_scalar(struct chip8 *vm, int steps) {
+    run_batch_lanes(vm, steps, false);
+}
+
+struct engine engines[] = {
+    { "reference", run_reference },
+    { "specialized", run_specialized },
+    { "batch", run_batch },
+    { "batch-scalar", run_batch_scalar },
+};
+
+#define ENGINE_COUNT (sizeof(engines) / sizeof(engines[0]))
+
+void load_input(struct chip8 *vm, const uint8_t *data, size_t size) {
+    uint8_t state[FUZZ_STATE_BYTES] = { 0 };
+    size_t state_size = size < FUZZ_STATE_BYTES ? size : FUZZ_STATE_BYTES;
+    size_t program_size = size - state_size;
+
+    memcpy(state, data, state_size);
+
+    vm_init_with_image(vm, data + state_size, program_size);
+    memcpy(vm->reg_v, state, 16);
+    vm->reg_i = (state[16] << 8 | state[17]) & 0xFFF;
+    vm->reg_dt = state[18];
+    vm->reg_st = state[19];
+    vm->keypad = state[20] << 8 | state[21];
+    memcpy(&vm->rng_state, &state[22], sizeof(vm->rng_state));
+    vm->profile = state[30] % PROFILE_COUNT;
+}
+
+/*
+ * Returns the name of the first field that differs, or NULL. Also
+ * checks that b's incremental hashes match its RAM and screen.
+ */
+const char *compare_vm(const struct chip8 *a, const struct chip8 *b) {
+    if (a->error != b->error) return "error";
+    if (a->pc != b->pc) return "pc";
+    if (a->sp != b->sp) return "sp";
+    if (a->reg_i != b->reg_i) return "I";
+    if (a->reg_dt != b->reg_dt) return "DT";
+    if (a->reg_st != b->reg_st) return "ST";
+    if (memcmp(a->reg_v, b->reg_v, sizeof(a->reg_v))) return "V registers";
+    if (memcmp(a->stack, b->stack, a->sp * sizeof(a->stack[0]))) return "stack";
+    if (a->awaiting_input != b->awaiting_input) return "awaiting_input";
+    if (a->awaiting_input && a->input_register != b->input_register) return "input_register";
+    if (a->rng_state != b->rng_state) return "random state";
+    for (int i = 0; i < RAM_PAGE_COUNT; ++i) {
+        if (memcmp(a->pages[i], b->pages[i], RAM_PAGE_SIZE)) return "RAM";
+    }
+    if (memcmp(a->screen.rows, b->screen.rows, sizeof(a->screen.rows))) return "screen";
+    if (b->ram_hash != vm_hash_ram(b)) return "incremental RAM hash";
+    if (b->screen.pixel_hash != hash_pixels(&b->screen)) return "incremental screen hash";
+    return NULL;
+}
+
+void report_mismatch(const char *engine, const char *field, const uint8_t *data, size_t size) {
+    fprintf(stderr, "Engine %s diverges from %s in %s. Input (%zu bytes):\n",
+            engine, engines[0].name, field, size);
+    for (size_t i = 0; i < size; ++i) {
+        fprintf(stderr, "%02x%s", data[i], (i + 1) % 32 == 0 || i + 1 == size ? "\n" : "");
+    }
+}
+
+/*
+ * Runs one input through every engine. Returns false on divergence.
+ */
+bool fuzz_one(const uint8_t *data, size_t size) {
+    static struct chip8 expected, actual;
+
+    load_input(&expected, data, size);
+    engines[0].run(&expected, FUZZ_STEPS);
+
+    for (size_t i = 0; i < ENGINE_COUNT; ++i) {
+        load_input(&actual, data, size);
+        engines[i].run(&actual, FUZZ_STEPS);
+
+        const char *field = compare_vm(&expected, &actual);
+        vm_release(&actual);
+        if (field) {
+            report_mismatch(engines[i].name, field, data, size);
+            vm_release(&expected);
+            return false;
+        }
+    }
+
+    vm_release(&expected);
+    return true;
+}
+
+#ifdef FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size <= FUZZ_MAX_INPUT && !fuzz_one(data, size)) {
+        abort();
+    }
+    return 0;
+}
+
+#else
+
+uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Du;
+}
+
+/*
+ * Random inputs are mostly short programs, with opcodes drawn so that
+ * jumps and calls tend to land inside the program.
+ */
+size_t generate_input(uint64_t *state, uint8_t *data) {
+    size_t program_size = 2 + 2 * (next_random(state) % 64);
+
+    for (size_t i = 0; i < FUZZ_STATE_BYTES; ++i) {
+        data[i] = next_random(state);
+    }
+    for (size_t i = 0; i < program_size; i += 2) {
+        uint16_t opcode = next_random(state);
+        uint8_t type = opcode >> 12;
+        if (type == 1 || type == 2 || type == 0xA) {
+            opcode = (opcode & 0xF000) | (PROG_MEM_START + (opcode % program_size));
+        }
+        data[FUZZ_STATE_BYTES + i] = opcode >> 8;
+        data[FUZZ_STATE_BYTES + i + 1] = opcode & 0xFF;
+    }
+
+    return FUZZ_STATE_BYTES + program_size;
+}
+
+int fuzz_file(const char *filename) {
+    static uint8_t data[FUZZ_MAX_INPUT];
+    FILE *fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open file %s.\n", filename);
+        exit(1);
+    }
+    size_t size = fread(data, 1, sizeof(data), fp);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    if (!fuzz_one(data, size)) {
+        abort();
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t data[FUZZ_MAX_INPUT];
+    unsigned long runs = DEFAULT_RUNS;
+    uint64_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                runs = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: fuzz [-n runs] [-s seed] [input file | -]\n");
+                exit(1);
+        }
+    }
+
+    if (optind < argc) {
+        return fuzz_file(argv[optind]);
+    }
+
+    uint64_t state = seed ? seed : 1;
+    for (unsigned long run = 0; run < runs; ++run) {
+        size_t size = generate_input(&state, data);
+        if (!fuzz_one(data, size)) {
+            fprintf(stderr, "Failed on run %lu (seed %llu).\n", run, (unsigned long long) seed);
+            return 1;
+        }
+    }
+    fprintf(stderr, "%lu runs across %zu engine(s) passed (seed %llu).\n",
+            runs, ENGINE_COUNT, (unsigned long long) seed);
+
+    return 0;
+}
+
+#endif
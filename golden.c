@@ -0,0 +1,326 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "machine.h"
+#include "screen.h"
+
+/*
+ * Golden-trace regression harness. Each manifest line names a ROM, a
+ * replay file, a golden trace and optionally a quirk profile:
+ *
+ *   roms/pong.ch8 replays/pong.txt regress/pong.txt schip
+ *
+ * Replay files contain "frame keypad" lines (keypad as a hex bitmask,
+ * held from that frame on); "-" means no input. Golden traces hold one
+ * hex screen hash per frame. With -u the traces are (re)written instead
+ * of checked. Jobs are spread over -j threads.
+ *
+ * Once the replay is exhausted and the VM state repeats, the rest of
+ * the trace is filled in from the cycle instead of being emulated.
+ */
+
+#define DEFAULT_FRAMES 600
+#define MAX_LINE 1024
+#define GOLDEN_SEED 0xC8
+
+struct replay_event {
+    uint32_t frame;
+    uint16_t keypad;
+};
+
+struct job {
+    char rom[MAX_LINE];
+    char replay[MAX_LINE];
+    char golden[MAX_LINE];
+    enum quirk_profile profile;
+    bool passed;
+    char report[3 * MAX_LINE];
+};
+
+struct harness {
+    struct job *jobs;
+    size_t job_count;
+    size_t next_job;
+    pthread_mutex_t lock;
+    bool update;
+    uint32_t frames;
+};
+
+size_t read_replay(const char *filename, struct replay_event **events) {
+    size_t count = 0;
+    size_t capacity = 16;
+    char line[MAX_LINE];
+
+    *events = malloc(capacity * sizeof(struct replay_event));
+    if (strcmp(filename, "-") == 0) {
+        return 0;
+    }
+
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        free(*events);
+        *events = NULL;
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned int frame, keypad;
+        if (line[0] == '#' || sscanf(line, "%u %x", &frame, &keypad) != 2) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            *events = realloc(*events, capacity * sizeof(struct replay_event));
+        }
+        (*events)[count++] = (struct replay_event) { frame, keypad };
+    }
+    fclose(fp);
+
+    return count;
+}
+
+size_t read_golden(const char *filename, uint64_t **hashes) {
+    size_t count = 0;
+    size_t capacity = DEFAULT_FRAMES;
+    char line[MAX_LINE];
+
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        *hashes = NULL;
+        return 0;
+    }
+    *hashes = malloc(capacity * sizeof(uint64_t));
+    while (fgets(line, sizeof(line), fp)) {
+        uint64_t hash;
+        if (sscanf(line, "%" SCNx64, &hash) != 1) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            *hashes = realloc(*hashes, capacity * sizeof(uint64_t));
+        }
+        (*hashes)[count++] = hash;
+    }
+    fclose(fp);
+
+    return count;
+}
+
+void run_job(struct job *job, bool update, uint32_t frames) {
+    struct chip8 vm;
+    struct replay_event *events = NULL;
+    uint64_t *golden = NULL;
+    size_t golden_count = 0;
+    FILE *out = NULL;
+
+    job->passed = false;
+
+    FILE *rom = fopen(job->rom, "r");
+    if (rom == NULL) {
+        snprintf(job->report, sizeof(job->report), "%s: cannot open ROM", job->rom);
+        return;
+    }
+    fclose(rom);
+
+    size_t event_count = read_replay(job->replay, &events);
+    if (events == NULL) {
+        snprintf(job->report, sizeof(job->report), "%s: cannot open replay %s",
+                job->rom, job->replay);
+        return;
+    }
+
+    if (update) {
+        out = fopen(job->golden, "w");
+        if (out == NULL) {
+            snprintf(job->report, sizeof(job->report), "%s: cannot write %s",
+                    job->rom, job->golden);
+            free(events);
+            return;
+        }
+    } else {
+        golden_count = read_golden(job->golden, &golden);
+        if (golden_count == 0) {
+            snprintf(job->report, sizeof(job->report), "%s: no golden trace in %s",
+                    job->rom, job->golden);
+            free(events);
+            return;
+        }
+        frames = golden_count;
+    }
+
+    vm_init_with_rom(&vm, job->rom);
+    vm_seed_random(&vm, GOLDEN_SEED);
+    vm.profile = job->profile;
+
+    size_t next_event = 0;
+    uint64_t *trace = malloc(frames * sizeof(uint64_t));
+    struct cycle_detector detector;
+    uint32_t period = 0;
+    uint32_t cycle_frame = 0;
+
+    job->passed = true;
+    cycle_detector_reset(&detector, vm_state_hash(&vm));
+
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+        uint64_t hash;
+
+        if (period) {
+            // The VM is in a cycle with no input left to replay; the
+            // remaining screens repeat.
+            hash = trace[frame - period];
+        } else {
+            while (next_event < event_count && events[next_event].frame <= frame) {
+                vm_set_keypad(&vm, events[next_event++].keypad);
+                cycle_detector_reset(&detector, vm_state_hash(&vm));
+            }
+
+            if (vm_run_frame(&vm) != NO_ERROR) {
+                job->passed = false;
+                snprintf(job->report, sizeof(job->report),
+                        "%s: VM error %d at frame %u, pc %04x",
+                        job->rom, vm.error, frame, vm.pc);
+                break;
+            }
+
+            hash = hash_screen(&vm.screen);
+            if (next_event == event_count) {
+                period = cycle_detector_update(&detector, vm_state_hash(&vm));
+                cycle_frame = frame;
+            }
+        }
+        trace[frame] = hash;
+
+        if (update) {
+            fprintf(out, "%016" PRIx64 "\n", hash);
+        } else if (hash != golden[frame]) {
+            job->passed = false;
+            snprintf(job->report, sizeof(job->report),
+                    "%s: first divergence at frame %u (expected %016" PRIx64 ", got %016" PRIx64 ")",
+                    job->rom, frame, golden[frame], hash);
+            break;
+        }
+    }
+
+    if (job->passed && period) {
+        snprintf(job->report, sizeof(job->report), "%s: %s %u frames (cycle of %u from frame %u)",
+                job->rom, update ? "recorded" : "matched", frames, period, cycle_frame);
+    } else if (job->passed) {
+        snprintf(job->report, sizeof(job->report), "%s: %s %u frames",
+                job->rom, update ? "recorded" : "matched", frames);
+    }
+
+    if (out) {
+        fclose(out);
+    }
+    vm_release(&vm);
+    free(trace);
+    free(events);
+    free(golden);
+}
+
+void *worker(void *arg) {
+    struct harness *harness = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&harness->lock);
+        size_t index = harness->next_job++;
+        pthread_mutex_unlock(&harness->lock);
+
+        if (index >= harness->job_count) {
+            return NULL;
+        }
+        run_job(&harness->jobs[index], harness->update, harness->frames);
+    }
+}
+
+size_t read_manifest(const char *filename, struct job **jobs) {
+    size_t count = 0;
+    size_t capacity = 16;
+    char line[3 * MAX_LINE];
+
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        printf("Cannot open manifest %s.\n", filename);
+        exit(1);
+    }
+
+    *jobs = malloc(capacity * sizeof(struct job));
+    while (fgets(line, sizeof(line), fp)) {
+        struct job job = { .profile = PROFILE_DEFAULT };
+        char profile[MAX_LINE];
+        int fields = sscanf(line, "%1023s %1023s %1023s %1023s",
+                job.rom, job.replay, job.golden, profile);
+        if (line[0] == '#' || fields < 3) {
+            continue;
+        }
+        if (fields == 4 && !parse_profile(profile, &job.profile)) {
+            printf("Unknown quirk profile %s for %s.\n", profile, job.rom);
+            exit(1);
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            *jobs = realloc(*jobs, capacity * sizeof(struct job));
+        }
+        (*jobs)[count++] = job;
+    }
+    fclose(fp);
+
+    return count;
+}
+
+int main(int argc, char **argv) {
+    struct harness harness = { .frames = DEFAULT_FRAMES };
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "uj:f:")) != -1) {
+        switch (opt) {
+            case 'u':
+                harness.update = true;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'f':
+                harness.frames = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                optind = argc;
+        }
+    }
+    if (optind >= argc) {
+        printf("Usage: golden [-u] [-j threads] [-f frames] manifest\n");
+        exit(0);
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    harness.job_count = read_manifest(argv[optind], &harness.jobs);
+    pthread_mutex_init(&harness.lock, NULL);
+
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; ++i) {
+        pthread_create(&workers[i], NULL, worker, &harness);
+    }
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    size_t failures = 0;
+    for (size_t i = 0; i < harness.job_count; ++i) {
+        printf("%s %s\n", harness.jobs[i].passed ? "PASS" : "FAIL", harness.jobs[i].report);
+        if (!harness.jobs[i].passed) {
+            ++failures;
+        }
+    }
+    printf("%zu of %zu passed\n", harness.job_count - failures, harness.job_count);
+
+    free(workers);
+    free(harness.jobs);
+    return failures ? 1 : 0;
+}
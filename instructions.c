@@ -1,14 +1,11 @@
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include "machine.h"
 #include "instructions.h"
-#include "sdl_system.h"
+#include "native.h"
 #include "screen.h"
-
-#define OP_VX_VY(op, vm, instruction) \
-    uint8_t reg1 = REG_1(instruction); \
-    uint8_t reg2 = REG_2(instruction); \
-    vm->reg_v[reg1] = vm->reg_v[reg1] op vm->reg_v[reg2];
+#include "trace.h"
 
 void run_cls(struct chip8 *vm) {
     clear_screen(&vm->screen);
@@ -97,103 +94,33 @@ void run_ld_vx_vy(struct chip8 *vm, uint16_t instruction) {
     vm->reg_v[reg1] = vm->reg_v[reg2];
 }
 
-void run_or_vx_vy(struct chip8 *vm, uint16_t instruction) {
-    OP_VX_VY(|, vm, instruction);
-}
-
-void run_and_vx_vy(struct chip8 *vm, uint16_t instruction) {
-    OP_VX_VY(&, vm, instruction);
-}
-
-void run_xor_vx_vy(struct chip8 *vm, uint16_t instruction) {
-    OP_VX_VY(^, vm, instruction);
-}
-
-void run_add_vx_vy(struct chip8 *vm, uint16_t instruction) {
-    uint8_t reg1 = REG_1(instruction);
-    uint8_t reg2 = REG_2(instruction);
-    uint16_t result = vm->reg_v[reg1] + vm->reg_v[reg2];
-
-    vm->reg_v[0xF] = vm->reg_v[reg1] > UINT8_MAX - vm->reg_v[reg2];
-    vm->reg_v[reg1] = LOW_BYTE(result);
-}
-
-void run_sub_vx_vy(struct chip8 *vm, uint16_t instruction) {
-    uint8_t reg1 = REG_1(instruction);
-    uint8_t reg2 = REG_2(instruction);
-
-    uint8_t result = (int8_t) vm->reg_v[reg1] - (int8_t) vm->reg_v[reg2];
-    vm->reg_v[0xF] = vm->reg_v[reg1] > vm->reg_v[reg2];
-    vm->reg_v[reg1] = result;
-}
-
-void run_shr_vx(struct chip8 *vm, uint16_t instruction) {
-    uint8_t reg1 = REG_1(instruction);
-
-    vm->reg_v[0xF] = LSB(vm->reg_v[reg1]);
-    vm->reg_v[reg1] = vm->reg_v[reg1] >> 1;
-}
-
-void run_subn_vx_vy(struct chip8 *vm, uint16_t instruction) {
-    uint8_t reg1 = REG_1(instruction);
-    uint8_t reg2 = REG_2(instruction);
-
-    uint8_t result = (int8_t) vm->reg_v[reg2] - (int8_t) vm->reg_v[reg1];
-    vm->reg_v[0xF] = vm->reg_v[reg2] > vm->reg_v[reg1];
-    vm->reg_v[reg1] = result;
-}
-
-void run_shl_vx(struct chip8 *vm, uint16_t instruction) {
-    uint8_t reg1 = REG_1(instruction);
-
-    vm->reg_v[0xF] = MSB(vm->reg_v[reg1]);
-    vm->reg_v[reg1] = vm->reg_v[reg1] << 1;
-}
-
-void run_jp_v0_addr(struct chip8 *vm, uint16_t instruction) {
-    vm->pc = vm->reg_v[0] + MEM_ADDR(instruction);
+/*
+ * Per-VM linear congruential generator, so that runs are reproducible
+ * and independent VMs don't share random state.
+ */
+static uint8_t next_random(struct chip8 *vm) {
+    vm->rng_state = vm->rng_state * 6364136223846793005u + 1442695040888963407u;
+    return vm->rng_state >> 56;
 }
 
 void run_rnd_vx_byte(struct chip8 *vm, uint16_t instruction) {
     uint8_t reg = REG_1(instruction);
-    uint8_t r = rand() % 255u;
+    uint8_t r = next_random(vm);
     uint8_t byte = LOW_BYTE(instruction);
 
     vm->reg_v[reg] = r & byte;
 }
 
-void run_drw_vx_vy_n(struct chip8 *vm, uint16_t instruction) {
-    int sprite_bytes = LOW_NIBBLE(instruction);
-    int x_coord = vm->reg_v[REG_1(instruction)];
-    int y_coord = vm->reg_v[REG_2(instruction)];
-    uint16_t start = vm->reg_i;
-    int i, j;
-    uint8_t byte;
-    uint8_t pixel;
-
-    vm->reg_v[0xF] = 0;
-    for (i = 0; i < sprite_bytes; ++i) {
-        byte = vm->ram[start + i];
-        for (j = 7; j >= 0; --j) {
-            pixel = LSB(byte);
-            if (xor_pixel(&vm->screen, x_coord + j, y_coord + i, pixel)) {
-                vm->reg_v[0xF] = 1;
-            }
-            byte >>= 1;
-        }
-    }
-}
-
 void run_skp_vx(struct chip8 *vm, uint16_t instruction) {
     uint8_t reg = REG_1(instruction);
-    if (is_key_down(vm->reg_v[reg])) {
+    if (vm_key_down(vm, vm->reg_v[reg])) {
         vm->pc += 2;
     }
 }
 
 void run_sknp_vx(struct chip8 *vm, uint16_t instruction) {
     uint8_t reg = REG_1(instruction);
-    if (!is_key_down(vm->reg_v[reg])) {
+    if (!vm_key_down(vm, vm->reg_v[reg])) {
         vm->pc += 2;
     }
 }
@@ -212,6 +139,9 @@ void run_ld_vx_k(struct chip8 *vm, uint16_t instruction) {
 void run_ld_vx_k_receive_input(struct chip8 *vm, uint8_t input) {
     vm->reg_v[vm->input_register] = input;
     vm->awaiting_input = false;
+    if (vm->input_time && input == vm->input_key) {
+        vm_read_input(vm);
+    }
 }
 
 void run_ld_dt_vx(struct chip8 *vm, uint16_t instruction) {
@@ -245,177 +175,160 @@ void run_ld_b_vx(struct chip8 *vm, uint16_t instruction) {
     uint8_t lowDigit = regValue % 10;
 
     uint16_t location = vm->reg_i;
-    vm->ram[location] = hundredsDigit;
-    vm->ram[location + 1] = tensDigit;
-    vm->ram[location + 2] = lowDigit;
+    if (location + 2 >= RAM_SIZE) {
+        vm->error = ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS;
+        return;
+    }
+    vm_check_watch(vm, location, 3, WATCH_WRITE);
+
+    vm_write(vm, location, hundredsDigit);
+    vm_write(vm, location + 1, tensDigit);
+    vm_write(vm, location + 2, lowDigit);
+}
+
+#define PROFILE default
+#define QUIRK_SHIFT_VY 0
+#define QUIRK_INCREMENT_I 0
+#define QUIRK_JUMP_VX 0
+#define QUIRK_CLIP_SPRITES 0
+#define QUIRK_VF_RESET 0
+#define QUIRK_LEGACY_FLAGS 1
+#include "dispatch.h"
+
+#define PROFILE chip8
+#define QUIRK_SHIFT_VY 1
+#define QUIRK_INCREMENT_I 1
+#define QUIRK_JUMP_VX 0
+#define QUIRK_CLIP_SPRITES 1
+#define QUIRK_VF_RESET 1
+#define QUIRK_LEGACY_FLAGS 0
+#include "dispatch.h"
+
+#define PROFILE schip
+#define QUIRK_SHIFT_VY 0
+#define QUIRK_INCREMENT_I 0
+#define QUIRK_JUMP_VX 1
+#define QUIRK_CLIP_SPRITES 1
+#define QUIRK_VF_RESET 0
+#define QUIRK_LEGACY_FLAGS 0
+#include "dispatch.h"
+
+#define PROFILE xochip
+#define QUIRK_SHIFT_VY 1
+#define QUIRK_INCREMENT_I 1
+#define QUIRK_JUMP_VX 0
+#define QUIRK_CLIP_SPRITES 0
+#define QUIRK_VF_RESET 0
+#define QUIRK_LEGACY_FLAGS 0
+#include "dispatch.h"
+
+/*
+ * The individual handlers and run_instruction() keep this emulator's
+ * default semantics.
+ */
+void run_or_vx_vy(struct chip8 *vm, uint16_t instruction) {
+    or_vx_vy_default(vm, instruction);
+}
+
+void run_and_vx_vy(struct chip8 *vm, uint16_t instruction) {
+    and_vx_vy_default(vm, instruction);
+}
+
+void run_xor_vx_vy(struct chip8 *vm, uint16_t instruction) {
+    xor_vx_vy_default(vm, instruction);
+}
+
+void run_add_vx_vy(struct chip8 *vm, uint16_t instruction) {
+    add_vx_vy_default(vm, instruction);
+}
+
+void run_sub_vx_vy(struct chip8 *vm, uint16_t instruction) {
+    sub_vx_vy_default(vm, instruction);
+}
+
+void run_shr_vx(struct chip8 *vm, uint16_t instruction) {
+    shr_vx_default(vm, instruction);
+}
+
+void run_subn_vx_vy(struct chip8 *vm, uint16_t instruction) {
+    subn_vx_vy_default(vm, instruction);
+}
+
+void run_shl_vx(struct chip8 *vm, uint16_t instruction) {
+    shl_vx_default(vm, instruction);
+}
+
+void run_jp_v0_addr(struct chip8 *vm, uint16_t instruction) {
+    jp_v0_addr_default(vm, instruction);
+}
+
+void run_drw_vx_vy_n(struct chip8 *vm, uint16_t instruction) {
+    drw_vx_vy_n_default(vm, instruction);
 }
 
 void run_ld_i_vx(struct chip8 *vm, uint16_t instruction) {
-    uint8_t reg = REG_1(instruction);
-    uint16_t location = vm->reg_i;
-    uint8_t i;
-    for (i = 0; i <= reg; ++i) {
-        vm->ram[location++] = vm->reg_v[i];
-    }
+    ld_i_vx_default(vm, instruction);
 }
 
 void run_ld_vx_i(struct chip8 *vm, uint16_t instruction) {
-    uint8_t reg = REG_1(instruction);
-    uint16_t location = vm->reg_i;
-    uint8_t i;
-    for (i = 0; i <= reg; ++i) {
-        vm->reg_v[i] = vm->ram[location++];
-    }
+    ld_vx_i_default(vm, instruction);
 }
 
-void run_8xyn(struct chip8 *vm, uint16_t instruction) {
-    uint8_t optype = LOW_NIBBLE(instruction);
+void run_instruction(struct chip8 *vm, uint16_t instruction) {
+    dispatch_default(vm, instruction);
+}
 
-    switch (optype) {
-        case 0:
-            run_ld_vx_vy(vm, instruction);
-            break;
-        case 1:
-            run_or_vx_vy(vm, instruction);
-            break;
-        case 2:
-            run_and_vx_vy(vm, instruction);
-            break;
-        case 3:
-            run_xor_vx_vy(vm, instruction);
+void run_instruction_with_profile(struct chip8 *vm, enum quirk_profile profile,
+        uint16_t instruction) {
+    switch (profile) {
+        case PROFILE_CHIP8:
+            dispatch_chip8(vm, instruction);
             break;
-        case 4:
-            run_add_vx_vy(vm, instruction);
+        case PROFILE_SCHIP:
+            dispatch_schip(vm, instruction);
             break;
-        case 5:
-            run_sub_vx_vy(vm, instruction);
-            break;
-        case 6:
-            run_shr_vx(vm, instruction);
-            break;
-        case 7:
-            run_subn_vx_vy(vm, instruction);
-            break;
-        case 0xE:
-            run_shl_vx(vm, instruction);
+        case PROFILE_XOCHIP:
+            dispatch_xochip(vm, instruction);
             break;
         default:
-            printf("Skipping unknown 8xyn instruction %x\n", instruction);
+            dispatch_default(vm, instruction);
     }
 }
 
-void run_instruction(struct chip8 *vm, uint16_t instruction) {
-    uint16_t instruction_type = HIGH_NIBBLE(instruction);
-
-    switch (instruction_type) {
-        case 0:
-            switch (instruction) {
-                case CLS:
-                    run_cls(vm);
-                    break;
-                case RET:
-                    run_ret(vm);
-                    break;
-                default:
-                    printf("Skipping unknown 0nnn instruction %x\n", instruction);
-            }
-            break;
-        case 1:
-            run_jp_addr(vm, instruction);
-            break;
-        case 2:
-            run_call_addr(vm, instruction);
-            break;
-        case 3:
-            run_se_vx_byte(vm, instruction);
-            break;
-        case 4:
-            run_sne_vx_byte(vm, instruction);
-            break;
-        case 5:
-            if (LOW_NIBBLE(instruction) == 0) {
-                run_se_vx_vy(vm, instruction);
-            } else {
-                printf("Skipping unknown 5nnn instruction %x\n", instruction);
-            }
-            break;
-        case 6:
-            run_ld_vx_byte(vm, instruction);
-            break;
-        case 7:
-            run_add_vx_byte(vm, instruction);
-            break;
-        case 8:
-            run_8xyn(vm, instruction);
-            break;
-        case 9:
-            if (LOW_NIBBLE(instruction) == 0) {
-                run_sne_vx_vy(vm, instruction);
-            } else {
-                printf("Skipping unknown 9nnn instruction %x\n", instruction);
-            }
-            break;
-        case 0xA:
-            run_ld_i_addr(vm, instruction);
-            break;
-        case 0xB:
-            run_jp_v0_addr(vm, instruction);
-            break;
-        case 0xC:
-            run_rnd_vx_byte(vm, instruction);
-            break;
-        case 0xD:
-            run_drw_vx_vy_n(vm, instruction);
-            break;
-        case 0xE:
-            switch (LOW_BYTE(instruction)) {
-                case 0x9E:
-                    run_skp_vx(vm, instruction);
-                    break;
-                case 0xA1:
-                    run_sknp_vx(vm, instruction);
-                    break;
-                default:
-                    printf("Skipping unknown 0xEnnn instruction %x\n", instruction);
-                    break;
-            }
-            break;
-        case 0xF:
-            switch (LOW_BYTE(instruction)) {
-                case 0x7:
-                    run_ld_vx_dt(vm, instruction);
-                    break;
-                case 0xA:
-                    run_ld_vx_k(vm, instruction);
-                    break;
-                case 0x15:
-                    run_ld_dt_vx(vm, instruction);
-                    break;
-                case 0x18:
-                    run_ld_st_vx(vm, instruction);
-                    break;
-                case 0x1E:
-                    run_add_i_vx(vm, instruction);
-                    break;
-                case 0x29:
-                    run_ld_f_vx(vm, instruction);
-                    break;
-                case 0x33:
-                    run_ld_b_vx(vm, instruction);
-                    break;
-                case 0x55:
-                    run_ld_i_vx(vm, instruction);
-                    break;
-                case 0x65:
-                    run_ld_vx_i(vm, instruction);
-                    break;
-                default:
-                    printf("Skipping unknown 0xFnnn instruction %x\n", instruction);
-                    break;
-            }
-            break;
+static int run_traced_cycles(struct chip8 *vm, int cycles) {
+    switch (vm->profile) {
+        case PROFILE_CHIP8:
+            return run_traced_cycles_chip8(vm, cycles);
+        case PROFILE_SCHIP:
+            return run_traced_cycles_schip(vm, cycles);
+        case PROFILE_XOCHIP:
+            return run_traced_cycles_xochip(vm, cycles);
         default:
-            printf("Skipping unknown instruction %x\n", instruction);
+            return run_traced_cycles_default(vm, cycles);
     }
 }
 
+int run_interpreted_cycles(struct chip8 *vm, int cycles) {
+    if (vm->trace) {
+        return run_traced_cycles(vm, cycles);
+    }
+    switch (vm->profile) {
+        case PROFILE_CHIP8:
+            return run_cycles_chip8(vm, cycles);
+        case PROFILE_SCHIP:
+            return run_cycles_schip(vm, cycles);
+        case PROFILE_XOCHIP:
+            return run_cycles_xochip(vm, cycles);
+        default:
+            return run_cycles_default(vm, cycles);
+    }
+}
+
+int run_cycles(struct chip8 *vm, int cycles) {
+    // Translated blocks don't keep pc current, which a watchpoint hit
+    // needs, and don't record traces.
+    if (vm->native && !vm->watched_pages && !vm->trace) {
+        return native_run_cycles(vm->native, vm, cycles);
+    }
+    return run_interpreted_cycles(vm, cycles);
+}
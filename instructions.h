@@ -2,6 +2,7 @@
 #define INSTRUCTIONS_H
 
 #include <stdint.h>
+#include "machine.h"
 
 #define LOW_BYTE(instr) (instr & 0x00FF)
 #define MEM_ADDR(instr) (instr & 0x0FFF)
@@ -14,11 +15,32 @@
 
 #define CLS 0x00E0
 #define RET 0x00EE
+/*
+ * An otherwise ignored 0nnn word the debugger writes over instructions
+ * to break on them. It only stops the VM while breakpoints are armed.
+ */
+#define BREAKPOINT 0x0001
 
 struct chip8;
 
 void run_instruction(struct chip8 *vm, uint16_t instruction);
 
+void run_instruction_with_profile(struct chip8 *vm, enum quirk_profile profile,
+        uint16_t instruction);
+
+/*
+ * Fetches and executes up to `cycles` instructions with the VM's quirk
+ * profile, stopping early on an error or when waiting for a key.
+ * Returns the number of instructions executed. Uses the VM's translated
+ * program if one is attached.
+ */
+int run_cycles(struct chip8 *vm, int cycles);
+
+/*
+ * run_cycles() that always interprets.
+ */
+int run_interpreted_cycles(struct chip8 *vm, int cycles);
+
 void run_cls(struct chip8 *vm);
 
 void run_ret(struct chip8 *vm);
@@ -2,14 +2,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include "machine.h"
 #include "instructions.h"
 #include "screen.h"
-#include "sdl_system.h"
-
-#define UPDATE_INTERVAL_SECONDS (1/120.f)
-#define TIMER_UPDATE_INTERVAL_SECONDS (1/120.f)
-#define RENDER_INTERVAL_SECONDS (1/60.f)
+#include "eventlog.h"
 
 uint8_t hex_sprites[] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0x0
@@ -31,85 +28,234 @@ uint8_t hex_sprites[] = {
 };
 
 /*
- * Reads two-byte instruction stored in big-endian format
- * from RAM (starting at PC).
+ * 64-bit FNV-1a, used to identify ROM images.
  */
-uint16_t read_instruction(struct chip8 *vm) {
-    uint8_t high_byte = vm->ram[vm->pc];
-    uint8_t low_byte = vm->ram[vm->pc + 1];
-    return high_byte << 8 | low_byte;
+uint64_t hash_rom(const uint8_t *image, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= image[i];
+        hash *= 0x100000001b3u;
+    }
+    return hash;
+}
+
+struct rom_image *rom_image_create(const uint8_t *program, size_t size) {
+    struct rom_image *image = calloc(1, sizeof(struct rom_image));
+
+    if (size > RAM_SIZE - PROG_MEM_START) {
+        size = RAM_SIZE - PROG_MEM_START;
+    }
+    image->refs = 1;
+    image->program_size = size;
+    image->hash = hash_rom(program, size);
+    memcpy(&image->ram[HEX_SPRITE_START_ADDR], hex_sprites, 16 * HEX_SPRITE_LEN);
+    memcpy(&image->ram[PROG_MEM_START], program, size);
+    for (int i = 0; i < RAM_SIZE; ++i) {
+        image->ram_hash ^= ram_key(i, image->ram[i]);
+    }
+
+    return image;
+}
+
+void rom_image_release(struct rom_image *image) {
+    // Instances of one image may be released from different threads.
+    if (image && __atomic_sub_fetch(&image->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(image);
+    }
 }
 
-void init(struct chip8 *vm, size_t program_size) {
+void vm_init_shared(struct chip8 *vm, struct rom_image *image) {
+    memset(vm, 0, sizeof(*vm));
+    __atomic_add_fetch(&image->refs, 1, __ATOMIC_RELAXED);
+    vm->image = image;
+    for (int i = 0; i < RAM_PAGE_COUNT; ++i) {
+        vm->pages[i] = &image->ram[i * RAM_PAGE_SIZE];
+    }
+
     vm->pc = PROG_MEM_START;
-    vm->sp = 0;
-    vm->error = 0;
-    vm->awaiting_input = false;
-    vm->prog_mem_end = PROG_MEM_START + program_size;
+    // A two-byte instruction can't start at the last byte of RAM.
+    vm->prog_mem_end = PROG_MEM_START + image->program_size;
+    if (vm->prog_mem_end > RAM_SIZE - 1) {
+        vm->prog_mem_end = RAM_SIZE - 1;
+    }
+    vm->cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    vm->rom_hash = image->hash;
+    vm->ram_hash = image->ram_hash;
     clear_screen(&vm->screen);
+}
 
-    memcpy(&vm->ram[HEX_SPRITE_START_ADDR], hex_sprites, 16 * HEX_SPRITE_LEN);
+struct ram_page {
+    int refs;
+    uint8_t bytes[RAM_PAGE_SIZE];
+};
+
+static struct ram_page *page_of(uint8_t *bytes) {
+    return (struct ram_page *) (bytes - offsetof(struct ram_page, bytes));
+}
+
+static void release_page(uint8_t *bytes) {
+    struct ram_page *page = page_of(bytes);
+    if (__atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(page);
+    }
+}
+
+void vm_make_page_private(struct chip8 *vm, int page) {
+    struct ram_page *copy = malloc(sizeof(struct ram_page));
+    uint16_t bit = 1 << page;
+
+    copy->refs = 1;
+    memcpy(copy->bytes, vm->pages[page], RAM_PAGE_SIZE);
+    if (vm->owned_pages & bit) {
+        release_page(vm->pages[page]);
+    }
+    vm->pages[page] = copy->bytes;
+    vm->owned_pages |= bit;
+    vm->private_pages |= bit;
+}
+
+void vm_fork(struct chip8 *child, struct chip8 *parent) {
+    *child = *parent;
+    __atomic_add_fetch(&parent->image->refs, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < RAM_PAGE_COUNT; ++i) {
+        if (parent->owned_pages & 1 << i) {
+            __atomic_add_fetch(&page_of(parent->pages[i])->refs, 1, __ATOMIC_RELAXED);
+        }
+    }
+    parent->private_pages = 0;
+    child->private_pages = 0;
+    // A trace or event log has a single producer, and watchpoint hits
+    // belong to the parent's debugger.
+    child->trace = NULL;
+    child->events = NULL;
+    child->watches = NULL;
+    child->watched_pages = 0;
+}
+
+void vm_release(struct chip8 *vm) {
+    for (int i = 0; i < RAM_PAGE_COUNT; ++i) {
+        if (vm->owned_pages & 1 << i) {
+            release_page(vm->pages[i]);
+        }
+        vm->pages[i] = NULL;
+    }
+    vm->private_pages = 0;
+    vm->owned_pages = 0;
+    rom_image_release(vm->image);
+    vm->image = NULL;
+}
+
+size_t vm_init_with_image(struct chip8 *vm, const uint8_t *image, size_t size) {
+    struct rom_image *shared = rom_image_create(image, size);
+
+    vm_init_shared(vm, shared);
+    rom_image_release(shared);
+
+    return vm->image->program_size;
 }
 
 size_t vm_init_with_rom(struct chip8 *vm, const char *const filename) {
+    uint8_t program[RAM_SIZE - PROG_MEM_START];
     FILE *fp = fopen(filename, "r");
     if (fp == NULL) {
         printf("Cannot open file %s.\n", filename);
         exit(1);
     }
 
-    int max_size = RAM_SIZE - PROG_MEM_START;
-    size_t bytes_read = fread(&vm->ram[PROG_MEM_START], sizeof(uint8_t), max_size, fp);
+    size_t bytes_read = fread(program, sizeof(uint8_t), sizeof(program), fp);
     fclose(fp);
 
-    init(vm, bytes_read);
+    return vm_init_with_image(vm, program, bytes_read);
+}
+
+void vm_report(struct chip8 *vm, enum vm_event_type type, uint16_t pc, uint16_t opcode) {
+    struct vm_event event = { vm->instructions, pc, opcode, type, vm->error, 0 };
+    char line[128];
 
-    return bytes_read;
+    if (vm->events && event_log_push(vm->events, &event)) {
+        return;
+    }
+    if (type == EVENT_ERROR) {
+        format_event(line, sizeof(line), &event);
+        fprintf(stderr, "%s\n", line);
+    }
 }
 
-void print_error(struct chip8* vm, uint16_t old_pc) {
-    switch (vm->error) {
-        case NO_ERROR:
-            break;
-        case ERROR_STACK_OVERFLOW:
-            printf("Error: Stack overflow at %04x\n", old_pc);
-            break;
-        case ERROR_STACK_UNDERFLOW:
-            printf("Error: Stack underflow at %04x\n", old_pc);
-            break;
-        case ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS:
-            printf("Error: Out of bounds memory access at %04x\n", old_pc);
-            break;
-        default:
-            printf("Error: Unknown error\n");
+void vm_watch_access(struct chip8 *vm, uint16_t address, uint16_t length, uint8_t access) {
+    struct watch_table *watches = vm->watches;
+
+    if (watches == NULL) {
+        return;
+    }
+    for (int i = 0; i < watches->count; ++i) {
+        const struct watchpoint *point = &watches->points[i];
+        if ((point->access & access) && address < point->start + point->length &&
+                point->start < address + length) {
+            watches->hit.pc = vm->pc - 2;
+            watches->hit.address = address > point->start ? address : point->start;
+            watches->hit.access = access;
+            vm->error = ERROR_WATCHPOINT;
+            return;
+        }
     }
 }
 
+/*
+ * Fetches and executes a single instruction. Errors are left in
+ * vm->error for the caller to report.
+ */
+void vm_step(struct chip8 *vm) {
+    run_cycles(vm, 1);
+}
+
 void vm_run_instruction(struct chip8 *vm, float dt) {
+    // A translated block only runs when the cycle budget fits all of
+    // it, so a native program gets a whole frame's instructions at once.
+    int cycles = vm->native ? vm->cycles_per_frame : 1;
+
     vm->sec_since_update += dt;
-    if (vm->sec_since_update < UPDATE_INTERVAL_SECONDS || vm->awaiting_input) {
+    if (vm->sec_since_update < RENDER_INTERVAL_SECONDS * cycles / vm->cycles_per_frame ||
+            vm->awaiting_input) {
         return;
     }
 
-    uint16_t instruction = read_instruction(vm);
     uint16_t old_pc = vm->pc;
 
-    vm->pc += 2;
-
-    run_instruction(vm, instruction);
-
-    if (vm->pc < PROG_MEM_START || vm->pc >= vm->prog_mem_end) {
-        vm->error = ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS;
-    }
+    run_cycles(vm, cycles);
 
     if (vm->error) {
-        print_error(vm, old_pc);
+        // After a batch only the pc the VM stopped at is known.
+        uint16_t pc = cycles == 1 ? old_pc : vm->pc;
+        vm_report(vm, EVENT_ERROR, pc, vm_read(vm, pc) << 8 | vm_read(vm, pc + 1));
         exit(vm->error);
     }
 
     vm->sec_since_update = 0;
 }
 
+uint16_t scripted_keypad(uint64_t *keys, uint32_t frame) {
+    if (frame % KEYPAD_SCRIPT_PERIOD == 0) {
+        *keys = *keys * 6364136223846793005u + 1442695040888963407u;
+    }
+    return *keys >> 48;
+}
+
+void vm_end_frame(struct chip8 *vm) {
+    if (!vm->awaiting_input) {
+        for (int i = 0; i < TIMER_TICKS_PER_FRAME; ++i) {
+            if (vm->reg_dt > 0) --vm->reg_dt;
+            if (vm->reg_st > 0) --vm->reg_st;
+        }
+    }
+}
+
+enum vm_error vm_run_frame(struct chip8 *vm) {
+    run_cycles(vm, vm->cycles_per_frame);
+    vm_end_frame(vm);
+
+    return vm->error;
+}
+
 void vm_update_timers(struct chip8 *vm, float dt) {
     vm->sec_since_dt_update += dt;
     vm->sec_since_st_update += dt;
@@ -125,30 +271,100 @@ void vm_update_timers(struct chip8 *vm, float dt) {
     }
 }
 
-void vm_render(struct chip8 *vm, float dt, struct io_state *io) {
-    vm->sec_since_render += dt;
-    if (vm->screen.changed && vm->sec_since_render >= RENDER_INTERVAL_SECONDS) {
-        draw_screen(io, &vm->screen);
-        vm->screen.changed = false;
-        vm->sec_since_render = 0;
+void vm_set_keypad(struct chip8 *vm, uint16_t keypad) {
+    uint16_t pressed = keypad & ~vm->keypad;
+
+    vm->keypad = keypad;
+    if (pressed && vm->awaiting_input) {
+        int hex_key = 0;
+        while (!(pressed & (1 << hex_key))) {
+            ++hex_key;
+        }
+        run_ld_vx_k_receive_input(vm, hex_key);
+    }
+}
+
+void vm_press_key(struct chip8 *vm, int hex_key, uint64_t time) {
+    vm->input_time = time;
+    vm->input_key = hex_key;
+}
+
+void vm_read_input(struct chip8 *vm) {
+    // Keep measuring from an earlier press until the screen answers it.
+    if (!vm->read_input_time) {
+        vm->read_input_time = vm->input_time;
+        vm->read_screen_hash = vm->screen.pixel_hash;
     }
+    vm->input_time = 0;
 }
 
-void vm_run(struct chip8 *vm, float dt, struct io_state *io) {
-    uint8_t old_st = vm->reg_st;
+void vm_seed_random(struct chip8 *vm, uint64_t seed) {
+    vm->rng_state = seed;
+}
 
-    vm_run_instruction(vm, dt);
-    vm_update_timers(vm, dt);
+uint64_t vm_state_hash(const struct chip8 *vm) {
+    uint64_t v_low, v_high;
+    uint64_t h = vm->ram_hash ^ mix64(vm->screen.pixel_hash ^ 0x9e3779b97f4a7c15u);
 
-    if (vm->reg_st != old_st) {
-        if (vm->reg_st > 0) {
-            play_sound(io);
-        } else {
-            stop_sound(io);
-        }
+    memcpy(&v_low, &vm->reg_v[0], 8);
+    memcpy(&v_high, &vm->reg_v[8], 8);
+    h = mix64(h ^ v_low);
+    h = mix64(h ^ v_high);
+    h = mix64(h ^ ((uint64_t) vm->pc | (uint64_t) vm->reg_i << 16 |
+                (uint64_t) vm->sp << 32 | (uint64_t) vm->reg_dt << 48 |
+                (uint64_t) vm->reg_st << 56));
+    h = mix64(h ^ ((uint64_t) vm->keypad | (uint64_t) vm->awaiting_input << 16 |
+                (uint64_t) vm->input_register << 24 | (uint64_t) vm->error << 32));
+    h = mix64(h ^ vm->rng_state);
+    for (int i = 0; i < vm->sp && i < STACK_SIZE; ++i) {
+        h = mix64(h ^ vm->stack[i]);
+    }
+    return h;
+}
+
+uint64_t vm_hash_ram(const struct chip8 *vm) {
+    uint64_t h = 0;
+    for (int i = 0; i < RAM_SIZE; ++i) {
+        h ^= ram_key(i, vm_read(vm, i));
+    }
+    return h;
+}
+
+void cycle_detector_reset(struct cycle_detector *detector, uint64_t hash) {
+    detector->saved = hash;
+    detector->power = 1;
+    detector->length = 0;
+}
+
+uint32_t cycle_detector_update(struct cycle_detector *detector, uint64_t hash) {
+    ++detector->length;
+    if (hash == detector->saved) {
+        return detector->length;
     }
+    if (detector->length == detector->power) {
+        detector->saved = hash;
+        detector->power *= 2;
+        detector->length = 0;
+    }
+    return 0;
+}
 
-    vm_render(vm, dt, io);
+static const char *profile_names[PROFILE_COUNT] = {
+    "default", "chip8", "schip", "xochip"
+};
+
+const char *profile_name(enum quirk_profile profile) {
+    return profile < PROFILE_COUNT ? profile_names[profile] : "unknown";
+}
+
+bool parse_profile(const char *name, enum quirk_profile *profile) {
+    for (int i = 0; i < PROFILE_COUNT; ++i) {
+        if (strcmp(name, profile_names[i]) == 0) {
+            *profile = i;
+            return true;
+        }
+    }
+    return false;
 }
 
 void vm_receive_input(struct chip8 *vm, int hex_key) {
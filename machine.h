@@ -11,18 +11,110 @@
 #define STACK_SIZE 16
 #define HEX_SPRITE_LEN 5
 #define HEX_SPRITE_START_ADDR 0
+#define DEFAULT_CYCLES_PER_FRAME 2
+#define TIMER_UPDATE_INTERVAL_SECONDS (1/120.f)
+#define RENDER_INTERVAL_SECONDS (1/60.f)
+#define TIMER_TICKS_PER_FRAME ((int) (RENDER_INTERVAL_SECONDS / TIMER_UPDATE_INTERVAL_SECONDS + 0.5f))
+#define RAM_PAGE_SIZE 256
+#define RAM_PAGE_COUNT (RAM_SIZE / RAM_PAGE_SIZE)
 
-struct io_state;
+struct native_program;
+struct trace;
+struct event_log;
 
 enum vm_error {
     NO_ERROR,
     ERROR_STACK_OVERFLOW,
     ERROR_STACK_UNDERFLOW,
-    ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS
+    ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS,
+    ERROR_BREAKPOINT,
+    ERROR_WATCHPOINT
 };
 
-struct chip8 {
+/*
+ * Diagnostics reported through vm_report(); see eventlog.h.
+ */
+enum vm_event_type {
+    EVENT_UNKNOWN_INSTRUCTION,
+    EVENT_ERROR,
+    EVENT_TYPE_COUNT
+};
+
+/*
+ * Instruction semantics that differ between CHIP-8 implementations.
+ * PROFILE_DEFAULT is this emulator's original behaviour.
+ */
+enum quirk_profile {
+    PROFILE_DEFAULT,
+    PROFILE_CHIP8,
+    PROFILE_SCHIP,
+    PROFILE_XOCHIP,
+    PROFILE_COUNT
+};
+
+/*
+ * Font and program image shared read-only by every VM started from it.
+ * Reference counted; the last vm_release() frees it.
+ */
+struct rom_image {
+    int refs;
+    uint64_t hash;
+    uint64_t ram_hash;
+    size_t program_size;
     uint8_t ram[RAM_SIZE];
+};
+
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+#define MAX_WATCHPOINTS 16
+
+/*
+ * RAM ranges to stop on when Fx33, Fx55, Fx65 or a sprite read touches
+ * them with a matching access. `hit` describes the last access that
+ * raised ERROR_WATCHPOINT; the instruction completes before the VM
+ * stops.
+ */
+struct watchpoint {
+    uint16_t start;
+    uint16_t length;
+    uint8_t access;
+};
+
+struct watch_table {
+    struct watchpoint points[MAX_WATCHPOINTS];
+    int count;
+    struct {
+        uint16_t pc;
+        uint16_t address;
+        uint8_t access;
+    } hit;
+};
+
+/*
+ * RAM is mapped in RAM_PAGE_SIZE pages. Pages start out pointing into
+ * the shared rom_image and are copied on the first write (only Fx33
+ * and Fx55 write to memory). owned_pages marks pages that are heap
+ * copies the VM holds a reference to; private_pages marks the subset
+ * it may write in place. vm_fork() shares owned pages, clearing
+ * private_pages on both sides.
+ *
+ * ram_hash is the XOR of ram_key() over every address, updated by
+ * vm_write(); together with screen.pixel_hash it lets vm_state_hash()
+ * hash the whole VM without reading RAM or the framebuffer.
+ *
+ * watched_pages marks pages covered by a watchpoint in `watches`.
+ * Memory instructions consult only the bitmap and look the table up
+ * when they touch a watched page. `trace`, when set, records every
+ * interpreted instruction (see trace.h), and `events` collects
+ * diagnostics (see eventlog.h); vm_fork() passes on neither, nor the
+ * watchpoints.
+ */
+struct chip8 {
+    uint8_t *pages[RAM_PAGE_COUNT];
+    uint16_t private_pages;
+    uint16_t owned_pages;
+    uint64_t ram_hash;
+    struct rom_image *image;
     uint16_t stack[STACK_SIZE];
     uint16_t pc;
     uint16_t sp;
@@ -40,11 +132,222 @@ struct chip8 {
 
     bool awaiting_input;
     uint8_t input_register;
+    uint16_t keypad;
+    // Input latency, in the frontend's clock: the last key press the
+    // program hasn't read yet, then the one it read, with the screen's
+    // pixel hash at that point, until a changed frame is presented.
+    uint64_t input_time;
+    uint8_t input_key;
+    uint64_t read_input_time;
+    uint64_t read_screen_hash;
+    uint64_t rng_state;
+    enum quirk_profile profile;
+    int cycles_per_frame;
+    uint64_t rom_hash;
+    const struct native_program *native;
+    bool breakpoints_armed;
+    uint16_t watched_pages;
+    struct watch_table *watches;
+    struct trace *trace;
+    struct event_log *events;
+    uint64_t instructions;  // completed without an error by run_cycles()
 };
 
+uint64_t hash_rom(const uint8_t *image, size_t size);
+
+void vm_make_page_private(struct chip8 *vm, int page);
+
+static inline uint64_t ram_key(uint16_t address, uint8_t value) {
+    return mix64((uint64_t) address << 8 | value);
+}
+
+static inline uint8_t vm_read(const struct chip8 *vm, uint16_t address) {
+    return vm->pages[address / RAM_PAGE_SIZE][address % RAM_PAGE_SIZE];
+}
+
+static inline void vm_write(struct chip8 *vm, uint16_t address, uint8_t value) {
+    int page = address / RAM_PAGE_SIZE;
+    uint8_t *byte;
+
+    if (!(vm->private_pages & 1 << page)) {
+        vm_make_page_private(vm, page);
+    }
+    byte = &vm->pages[page][address % RAM_PAGE_SIZE];
+    vm->ram_hash ^= ram_key(address, *byte) ^ ram_key(address, value);
+    *byte = value;
+}
+
+/*
+ * Appends an event for the instruction `opcode` at `pc` to vm->events.
+ * Errors take their code from vm->error, and go straight to stderr when
+ * no log is attached or the log has no room.
+ */
+void vm_report(struct chip8 *vm, enum vm_event_type type, uint16_t pc, uint16_t opcode);
+
+/*
+ * Slow path of vm_check_watch(): raises ERROR_WATCHPOINT if the access
+ * overlaps a watchpoint.
+ */
+void vm_watch_access(struct chip8 *vm, uint16_t address, uint16_t length, uint8_t access);
+
+/*
+ * Called by the memory instructions before touching `length` (> 0)
+ * bytes at `address`.
+ */
+static inline void vm_check_watch(struct chip8 *vm, uint16_t address, uint16_t length,
+        uint8_t access) {
+    uint32_t first = address / RAM_PAGE_SIZE;
+    uint32_t last = (address + length - 1u) / RAM_PAGE_SIZE;
+
+    if (vm->watched_pages >> first & ((2u << (last - first)) - 1)) {
+        vm_watch_access(vm, address, length, access);
+    }
+}
+
+/*
+ * Builds a shared image (font plus program) with one reference held by
+ * the caller.
+ */
+struct rom_image *rom_image_create(const uint8_t *program, size_t size);
+
+void rom_image_release(struct rom_image *image);
+
+/*
+ * Loads a ROM and resets the VM. The image hash is left in vm->rom_hash
+ * for looking up per-ROM settings.
+ */
 size_t vm_init_with_rom(struct chip8 *vm, const char *const filename);
 
-void vm_run(struct chip8 *vm, float dt, struct io_state *io);
+/*
+ * Resets the VM with an in-memory ROM image (e.g. a corpus archive
+ * slice). Images larger than program memory are truncated.
+ */
+size_t vm_init_with_image(struct chip8 *vm, const uint8_t *image, size_t size);
+
+/*
+ * Resets the VM on top of a shared image, taking a reference to it.
+ * Use this to run many instances of one ROM: each holds only the pages
+ * it has written to.
+ */
+void vm_init_shared(struct chip8 *vm, struct rom_image *image);
+
+/*
+ * Starts `child` as a copy of `parent`. Costs a copy of the register
+ * and screen state plus a reference per page; RAM is shared until
+ * either side writes to it. Release both with vm_release().
+ */
+void vm_fork(struct chip8 *child, struct chip8 *parent);
+
+/*
+ * Drops the VM's page and image references.
+ */
+void vm_release(struct chip8 *vm);
+
+/*
+ * Wall-clock pacing for interactive frontends (see vm_run() in
+ * sdl_system.h): runs the next instruction once its slot in the render
+ * interval has come, or with a native program attached the next frame's
+ * instructions once the frame has come, and ticks the timers at 60 Hz.
+ * VM errors are reported through vm_report() and end the program.
+ */
+void vm_run_instruction(struct chip8 *vm, float dt);
+
+void vm_update_timers(struct chip8 *vm, float dt);
+
+/*
+ * Runs one 60 Hz frame without any wall-clock timing: the instructions
+ * of one render interval followed by the matching timer ticks. Used by
+ * headless tools, which get deterministic results for a given ROM,
+ * random seed and keypad history.
+ */
+enum vm_error vm_run_frame(struct chip8 *vm);
+
+/*
+ * The timer ticks that close a vm_run_frame() frame, for callers that
+ * run its instructions themselves.
+ */
+void vm_end_frame(struct chip8 *vm);
+
+void vm_step(struct chip8 *vm);
+
+#define KEYPAD_SCRIPT_PERIOD 30
+
+/*
+ * Repeatable keypad input for runs without a player, e.g. profiling
+ * and benchmarks: a new pseudo-random state every KEYPAD_SCRIPT_PERIOD
+ * frames. Start `keys` at 1; returns the keypad for `frame`.
+ */
+uint16_t scripted_keypad(uint64_t *keys, uint32_t frame);
+
+/*
+ * Sets the keypad state, one bit per hex key. A newly pressed key
+ * satisfies a pending Fx0A.
+ */
+void vm_set_keypad(struct chip8 *vm, uint16_t keypad);
+
+/*
+ * Notes a hex key press at `time` (any clock the frontend likes) for
+ * input latency measurement. It replaces a press the program hasn't
+ * read yet.
+ */
+void vm_press_key(struct chip8 *vm, int hex_key, uint64_t time);
+
+/*
+ * The program read vm->input_key. The frame answering the press is the
+ * first one presented after the screen changes from here.
+ */
+void vm_read_input(struct chip8 *vm);
+
+/*
+ * Key test for Ex9E/ExA1, shared with translated code.
+ */
+static inline bool vm_key_down(struct chip8 *vm, uint8_t hex_key) {
+    if (vm->input_time && hex_key == vm->input_key) {
+        vm_read_input(vm);
+    }
+    return hex_key <= 0xF && (vm->keypad >> hex_key) & 1;
+}
+
+void vm_seed_random(struct chip8 *vm, uint64_t seed);
+
+/*
+ * 64-bit hash of everything that determines the VM's future: registers,
+ * stack, timers, keypad, random state, RAM and framebuffer. RAM and the
+ * framebuffer come from their incremental hashes, so this is O(1).
+ */
+uint64_t vm_state_hash(const struct chip8 *vm);
+
+/*
+ * Recomputes ram_hash from scratch.
+ */
+uint64_t vm_hash_ram(const struct chip8 *vm);
+
+/*
+ * Brent's cycle detection over a sequence of state hashes, one per
+ * frame. Once the sequence returns to an earlier state the VM is in a
+ * fixed-point cycle (as long as its input stays the same) and the
+ * remaining frames repeat with the returned period.
+ */
+struct cycle_detector {
+    uint64_t saved;
+    uint32_t power;
+    uint32_t length;
+};
+
+void cycle_detector_reset(struct cycle_detector *detector, uint64_t hash);
+
+/*
+ * Feeds the next state hash. Returns the cycle period, or 0 while no
+ * repeat has been seen.
+ */
+uint32_t cycle_detector_update(struct cycle_detector *detector, uint64_t hash);
+
+const char *profile_name(enum quirk_profile profile);
+
+/*
+ * Parses a profile name ("default", "chip8", "schip", "xochip").
+ */
+bool parse_profile(const char *name, enum quirk_profile *profile);
 
 void vm_receive_input(struct chip8 *vm, int hex_key);
 
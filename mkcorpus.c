@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "machine.h"
+#include "corpus.h"
+
+/*
+ * Packs every regular file in the given directories into a corpus
+ * archive. Files are truncated to the size of program memory, as
+ * vm_init_with_rom() would load them, so archive hashes match
+ * vm->rom_hash and ROM database keys.
+ */
+
+#define MAX_PATH 4096
+#define MAX_ROM_SIZE (RAM_SIZE - PROG_MEM_START)
+
+struct rom_list {
+    struct corpus_rom *roms;
+    size_t count;
+    size_t capacity;
+};
+
+bool read_rom(const char *path, const char *name, struct rom_list *list) {
+    uint8_t *data = malloc(MAX_ROM_SIZE + 1);
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        printf("Cannot open file %s.\n", path);
+        free(data);
+        return false;
+    }
+    size_t size = fread(data, 1, MAX_ROM_SIZE + 1, fp);
+    fclose(fp);
+
+    if (size > MAX_ROM_SIZE) {
+        printf("Warning: %s is larger than program memory, truncating.\n", path);
+        size = MAX_ROM_SIZE;
+    }
+    if (strlen(name) >= CORPUS_NAME_LEN) {
+        printf("Warning: name of %s truncated to %d bytes.\n", path, CORPUS_NAME_LEN - 1);
+    }
+
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->roms = realloc(list->roms, list->capacity * sizeof(struct corpus_rom));
+    }
+    list->roms[list->count++] = (struct corpus_rom) {
+        .name = strdup(name),
+        .hash = hash_rom(data, size),
+        .data = data,
+        .size = size
+    };
+
+    return true;
+}
+
+void add_directory(const char *dirname, struct rom_list *list) {
+    char path[MAX_PATH];
+    struct stat st;
+    struct dirent *entry;
+
+    DIR *dir = opendir(dirname);
+    if (dir == NULL) {
+        printf("Cannot open directory %s.\n", dirname);
+        exit(1);
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dirname, entry->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        read_rom(path, entry->d_name, list);
+    }
+    closedir(dir);
+}
+
+/*
+ * Drops ROMs whose image repeats an earlier one so lookups by hash are
+ * unambiguous.
+ */
+void drop_duplicates(struct rom_list *list) {
+    size_t kept = 0;
+
+    qsort(list->roms, list->count, sizeof(struct corpus_rom), corpus_compare_roms);
+    for (size_t i = 0; i < list->count; ++i) {
+        struct corpus_rom *rom = &list->roms[i];
+        struct corpus_rom *last = kept ? &list->roms[kept - 1] : NULL;
+
+        if (last && last->hash == rom->hash && last->size == rom->size &&
+                memcmp(last->data, rom->data, rom->size) == 0) {
+            printf("Skipping %s, same image as %s.\n", rom->name, last->name);
+            free((void *) rom->name);
+            free((void *) rom->data);
+        } else {
+            list->roms[kept++] = *rom;
+        }
+    }
+    list->count = kept;
+}
+
+int main(int argc, char **argv) {
+    struct rom_list list = { 0 };
+
+    if (argc < 3) {
+        printf("Usage: mkcorpus archive directory...\n");
+        exit(0);
+    }
+
+    for (int i = 2; i < argc; ++i) {
+        add_directory(argv[i], &list);
+    }
+    drop_duplicates(&list);
+
+    if (!corpus_write(argv[1], list.roms, list.count)) {
+        printf("Cannot write archive %s.\n", argv[1]);
+        exit(1);
+    }
+    printf("Wrote %zu ROMs to %s.\n", list.count, argv[1]);
+
+    for (size_t i = 0; i < list.count; ++i) {
+        free((void *) list.roms[i].name);
+        free((void *) list.roms[i].data);
+    }
+    free(list.roms);
+    return 0;
+}
@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <string.h>
+#include "movie.h"
+
+#define MOVIE_MAGIC "C8MV"
+#define MOVIE_INDEX_MAGIC "C8MI"
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_BYTES 16
+#define MOVIE_TRAILER_BYTES 16
+
+#define KEYFRAME 'K'
+#define DELTA_FRAME 'D'
+
+/*
+ * RLE tokens: 0x00-0x7F is a run of (n + 1) zero bytes, 0x80-0xFF is
+ * followed by ((n & 0x7F) + 1) literal bytes. Deltas of a mostly static
+ * screen are mostly zero, so an unchanged frame costs three bytes.
+ */
+#define RLE_MAX_RUN 128
+#define RLE_LITERAL 0x80
+
+static void write_u16(FILE *fp, uint16_t value) {
+    fputc(value & 0xFF, fp);
+    fputc(value >> 8, fp);
+}
+
+static void write_u32(FILE *fp, uint32_t value) {
+    write_u16(fp, value & 0xFFFF);
+    write_u16(fp, value >> 16);
+}
+
+static uint32_t get_u32(const uint8_t *bytes) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+static void rows_to_bytes(const uint64_t rows[SCREEN_HEIGHT_PX], uint8_t *bytes) {
+    for (int y = 0; y < SCREEN_HEIGHT_PX; ++y) {
+        for (int i = 0; i < 8; ++i) {
+            bytes[y * 8 + i] = rows[y] >> (56 - 8 * i);
+        }
+    }
+}
+
+static void xor_bytes_into_rows(uint64_t rows[SCREEN_HEIGHT_PX], const uint8_t *bytes) {
+    for (int y = 0; y < SCREEN_HEIGHT_PX; ++y) {
+        uint64_t row = 0;
+        for (int i = 0; i < 8; ++i) {
+            row = row << 8 | bytes[y * 8 + i];
+        }
+        rows[y] ^= row;
+    }
+}
+
+static size_t rle_encode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t i = 0;
+    size_t out_len = 0;
+
+    while (i < len) {
+        size_t run = 0;
+        if (in[i] == 0) {
+            while (i + run < len && run < RLE_MAX_RUN && in[i + run] == 0) {
+                ++run;
+            }
+            out[out_len++] = run - 1;
+        } else {
+            while (i + run < len && run < RLE_MAX_RUN && in[i + run] != 0) {
+                ++run;
+            }
+            out[out_len++] = RLE_LITERAL | (run - 1);
+            memcpy(&out[out_len], &in[i], run);
+            out_len += run;
+        }
+        i += run;
+    }
+
+    return out_len;
+}
+
+static bool rle_decode(FILE *fp, uint8_t *out, size_t len) {
+    size_t filled = 0;
+
+    while (filled < len) {
+        int token = fgetc(fp);
+        if (token == EOF) {
+            return false;
+        }
+        size_t run = (token & ~RLE_LITERAL) + 1;
+        if (filled + run > len) {
+            return false;
+        }
+        if (token & RLE_LITERAL) {
+            if (fread(&out[filled], 1, run, fp) != run) {
+                return false;
+            }
+        } else {
+            memset(&out[filled], 0, run);
+        }
+        filled += run;
+    }
+
+    return true;
+}
+
+bool movie_writer_open(struct movie_writer *writer, const char *const filename,
+        uint32_t keyframe_interval) {
+    memset(writer, 0, sizeof(*writer));
+    writer->fp = fopen(filename, "wb");
+    if (writer->fp == NULL) {
+        return false;
+    }
+    writer->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+
+    fwrite(MOVIE_MAGIC, 1, 4, writer->fp);
+    write_u16(writer->fp, MOVIE_VERSION);
+    write_u16(writer->fp, SCREEN_WIDTH_PX);
+    write_u16(writer->fp, SCREEN_HEIGHT_PX);
+    write_u16(writer->fp, 0);
+    write_u32(writer->fp, writer->keyframe_interval);
+
+    return true;
+}
+
+void movie_write_frame(struct movie_writer *writer, const struct screen * const screen) {
+    uint64_t rows[SCREEN_HEIGHT_PX];
+    uint8_t bytes[MOVIE_FRAME_BYTES];
+    uint8_t encoded[MOVIE_FRAME_BYTES * 2];
+    bool keyframe = writer->frame_count % writer->keyframe_interval == 0;
+
+    pack_screen(screen, rows);
+    if (keyframe) {
+        if (writer->keyframe_count == writer->keyframe_capacity) {
+            writer->keyframe_capacity = writer->keyframe_capacity ? writer->keyframe_capacity * 2 : 64;
+            writer->keyframes = realloc(writer->keyframes,
+                    writer->keyframe_capacity * sizeof(uint32_t));
+        }
+        writer->keyframes[writer->keyframe_count++] = ftell(writer->fp);
+        memset(writer->previous, 0, sizeof(writer->previous));
+    }
+
+    for (int y = 0; y < SCREEN_HEIGHT_PX; ++y) {
+        writer->previous[y] ^= rows[y];
+    }
+    rows_to_bytes(writer->previous, bytes);
+    memcpy(writer->previous, rows, sizeof(rows));
+
+    fputc(keyframe ? KEYFRAME : DELTA_FRAME, writer->fp);
+    fwrite(encoded, 1, rle_encode(bytes, sizeof(bytes), encoded), writer->fp);
+    ++writer->frame_count;
+
+    // Bound what a crash can lose to one keyframe interval.
+    if (keyframe) {
+        fflush(writer->fp);
+    }
+}
+
+void movie_writer_close(struct movie_writer *writer) {
+    if (writer->fp == NULL) {
+        return;
+    }
+
+    uint32_t index_offset = ftell(writer->fp);
+    for (uint32_t i = 0; i < writer->keyframe_count; ++i) {
+        write_u32(writer->fp, writer->keyframes[i]);
+    }
+    fwrite(MOVIE_INDEX_MAGIC, 1, 4, writer->fp);
+    write_u32(writer->fp, index_offset);
+    write_u32(writer->fp, writer->keyframe_count);
+    write_u32(writer->fp, writer->frame_count);
+
+    fclose(writer->fp);
+    free(writer->keyframes);
+    writer->fp = NULL;
+    writer->keyframes = NULL;
+}
+
+static bool read_index(struct movie_reader *reader) {
+    uint8_t trailer[MOVIE_TRAILER_BYTES];
+
+    if (fseek(reader->fp, -MOVIE_TRAILER_BYTES, SEEK_END) != 0 ||
+            fread(trailer, 1, sizeof(trailer), reader->fp) != sizeof(trailer) ||
+            memcmp(trailer, MOVIE_INDEX_MAGIC, 4) != 0) {
+        return false;
+    }
+
+    uint32_t index_offset = get_u32(&trailer[4]);
+    reader->keyframe_count = get_u32(&trailer[8]);
+    reader->frame_count = get_u32(&trailer[12]);
+    reader->keyframes = malloc((reader->keyframe_count + 1) * sizeof(uint32_t));
+
+    fseek(reader->fp, index_offset, SEEK_SET);
+    for (uint32_t i = 0; i < reader->keyframe_count; ++i) {
+        uint8_t entry[4];
+        if (fread(entry, 1, 4, reader->fp) != 4) {
+            return false;
+        }
+        reader->keyframes[i] = get_u32(entry);
+    }
+
+    return true;
+}
+
+/*
+ * Recovers the index of a movie that was never closed by walking
+ * the frame records. A truncated final record is dropped.
+ */
+static void scan_index(struct movie_reader *reader) {
+    uint32_t capacity = 64;
+    uint8_t scratch[MOVIE_FRAME_BYTES];
+
+    free(reader->keyframes);
+    reader->keyframes = malloc(capacity * sizeof(uint32_t));
+    reader->keyframe_count = 0;
+    reader->frame_count = 0;
+
+    fseek(reader->fp, MOVIE_HEADER_BYTES, SEEK_SET);
+    for (;;) {
+        long offset = ftell(reader->fp);
+        int type = fgetc(reader->fp);
+        bool keyframe = reader->frame_count % reader->keyframe_interval == 0;
+
+        if (type != (keyframe ? KEYFRAME : DELTA_FRAME) ||
+                !rle_decode(reader->fp, scratch, sizeof(scratch))) {
+            break;
+        }
+        if (keyframe) {
+            if (reader->keyframe_count == capacity) {
+                capacity *= 2;
+                reader->keyframes = realloc(reader->keyframes, capacity * sizeof(uint32_t));
+            }
+            reader->keyframes[reader->keyframe_count++] = offset;
+        }
+        ++reader->frame_count;
+    }
+}
+
+bool movie_reader_open(struct movie_reader *reader, const char *const filename) {
+    uint8_t header[MOVIE_HEADER_BYTES];
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fp = fopen(filename, "rb");
+    if (reader->fp == NULL) {
+        return false;
+    }
+
+    if (fread(header, 1, sizeof(header), reader->fp) != sizeof(header) ||
+            memcmp(header, MOVIE_MAGIC, 4) != 0 ||
+            (header[6] | header[7] << 8) != SCREEN_WIDTH_PX ||
+            (header[8] | header[9] << 8) != SCREEN_HEIGHT_PX) {
+        movie_reader_close(reader);
+        return false;
+    }
+    reader->keyframe_interval = get_u32(&header[12]);
+    if (reader->keyframe_interval == 0) {
+        movie_reader_close(reader);
+        return false;
+    }
+
+    if (!read_index(reader)) {
+        scan_index(reader);
+    }
+
+    return true;
+}
+
+bool movie_seek(struct movie_reader *reader, uint32_t frame, struct screen *screen) {
+    uint8_t bytes[MOVIE_FRAME_BYTES];
+    uint32_t keyframe = frame / reader->keyframe_interval;
+
+    if (frame >= reader->frame_count || keyframe >= reader->keyframe_count) {
+        return false;
+    }
+
+    bool continue_from_current = reader->position > 0 &&
+        reader->position - 1 <= frame &&
+        (reader->position - 1) / reader->keyframe_interval == keyframe;
+    if (!continue_from_current) {
+        fseek(reader->fp, reader->keyframes[keyframe], SEEK_SET);
+        reader->position = keyframe * reader->keyframe_interval;
+    }
+
+    while (reader->position <= frame) {
+        int type = fgetc(reader->fp);
+        if ((type != KEYFRAME && type != DELTA_FRAME) ||
+                !rle_decode(reader->fp, bytes, sizeof(bytes))) {
+            reader->position = 0;
+            return false;
+        }
+        if (type == KEYFRAME) {
+            memset(reader->current, 0, sizeof(reader->current));
+        }
+        xor_bytes_into_rows(reader->current, bytes);
+        ++reader->position;
+    }
+
+    unpack_screen(screen, reader->current);
+    return true;
+}
+
+void movie_reader_close(struct movie_reader *reader) {
+    if (reader->fp) {
+        fclose(reader->fp);
+        reader->fp = NULL;
+    }
+    free(reader->keyframes);
+    reader->keyframes = NULL;
+}
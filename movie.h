@@ -0,0 +1,68 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "screen.h"
+
+#define MOVIE_DEFAULT_KEYFRAME_INTERVAL 120
+
+/*
+ * Movie file layout (all integers little-endian):
+ *
+ *   header   "C8MV", u16 version, u16 width, u16 height,
+ *            u16 reserved, u32 keyframe interval
+ *   frames   one record per frame: a type byte ('K' keyframe, 'D' delta)
+ *            followed by the RLE-encoded 256 byte packed framebuffer.
+ *            Keyframes store the frame itself, deltas the XOR against
+ *            the previous frame.
+ *   index    u32 file offset of every keyframe
+ *   trailer  "C8MI", u32 index offset, u32 keyframe count, u32 frame count
+ *
+ * Frame records are self-delimiting, so a movie whose writer died before
+ * writing the index can still be read; the reader rebuilds the index by
+ * scanning the frames.
+ */
+
+#define MOVIE_FRAME_BYTES (SCREEN_HEIGHT_PX * sizeof(uint64_t))
+
+struct movie_writer {
+    FILE *fp;
+    uint32_t keyframe_interval;
+    uint32_t frame_count;
+    uint64_t previous[SCREEN_HEIGHT_PX];
+    uint32_t *keyframes;
+    uint32_t keyframe_count;
+    uint32_t keyframe_capacity;
+};
+
+struct movie_reader {
+    FILE *fp;
+    uint32_t keyframe_interval;
+    uint32_t frame_count;
+    uint32_t *keyframes;
+    uint32_t keyframe_count;
+    uint32_t position;
+    uint64_t current[SCREEN_HEIGHT_PX];
+};
+
+bool movie_writer_open(struct movie_writer *writer, const char *const filename,
+        uint32_t keyframe_interval);
+
+void movie_write_frame(struct movie_writer *writer, const struct screen * const screen);
+
+void movie_writer_close(struct movie_writer *writer);
+
+bool movie_reader_open(struct movie_reader *reader, const char *const filename);
+
+/*
+ * Decodes frame number `frame` into `screen`. Seeks to the closest
+ * preceding keyframe unless the reader is already positioned between
+ * that keyframe and the requested frame.
+ */
+bool movie_seek(struct movie_reader *reader, uint32_t frame, struct screen *screen);
+
+void movie_reader_close(struct movie_reader *reader);
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+#include "native.h"
+#include "instructions.h"
+
+bool native_load(struct native_program *program, const char *const path) {
+    memset(program, 0, sizeof(*program));
+    program->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (program->handle == NULL) {
+        printf("Cannot load %s: %s\n", path, dlerror());
+        return false;
+    }
+
+    const struct native_header *header = dlsym(program->handle, NATIVE_SYMBOL);
+    if (header == NULL || header->abi_version != NATIVE_ABI_VERSION ||
+            header->vm_size != sizeof(struct chip8)) {
+        printf("%s was not built for this emulator.\n", path);
+        native_unload(program);
+        return false;
+    }
+    program->header = header;
+    for (uint32_t i = 0; i < header->block_count; ++i) {
+        program->by_address[header->blocks[i].start] = &header->blocks[i];
+    }
+
+    return true;
+}
+
+void native_unload(struct native_program *program) {
+    if (program->handle) {
+        dlclose(program->handle);
+    }
+    memset(program, 0, sizeof(*program));
+}
+
+bool native_attach(struct chip8 *vm, const struct native_program *program) {
+    if (program->header == NULL || program->header->rom_hash != vm->rom_hash ||
+            program->header->profile != (int) vm->profile) {
+        return false;
+    }
+    vm->native = program;
+    return true;
+}
+
+/*
+ * A block's code is current unless one of its pages has been copied,
+ * in which case the bytes are compared against the ROM image.
+ */
+static bool code_intact(const struct chip8 *vm, const struct native_block *block) {
+    if (!(vm->owned_pages & block->pages)) {
+        return true;
+    }
+    for (uint16_t address = block->start; address < block->end; ++address) {
+        if (vm_read(vm, address) != vm->image->ram[address]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int native_run_cycles(const struct native_program *program, struct chip8 *vm, int cycles) {
+    int executed = 0;
+
+    while (executed < cycles && !vm->error && !vm->awaiting_input) {
+        const struct native_block *block = program->by_address[vm->pc % RAM_SIZE];
+
+        if (block && executed + block->length <= cycles && code_intact(vm, block)) {
+            int before = executed;
+            executed = block->run(vm, executed, cycles);
+            if (vm->pc < PROG_MEM_START || vm->pc >= vm->prog_mem_end) {
+                vm->error = ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS;
+            }
+            // As the interpreter counts them: the failing one isn't.
+            vm->instructions += executed - before - (vm->error != 0);
+        } else {
+            executed += run_interpreted_cycles(vm, 1);
+        }
+    }
+
+    return executed;
+}
@@ -0,0 +1,71 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "machine.h"
+
+#define NATIVE_ABI_VERSION 1
+#define NATIVE_SYMBOL "chip8_native"
+
+/*
+ * Interface between the emulator and a ROM translated to C by the
+ * recompile tool and built as a shared object.
+ *
+ * Each block function runs its instructions, leaves vm->pc at the
+ * successor and returns `executed` plus the instructions it ran. When
+ * the successor is another block that fits in `limit` and whose code
+ * pages are untouched it tail-calls it directly, so a frame of a hot
+ * loop runs without returning to the dispatcher. Fx33 and Fx55 end a
+ * block, as does an instruction that sets vm->error or waits for a key.
+ */
+struct native_block {
+    uint16_t start;
+    uint16_t end;
+    uint16_t length;
+    uint16_t pages;
+    int (*run)(struct chip8 *vm, int executed, int limit);
+};
+
+/*
+ * Exported by the shared object as NATIVE_SYMBOL.
+ */
+struct native_header {
+    uint32_t abi_version;
+    uint32_t vm_size;
+    uint64_t rom_hash;
+    int profile;
+    uint32_t block_count;
+    const struct native_block *blocks;
+};
+
+struct native_program {
+    void *handle;
+    const struct native_header *header;
+    const struct native_block *by_address[RAM_SIZE];
+};
+
+/*
+ * Loads a translated ROM. Fails if the object was built against a
+ * different struct chip8 layout.
+ */
+bool native_load(struct native_program *program, const char *const path);
+
+void native_unload(struct native_program *program);
+
+/*
+ * Makes run_cycles() use the program for this VM. The VM must be running
+ * the ROM and quirk profile the program was translated from. The
+ * program must outlive the VM and any VMs forked from it.
+ */
+bool native_attach(struct chip8 *vm, const struct native_program *program);
+
+/*
+ * run_cycles() with translated blocks. Falls back to the interpreter at
+ * addresses that are not the start of a block (Bnnn and RET targets not
+ * found statically, invalid instructions), for blocks whose bytes no
+ * longer match the ROM, and for the tail of the cycle budget.
+ */
+int native_run_cycles(const struct native_program *program, struct chip8 *vm, int cycles);
+
+#endif
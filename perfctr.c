@@ -0,0 +1,138 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+static const char *counter_names[PERF_COUNTER_COUNT] = {
+    "cycles", "instructions", "branches", "branch-misses", "L1d-misses"
+};
+
+const char *perf_counter_name(enum perf_counter counter) {
+    return counter_names[counter];
+}
+
+#ifdef __linux__
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} counter_events[PERF_COUNTER_COUNT] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+        PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+};
+
+static int open_event(int counter, int group) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_events[counter].type;
+    attr.config = counter_events[counter].config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+bool perf_counters_open(struct perf_counters *counters) {
+    int leader = -1;
+
+    counters->open_count = 0;
+    counters->error = 0;
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        counters->fds[i] = open_event(i, leader);
+        counters->slots[i] = -1;
+        if (counters->fds[i] < 0) {
+            if (!counters->error) {
+                counters->error = errno;
+            }
+            continue;
+        }
+        if (leader < 0) {
+            leader = counters->fds[i];
+        }
+        counters->slots[i] = counters->open_count++;
+    }
+    if (leader < 0) {
+        return false;
+    }
+
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+#else
+
+// perf_event_open(2) is Linux only; elsewhere no counter opens.
+bool perf_counters_open(struct perf_counters *counters) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        counters->fds[i] = -1;
+        counters->slots[i] = -1;
+    }
+    counters->open_count = 0;
+    counters->error = ENOSYS;
+    return false;
+}
+
+#endif
+
+void perf_counters_close(struct perf_counters *counters) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if (counters->fds[i] >= 0) {
+            close(counters->fds[i]);
+            counters->fds[i] = -1;
+        }
+    }
+    counters->open_count = 0;
+}
+
+void perf_counters_read(const struct perf_counters *counters, struct perf_sample *sample) {
+    uint64_t group[1 + PERF_COUNTER_COUNT];
+    int leader = -1;
+
+    memset(sample, 0, sizeof(*sample));
+    for (int i = 0; i < PERF_COUNTER_COUNT && leader < 0; ++i) {
+        if (counters->slots[i] >= 0) {
+            leader = counters->fds[i];
+        }
+    }
+    if (leader < 0 || read(leader, group, sizeof(group)) < (ssize_t) sizeof(uint64_t)) {
+        return;
+    }
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        int slot = counters->slots[i];
+        if (slot >= 0 && (uint64_t) slot < group[0]) {
+            sample->values[i] = group[1 + slot];
+            sample->valid[i] = true;
+        }
+    }
+}
+
+void perf_sample_delta(const struct perf_sample *before, const struct perf_sample *after,
+        struct perf_sample *delta) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        delta->valid[i] = before->valid[i] && after->valid[i];
+        delta->values[i] = delta->valid[i] ? after->values[i] - before->values[i] : 0;
+    }
+}
+
+double perf_ratio(const struct perf_sample *sample, enum perf_counter numerator,
+        enum perf_counter denominator) {
+    if (!sample->valid[numerator] || !sample->valid[denominator] ||
+            sample->values[denominator] == 0) {
+        return -1;
+    }
+    return (double) sample->values[numerator] / sample->values[denominator];
+}
@@ -0,0 +1,62 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Hardware performance counters for the calling thread (user mode
+ * only), read through perf_event_open(2) as one group so all of them
+ * cover the same instructions. Counters the CPU or kernel doesn't
+ * offer are left out; without a PMU (e.g. in most VMs), or off Linux,
+ * none open and every sample is invalid.
+ */
+
+enum perf_counter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCHES,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+struct perf_counters {
+    int fds[PERF_COUNTER_COUNT];
+    // Position of each open counter in a group read, or -1.
+    int slots[PERF_COUNTER_COUNT];
+    int open_count;
+    int error;          // errno of the first counter that failed to open
+};
+
+struct perf_sample {
+    uint64_t values[PERF_COUNTER_COUNT];
+    bool valid[PERF_COUNTER_COUNT];
+};
+
+const char *perf_counter_name(enum perf_counter counter);
+
+/*
+ * Returns false if no counter could be opened.
+ */
+bool perf_counters_open(struct perf_counters *counters);
+
+void perf_counters_close(struct perf_counters *counters);
+
+/*
+ * Current counts. Counters keep running; subtract two reads with
+ * perf_sample_delta().
+ */
+void perf_counters_read(const struct perf_counters *counters, struct perf_sample *sample);
+
+void perf_sample_delta(const struct perf_sample *before, const struct perf_sample *after,
+        struct perf_sample *delta);
+
+/*
+ * numerator / denominator, or a negative number when either counter
+ * is missing or the denominator is 0.
+ */
+double perf_ratio(const struct perf_sample *sample, enum perf_counter numerator,
+        enum perf_counter denominator);
+
+#endif
@@ -0,0 +1,170 @@
+#include <string.h>
+#include "phosphor.h"
+#include "telemetry.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PHOSPHOR_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define PHOSPHOR_HAVE_AVX2 0
+#endif
+
+void phosphor_init(struct phosphor *phosphor, uint8_t persistence) {
+    memset(phosphor, 0, sizeof(*phosphor));
+    phosphor->persistence = persistence;
+#if PHOSPHOR_HAVE_AVX2
+    phosphor->use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    for (int i = 0; i < 256; ++i) {
+        phosphor->palette[i] = 0xFF000000u | i << 16 | i << 8 | i;
+    }
+}
+
+/*
+ * Updates one row and returns whether it is still fading.
+ */
+static bool update_scalar(struct phosphor *phosphor, const struct screen *screen, int y) {
+    uint8_t *intensity = phosphor->intensity[y];
+    uint8_t fading = 0;
+
+    for (int x = 0; x < SCREEN_WIDTH_PX; ++x) {
+        if (screen->rows[y] >> (SCREEN_WIDTH_PX - 1 - x) & 1) {
+            intensity[x] = 0xFF;
+        } else {
+            intensity[x] = intensity[x] * phosphor->persistence >> 8;
+            fading |= intensity[x];
+        }
+    }
+    return fading;
+}
+
+#if PHOSPHOR_HAVE_AVX2
+
+#define AVX2 __attribute__((target("avx2")))
+
+/*
+ * Expands 32 pixel bits, leftmost in bit 31, to 0xFF/0x00 bytes.
+ */
+static AVX2 __m256i expand_bits(uint32_t bits) {
+    const __m256i bytes = _mm256_setr_epi8(
+            3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+            1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i select = _mm256_set1_epi64x(0x0102040810204080);
+    __m256i spread = _mm256_shuffle_epi8(_mm256_set1_epi32(bits), bytes);
+
+    return _mm256_cmpeq_epi8(_mm256_and_si256(spread, select), select);
+}
+
+static AVX2 bool update_avx2(struct phosphor *phosphor, const struct screen *screen, int y) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i persistence = _mm256_set1_epi16(phosphor->persistence);
+    __m256i fading = zero;
+
+    for (int half = 0; half < 2; ++half) {
+        __m256i *intensity = (__m256i *) &phosphor->intensity[y][half * 32];
+        __m256i lit = expand_bits(screen->rows[y] >> (32 - half * 32));
+        __m256i value = _mm256_loadu_si256(intensity);
+        __m256i low = _mm256_mullo_epi16(_mm256_unpacklo_epi8(value, zero), persistence);
+        __m256i high = _mm256_mullo_epi16(_mm256_unpackhi_epi8(value, zero), persistence);
+        __m256i decayed = _mm256_packus_epi16(_mm256_srli_epi16(low, 8),
+                _mm256_srli_epi16(high, 8));
+
+        fading = _mm256_or_si256(fading, _mm256_andnot_si256(lit, decayed));
+        _mm256_storeu_si256(intensity, _mm256_or_si256(decayed, lit));
+    }
+    return !_mm256_testz_si256(fading, fading);
+}
+
+static AVX2 void fill_avx2(uint32_t *out, uint32_t color, int count) {
+    __m256i value = _mm256_set1_epi32(color);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i *) (out + i), value);
+    }
+    if (i < count && count >= 8) {
+        // Overlap the last full store rather than finishing one by one.
+        _mm256_storeu_si256((__m256i *) (out + count - 8), value);
+    } else {
+        for (; i < count; ++i) {
+            out[i] = color;
+        }
+    }
+}
+
+#endif
+
+uint32_t phosphor_update(struct phosphor *phosphor, const struct screen *screen, uint32_t rows) {
+    uint32_t updated = rows | phosphor->fading_rows;
+
+    for (uint32_t left = updated; left; left &= left - 1) {
+        int y = __builtin_ctz(left);
+#if PHOSPHOR_HAVE_AVX2
+        bool fading = phosphor->use_avx2 ? update_avx2(phosphor, screen, y) :
+            update_scalar(phosphor, screen, y);
+#else
+        bool fading = update_scalar(phosphor, screen, y);
+#endif
+        if (fading) {
+            phosphor->fading_rows |= 1u << y;
+        } else {
+            phosphor->fading_rows &= ~(1u << y);
+        }
+    }
+    return updated;
+}
+
+static void fill_scalar(uint32_t *out, uint32_t color, int count) {
+    for (int i = 0; i < count; ++i) {
+        out[i] = color;
+    }
+}
+
+/*
+ * Builds the first row of each pixel row's block, then copies it down.
+ */
+void phosphor_upscale(const struct phosphor *phosphor, uint32_t *pixels, int pitch, int scale,
+        uint32_t rows) {
+    size_t row_bytes = (size_t) SCREEN_WIDTH_PX * scale * sizeof(uint32_t);
+
+    if (rows == 0) {
+        return;
+    }
+    int first = __builtin_ctz(rows);
+    int last = 31 - __builtin_clz(rows);
+    for (int y = first; y <= last; ++y) {
+        uint8_t *block = (uint8_t *) pixels + (size_t) (y - first) * scale * pitch;
+        uint32_t *row = (uint32_t *) block;
+
+        for (int x = 0; x < SCREEN_WIDTH_PX; ++x) {
+            uint32_t color = phosphor->palette[phosphor->intensity[y][x]];
+#if PHOSPHOR_HAVE_AVX2
+            if (phosphor->use_avx2) {
+                fill_avx2(row + x * scale, color, scale);
+                continue;
+            }
+#endif
+            fill_scalar(row + x * scale, color, scale);
+        }
+        for (int copy = 1; copy < scale; ++copy) {
+            memcpy(block + (size_t) copy * pitch, row, row_bytes);
+        }
+    }
+}
+
+void phosphor_render(struct phosphor *phosphor, const struct screen *screen, uint32_t rows,
+        uint32_t *pixels, int pitch, int scale) {
+    uint64_t start = telemetry_now();
+
+    phosphor_upscale(phosphor, pixels, pitch, scale, phosphor_update(phosphor, screen, rows));
+
+    uint64_t ns = telemetry_now() - start;
+    ++phosphor->frames;
+    phosphor->total_ns += ns;
+    if (ns > phosphor->max_ns) {
+        phosphor->max_ns = ns;
+    }
+    if (ns > PHOSPHOR_BUDGET_NS) {
+        ++phosphor->over_budget;
+    }
+}
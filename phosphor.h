@@ -0,0 +1,65 @@
+#ifndef PHOSPHOR_H
+#define PHOSPHOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "screen.h"
+
+// Share of a pixel's intensity kept each frame, out of 256: an unlit
+// pixel fades out over about six frames.
+#define PHOSPHOR_DEFAULT_PERSISTENCE 160
+#define PHOSPHOR_BUDGET_NS 1000000
+
+/*
+ * Phosphor persistence for the display. Each presented frame, lit
+ * pixels go to full intensity and unlit ones keep `persistence`/256 of
+ * theirs, so a sprite that is erased and redrawn between frames dims
+ * briefly instead of flickering. The intensities are then scaled up
+ * into an ARGB8888 image for a streaming texture.
+ *
+ * Only rows the caller says changed, and rows still fading, are
+ * touched: the rest of the image is already up to date.
+ *
+ * Both passes use AVX2 where the CPU has it. The time they take is
+ * kept per frame and checked against PHOSPHOR_BUDGET_NS.
+ */
+struct phosphor {
+    uint8_t intensity[SCREEN_HEIGHT_PX][SCREEN_WIDTH_PX];
+    uint8_t persistence;
+    bool use_avx2;
+    uint32_t fading_rows;   // rows where some unlit pixel is still visible
+    uint32_t palette[256];
+
+    uint64_t frames;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t over_budget;
+};
+
+void phosphor_init(struct phosphor *phosphor, uint8_t persistence);
+
+/*
+ * Lights the screen's pixels and decays the rest by one frame, in
+ * `rows` (one bit per pixel row) and the fading rows. Returns the rows
+ * it updated, rows | the old phosphor->fading_rows.
+ */
+uint32_t phosphor_update(struct phosphor *phosphor, const struct screen *screen, uint32_t rows);
+
+/*
+ * Writes pixel rows from the lowest to the highest of `rows`, `scale`
+ * times the screen size in each direction, to `pixels`, `pitch` bytes
+ * per row. `pixels` is the top of the lowest row, as in a texture
+ * locked over just those rows.
+ */
+void phosphor_upscale(const struct phosphor *phosphor, uint32_t *pixels, int pitch, int scale,
+        uint32_t rows);
+
+/*
+ * phosphor_update() and phosphor_upscale() of `rows`, timed. Include
+ * phosphor->fading_rows in `rows` so the image covers every row the
+ * update touches.
+ */
+void phosphor_render(struct phosphor *phosphor, const struct screen *screen, uint32_t rows,
+        uint32_t *pixels, int pitch, int scale);
+
+#endif
@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "movie.h"
+#include "screen.h"
+
+void print_frame(const struct screen * const screen, uint32_t frame) {
+    char line[SCREEN_WIDTH_PX + 2];
+
+    printf("frame %u\n", frame);
+    for (int y = 0; y < SCREEN_HEIGHT_PX; ++y) {
+        for (int x = 0; x < SCREEN_WIDTH_PX; ++x) {
+            line[x] = get_pixel(screen, x, y) ? '#' : '.';
+        }
+        line[SCREEN_WIDTH_PX] = '\n';
+        line[SCREEN_WIDTH_PX + 1] = '\0';
+        fputs(line, stdout);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: player <movie> [first frame [last frame]]\n");
+        exit(0);
+    }
+
+    struct movie_reader reader;
+    if (!movie_reader_open(&reader, argv[1])) {
+        printf("Cannot open movie %s.\n", argv[1]);
+        exit(1);
+    }
+
+    if (argc < 3) {
+        printf("%u frames, %u keyframes, keyframe interval %u\n",
+                reader.frame_count, reader.keyframe_count, reader.keyframe_interval);
+        movie_reader_close(&reader);
+        return 0;
+    }
+
+    uint32_t first = strtoul(argv[2], NULL, 0);
+    uint32_t last = argc > 3 ? strtoul(argv[3], NULL, 0) : first;
+    struct screen screen;
+
+    for (uint32_t frame = first; frame <= last; ++frame) {
+        if (!movie_seek(&reader, frame, &screen)) {
+            printf("Cannot decode frame %u.\n", frame);
+            movie_reader_close(&reader);
+            exit(1);
+        }
+        print_frame(&screen, frame);
+    }
+
+    movie_reader_close(&reader);
+}
@@ -1,176 +1,380 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cfg.h"
+#include "corpus.h"
+#include "disasm.h"
 #include "instructions.h"
 #include "machine.h"
+#include "trace.h"
 
-#define print_unknown() puts("unknown instruction or byte of data");
+/*
+ * Disassembler. By default every word of each file is decoded in order;
+ * files are mapped and formatted on -j threads, and -J writes JSON
+ * lines (file, address, opcode, mnemonic, operands) instead of text.
+ * Corpus archives are listed ROM by ROM.
+ *
+ * With -c the control flow is recovered first (see cfg.h) and the
+ * output is the basic blocks, subroutines, data regions and store
+ * targets. -p additionally runs the ROM headless for the given number
+ * of frames with changing keypad input and shows each block's share of
+ * the executed instructions.
+ *
+ * -t decodes an execution trace written by 'chip8 -t': one line per
+ * cycle with the instruction and the register it wrote.
+ */
 
-void print_mem_instr(char *name, uint16_t instr) {
-    printf("%s %x\n", name, MEM_ADDR(instr));
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+struct bulk_job {
+    char **files;
+    size_t count;
+    size_t next;
+    bool json;
+    bool headers;
+    pthread_mutex_t output_lock;
+};
+
+struct output {
+    struct bulk_job *job;
+    char *buffer;
+    char *end;
+    bool locked;        // holds output_lock until the file is done
+};
+
+/*
+ * Writes out the buffer. A flush before the end of a file keeps the
+ * output lock until the file's last flush, so other threads' listings
+ * can't land in the middle of it.
+ */
+static void flush_output(struct output *out, bool file_done) {
+    if (!out->locked) {
+        pthread_mutex_lock(&out->job->output_lock);
+        out->locked = true;
+    }
+    fwrite(out->buffer, 1, out->end - out->buffer, stdout);
+    if (file_done) {
+        pthread_mutex_unlock(&out->job->output_lock);
+        out->locked = false;
+    }
+    out->end = out->buffer;
 }
 
-void print_mem_reg_instr(char *name, char *reg_name, uint16_t instr) {
-    printf("%s %s, %x\n", name, reg_name, MEM_ADDR(instr));
+/*
+ * Formats every word of the image into the output buffer, flushing only
+ * when it runs low, so a ROM's listing normally goes out in one write.
+ */
+void disassemble_image(struct output *out, const char *name, const uint8_t *data, size_t size) {
+    char *name_json = malloc(6 * strlen(name) + 1);
+    size_t line_max = DISASM_LINE_MAX + (json_escape(name_json, name) - name_json);
+
+    if (out->job->headers && !out->job->json) {
+        if (out->end + line_max > out->buffer + OUTPUT_BUFFER_SIZE) {
+            flush_output(out, false);
+        }
+        out->end += sprintf(out->end, "%s:\n", name);
+    }
+    for (size_t offset = 0; offset + 1 < size; offset += 2) {
+        uint16_t instruction = data[offset] << 8 | data[offset + 1];
+        uint16_t address = PROG_MEM_START + offset;
+
+        if (out->end + line_max > out->buffer + OUTPUT_BUFFER_SIZE) {
+            flush_output(out, false);
+        }
+        if (out->job->json) {
+            out->end = format_instruction_json(out->end, name_json, instruction, address);
+        } else {
+            out->end = format_instruction(out->end, instruction, address);
+        }
+    }
+    free(name_json);
 }
 
-void print_single_reg_instr(char *name, uint16_t instr) {
-    printf("%s V%x\n", name, REG_1(instr));
+/*
+ * Maps a ROM, or a corpus archive whose ROMs are listed as
+ * "archive:name", and disassembles it.
+ */
+void disassemble_file(struct output *out, const char *path) {
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Cannot open file %s.\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    const uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Cannot map file %s.\n", path);
+        return;
+    }
+
+    struct corpus corpus;
+    if (st.st_size >= 4 && memcmp(data, "C8CA", 4) == 0 && corpus_open(&corpus, path)) {
+        struct corpus_rom rom;
+        char *name = malloc(strlen(path) + CORPUS_NAME_LEN + 2);
+        for (uint32_t i = 0; corpus_get(&corpus, i, &rom); ++i) {
+            sprintf(name, "%s:%s", path, rom.name);
+            disassemble_image(out, name, rom.data, rom.size);
+        }
+        free(name);
+        corpus_close(&corpus);
+    } else {
+        disassemble_image(out, path, data, st.st_size);
+    }
+    munmap((void *) data, st.st_size);
+    flush_output(out, true);
 }
 
-void print_single_reg_instr_with_operand(char *name, uint16_t instr) {
-    uint16_t reg = REG_1(instr);
-    uint16_t operand = LOW_BYTE(instr);
-    printf("%s V%x, %x\n", name, reg, operand);
+void *bulk_worker(void *arg) {
+    struct bulk_job *job = arg;
+    struct output out = { job, malloc(OUTPUT_BUFFER_SIZE), NULL, false };
+
+    out.end = out.buffer;
+    for (;;) {
+        size_t index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (index >= job->count) {
+            break;
+        }
+        disassemble_file(&out, job->files[index]);
+    }
+    free(out.buffer);
+
+    return NULL;
 }
 
-void print_two_reg_instr(char *name, uint16_t instr) {
-    printf("%s V%x, V%x\n", name, REG_1(instr), REG_2(instr));
+/*
+ * Disassembles the files on `threads` threads. Each file's listing is
+ * written in one piece, but files finish in any order once there is
+ * more than one thread; JSON lines carry the file name for that reason.
+ */
+void disassemble_files(char **files, size_t count, int threads, bool json) {
+    struct bulk_job job = { .files = files, .count = count, .json = json, .headers = count > 1 };
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+
+    pthread_mutex_init(&job.output_lock, NULL);
+    for (int i = 1; i < threads; ++i) {
+        pthread_create(&workers[i], NULL, bulk_worker, &job);
+    }
+    bulk_worker(&job);
+    for (int i = 1; i < threads; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&job.output_lock);
+    free(workers);
 }
 
-void print_two_reg_instr_with_operand(char *name, uint16_t instr) {
-    uint16_t reg1 = REG_1(instr);
-    uint16_t reg2 = REG_2(instr);
-    uint16_t op = LOW_NIBBLE(instr);
-    printf("%s V%x, V%x, %x\n", name, reg1, reg2, op);
+static const char *exit_names[] = {
+    "next", "skip", "jump", "call", "return", "computed", "wait", "store", "invalid"
+};
+
+void profile_rom(struct chip8 *vm, uint32_t frames, uint32_t *hits) {
+    uint64_t keys = 1;
+
+    for (uint32_t frame = 0; frame < frames && !vm->error; ++frame) {
+        vm_set_keypad(vm, scripted_keypad(&keys, frame));
+        for (int i = 0; i < vm->cycles_per_frame && !vm->error && !vm->awaiting_input; ++i) {
+            ++hits[vm->pc % RAM_SIZE];
+            vm_step(vm);
+        }
+        vm_end_frame(vm);
+    }
 }
 
-void print_two_reg_op(uint16_t instr) {
-    static char *op_names[] = {
-        "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN", "SHL"
-    };
-    uint16_t optype = LOW_NIBBLE(instr);
-    print_two_reg_instr(op_names[optype], instr);
+void print_block(const struct cfg_block *block, const uint32_t *hits, uint64_t total) {
+    printf("block %04x-%04x %3d %-8s", block->start, block->end, block->length,
+            exit_names[block->exit]);
+    for (int i = 0; i < block->successor_count; ++i) {
+        printf(" %s%04x", i ? "" : "-> ", block->successors[i]);
+    }
+    if (block->exit == CFG_CALL) {
+        printf(" call %04x", block->callee);
+    }
+    if (block->store_address == CFG_UNKNOWN_STORE) {
+        printf(" store ?");
+    } else if (block->store_address >= 0) {
+        printf(" store %04x+%d", block->store_address, block->store_length);
+    }
+    if (block->written) {
+        printf(" written");
+    }
+    if (total) {
+        uint64_t executed = 0;
+        for (uint16_t address = block->start; address < block->end; address += 2) {
+            executed += hits[address];
+        }
+        printf("  %5.1f%%", 100.0 * executed / total);
+    }
+    printf("\n");
 }
 
-void print_f_instr(uint16_t instr) {
-    uint16_t reg = REG_1(instr);
-    switch (LOW_BYTE(instr)) {
-        case 7:
-            printf("LD V%x, DT\n", reg);
-            break;
-        case 0xA:
-            printf("LD V%x, K\n", reg);
-            break;
-        case 0x15:
-            printf("LD V%x, DT\n", reg);
-            break;
-        case 0x18:
-            printf("LD ST, V%x\n", reg);
-            break;
-        case 0x1E:
-            printf("ADD I, V%x\n", reg);
-            break;
-        case 0x29:
-            printf("LD F, V%x\n", reg);
-            break;
-        case 0x33:
-            printf("LD B, V%x\n", reg);
-            break;
-        case 0x55:
-            printf("LD [I], V%x\n", reg);
-            break;
-        case 0x65:
-            printf("LD V%x, [I]\n", reg);
-            break;
-        default:
-            print_unknown();
-            break;
+void print_cfg(const struct chip8 *vm, const uint32_t *hits, uint64_t total) {
+    struct cfg cfg;
+    uint32_t data_bytes = 0;
+
+    cfg_build(&cfg, vm->image->ram, PROG_MEM_START, PROG_MEM_START, vm->prog_mem_end);
+
+    for (size_t i = 0; i < cfg.block_count; ++i) {
+        print_block(&cfg.blocks[i], hits, total);
+    }
+    for (size_t i = 0; i < cfg.function_count; ++i) {
+        const struct cfg_function *function = &cfg.functions[i];
+        printf("sub %04x %zu blocks", function->entry, function->block_count);
+        for (size_t j = 0; j < function->callee_count; ++j) {
+            printf(" %s%04x", j ? "" : "calls ", function->callees[j]);
+        }
+        printf("\n");
     }
+    for (uint16_t address = PROG_MEM_START; address < vm->prog_mem_end; ) {
+        if (cfg.flags[address] & CFG_CODE) {
+            ++address;
+            continue;
+        }
+        uint16_t start = address;
+        while (address < vm->prog_mem_end && !(cfg.flags[address] & CFG_CODE)) {
+            ++address;
+        }
+        printf("data %04x-%04x %d bytes%s\n", start, address, address - start,
+                cfg.flags[start] & CFG_WRITTEN ? " written" : "");
+        data_bytes += address - start;
+    }
+
+    printf("%zu blocks, %zu subroutines, %u data bytes, %zu stores to unknown addresses%s\n",
+            cfg.block_count, cfg.function_count, data_bytes, cfg.unknown_stores,
+            cfg.computed_jumps ? ", computed jumps" : "");
+    cfg_free(&cfg);
 }
 
-void print_instruction(uint16_t instr, uint16_t addr) {
-    uint16_t instruction_type = HIGH_NIBBLE(instr);
-    printf("(%04x) %04x: ", addr, instr);
-
-    switch (instruction_type) {
-        case 0:
-            if (instr == CLS) {
-                puts("CLS");
-            } else if (instr == RET) {
-                puts("RET");
-            } else {
-                print_mem_instr("SYS", instr);
-            }
-            break;
-        case 1:
-            print_mem_instr("JP", instr);
-            break;
-        case 2:
-            print_mem_instr("CALL", instr);
-            break;
-        case 3:
-            print_single_reg_instr_with_operand("SE", instr);
-            break;
-        case 4:
-            print_single_reg_instr_with_operand("SNE", instr);
-            break;
-        case 5:
-            print_two_reg_instr("SE", instr);
-            break;
-        case 6:
-            print_single_reg_instr_with_operand("LD", instr);
-            break;
-        case 7:
-            print_single_reg_instr_with_operand("ADD", instr);
-            break;
-        case 8:
-            print_two_reg_op(instr);
-            break;
-        case 9:
-            print_two_reg_instr("SNE", instr);
-            break;
-        case 0xA:
-            print_mem_reg_instr("LD", "I", instr);
-            break;
-        case 0xB:
-            print_mem_reg_instr("JP", "V0", instr);
-            break;
-        case 0xC:
-            print_single_reg_instr_with_operand("RND", instr);
-            break;
-        case 0xD:
-            print_two_reg_instr_with_operand("DRW", instr);
-            break;
-        case 0xE:
-            switch (LOW_BYTE(instr)) {
-                case 0x9E:
-                    print_single_reg_instr("SKP", instr);
-                    break;
-                case 0xA1:
-                    print_single_reg_instr("SKNP", instr);
-                    break;
-                default:
-                    print_unknown();
-                    break;
-            }
-            break;
-        case 0xF:
-            print_f_instr(instr);
-            break;
-        default:
-            print_unknown();
+static const char *trace_register_names[] = { "I", "DT", "ST" };
+
+void print_trace(const char *path) {
+    struct trace_reader reader;
+    struct trace_record record;
+    char *buffer = malloc(OUTPUT_BUFFER_SIZE);
+    char *end = buffer;
+
+    if (!trace_reader_open(&reader, path)) {
+        fprintf(stderr, "%s: not a trace file\n", path);
+        exit(1);
+    }
+    while (trace_read(&reader, &record)) {
+        if (end - buffer > OUTPUT_BUFFER_SIZE - 2 * DISASM_LINE_MAX) {
+            fwrite(buffer, 1, end - buffer, stdout);
+            end = buffer;
+        }
+        end += sprintf(end, "%10" PRIu64 " ", reader.cycle);
+        end = format_instruction(end, record.opcode, record.pc) - 1;
+        if (record.reg < 16) {
+            end += sprintf(end, "  ; V%X=%02x", record.reg, record.value);
+        } else if (record.reg != TRACE_NONE) {
+            end += sprintf(end, "  ; %s=%04x", trace_register_names[record.reg - TRACE_I],
+                    record.value);
+        }
+        *end++ = '\n';
     }
+    fwrite(buffer, 1, end - buffer, stdout);
+    trace_reader_close(&reader);
+    free(buffer);
+}
+
+void print_usage(void) {
+    puts("Usage: reader [-j threads] [-J] <filename>...");
+    puts("       reader [-c] [-p frames] [-q profile] [-k cycles] <filename>");
+    puts("       reader -t <trace>");
 }
 
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Usage: reader <filename>\n");
+    bool graph = false;
+    uint32_t frames = 0;
+    enum quirk_profile profile = PROFILE_DEFAULT;
+    int cycles_per_frame = 0;
+    int threads = 1;
+    bool json = false;
+    bool trace = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "cp:q:k:j:Jt")) != -1) {
+        switch (opt) {
+            case 't':
+                trace = true;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'J':
+                json = true;
+                break;
+            case 'c':
+                graph = true;
+                break;
+            case 'p':
+                graph = true;
+                frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'q':
+                if (!parse_profile(optarg, &profile)) {
+                    printf("Unknown quirk profile %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'k':
+                cycles_per_frame = atoi(optarg);
+                break;
+            default:
+                print_usage();
+                exit(1);
+        }
+    }
+    if (optind >= argc) {
+        print_usage();
         exit(0);
     }
 
-    char *filename = argv[1];
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
-        printf("Cannot open file %s.\n", filename);
-        exit(1);
+    char *filename = argv[optind];
+    if (trace) {
+        print_trace(filename);
+        return 0;
     }
+    if (graph) {
+        struct chip8 vm;
+        uint32_t *hits = calloc(RAM_SIZE, sizeof(uint32_t));
+        uint64_t total = 0;
 
-    uint8_t instr[2];
+        vm_init_with_rom(&vm, filename);
+        vm.profile = profile;
+        if (cycles_per_frame > 0) {
+            vm.cycles_per_frame = cycles_per_frame;
+        }
+        vm_seed_random(&vm, 1);
+        profile_rom(&vm, frames, hits);
+        for (int i = 0; i < RAM_SIZE; ++i) {
+            total += hits[i];
+        }
+        print_cfg(&vm, hits, total);
+
+        free(hits);
+        vm_release(&vm);
+        return 0;
+    }
 
-    uint16_t addr = PROG_MEM_START;
-    while (fread(&instr, sizeof(uint8_t), 2, fp)) {
-        print_instruction((instr[0] << 8) | instr[1], addr);
-        addr += 2;
+    if (threads < 1) {
+        threads = 1;
     }
+    disassemble_files(&argv[optind], argc - optind, threads, json);
+    return 0;
 }
@@ -0,0 +1,427 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include "machine.h"
+#include "instructions.h"
+#include "cfg.h"
+#include "native.h"
+
+/*
+ * Static recompiler. 'recompile rom out.c' recovers the ROM's control
+ * flow and writes a C file with one function per basic block, using the
+ * interpreter's own handlers (the quirk-specialized ones from
+ * dispatch.h are inlined with the instruction as a constant). Build it
+ * against this source tree and load it with native_load():
+ *
+ *   cc -O2 -shared -fPIC -I path/to/chip8 out.c -o rom.so
+ *
+ * 'recompile -b rom.so rom' runs the ROM through the interpreter and
+ * the shared object side by side, checks that every frame ends in the
+ * same state, and times both.
+ *
+ * The translation is for one quirk profile (-q). Optimization matters:
+ * blocks chain into each other with tail calls.
+ */
+
+#define DEFAULT_BENCH_FRAMES 20000
+
+/*
+ * The quirk switches of each profile, as set in instructions.c.
+ */
+static const char *profile_quirks[PROFILE_COUNT] = {
+    "#define QUIRK_SHIFT_VY 0\n#define QUIRK_INCREMENT_I 0\n#define QUIRK_JUMP_VX 0\n"
+    "#define QUIRK_CLIP_SPRITES 0\n#define QUIRK_VF_RESET 0\n#define QUIRK_LEGACY_FLAGS 1\n",
+    "#define QUIRK_SHIFT_VY 1\n#define QUIRK_INCREMENT_I 1\n#define QUIRK_JUMP_VX 0\n"
+    "#define QUIRK_CLIP_SPRITES 1\n#define QUIRK_VF_RESET 1\n#define QUIRK_LEGACY_FLAGS 0\n",
+    "#define QUIRK_SHIFT_VY 0\n#define QUIRK_INCREMENT_I 0\n#define QUIRK_JUMP_VX 1\n"
+    "#define QUIRK_CLIP_SPRITES 1\n#define QUIRK_VF_RESET 0\n#define QUIRK_LEGACY_FLAGS 0\n",
+    "#define QUIRK_SHIFT_VY 1\n#define QUIRK_INCREMENT_I 1\n#define QUIRK_JUMP_VX 0\n"
+    "#define QUIRK_CLIP_SPRITES 0\n#define QUIRK_VF_RESET 0\n#define QUIRK_LEGACY_FLAGS 0\n"
+};
+
+static const char *arithmetic_names[16] = {
+    NULL, "or_vx_vy", "and_vx_vy", "xor_vx_vy", "add_vx_vy", "sub_vx_vy",
+    "shr_vx", "subn_vx_vy", NULL, NULL, NULL, NULL, NULL, NULL, "shl_vx", NULL
+};
+
+struct translation {
+    FILE *out;
+    const struct cfg *cfg;
+    const uint8_t *ram;
+    const char *profile;
+};
+
+static uint16_t fetch(const uint8_t *ram, uint16_t address) {
+    return ram[address] << 8 | ram[address + 1];
+}
+
+static uint16_t block_pages(const struct cfg_block *block) {
+    uint16_t pages = 0;
+    for (int page = block->start / RAM_PAGE_SIZE; page <= (block->end - 1) / RAM_PAGE_SIZE; ++page) {
+        pages |= 1 << page;
+    }
+    return pages;
+}
+
+static void emit_error_check(struct translation *t, uint16_t next, int executed) {
+    fprintf(t->out, "    if (vm->error) {\n");
+    fprintf(t->out, "        vm->pc = 0x%03x;\n", next);
+    fprintf(t->out, "        return executed + %d;\n", executed);
+    fprintf(t->out, "    }\n");
+}
+
+/*
+ * Continues at `target` after `executed` instructions of this block,
+ * chaining into the target's block when it fits the budget.
+ */
+static void emit_successor(struct translation *t, uint16_t target, int executed, const char *indent) {
+    const struct cfg_block *next = cfg_block_at(t->cfg, target);
+
+    fprintf(t->out, "%svm->pc = 0x%03x;\n", indent, target);
+    if (next) {
+        fprintf(t->out, "%sif (executed + %d <= limit && !(vm->owned_pages & 0x%04x)) {\n",
+                indent, executed + next->length, block_pages(next));
+        fprintf(t->out, "%s    return block_%03x(vm, executed + %d, limit);\n",
+                indent, next->start, executed);
+        fprintf(t->out, "%s}\n", indent);
+    }
+    fprintf(t->out, "%sreturn executed + %d;\n", indent, executed);
+}
+
+static void emit_skip(struct translation *t, uint16_t instruction, uint16_t next, int executed) {
+    int x = REG_1(instruction);
+    int y = REG_2(instruction);
+
+    switch (HIGH_NIBBLE(instruction)) {
+        case 3:
+            fprintf(t->out, "    if (vm->reg_v[%d] == 0x%02x) {\n", x, LOW_BYTE(instruction));
+            break;
+        case 4:
+            fprintf(t->out, "    if (vm->reg_v[%d] != 0x%02x) {\n", x, LOW_BYTE(instruction));
+            break;
+        case 5:
+            fprintf(t->out, "    if (vm->reg_v[%d] == vm->reg_v[%d]) {\n", x, y);
+            break;
+        case 9:
+            fprintf(t->out, "    if (vm->reg_v[%d] != vm->reg_v[%d]) {\n", x, y);
+            break;
+        default:
+            fprintf(t->out, "    if (%svm_key_down(vm, vm->reg_v[%d])) {\n",
+                    LOW_BYTE(instruction) == 0x9E ? "" : "!", x);
+    }
+    emit_successor(t, next + 2, executed, "        ");
+    fprintf(t->out, "    }\n");
+    emit_successor(t, next, executed, "    ");
+}
+
+/*
+ * Straight-line instructions.
+ */
+static void emit_instruction(struct translation *t, uint16_t instruction, uint16_t next, int executed) {
+    FILE *out = t->out;
+    int x = REG_1(instruction);
+    int y = REG_2(instruction);
+
+    switch (HIGH_NIBBLE(instruction)) {
+        case 0:
+            fprintf(out, "    run_cls(vm);\n");
+            break;
+        case 6:
+            fprintf(out, "    vm->reg_v[%d] = 0x%02x;\n", x, LOW_BYTE(instruction));
+            break;
+        case 7:
+            fprintf(out, "    vm->reg_v[%d] += 0x%02x;\n", x, LOW_BYTE(instruction));
+            break;
+        case 8:
+            if (LOW_NIBBLE(instruction) == 0) {
+                fprintf(out, "    vm->reg_v[%d] = vm->reg_v[%d];\n", x, y);
+            } else {
+                fprintf(out, "    %s_%s(vm, 0x%04x);\n",
+                        arithmetic_names[LOW_NIBBLE(instruction)], t->profile, instruction);
+            }
+            break;
+        case 0xA:
+            fprintf(out, "    vm->reg_i = 0x%03x;\n", MEM_ADDR(instruction));
+            break;
+        case 0xC:
+            fprintf(out, "    run_rnd_vx_byte(vm, 0x%04x);\n", instruction);
+            break;
+        case 0xD:
+            fprintf(out, "    drw_vx_vy_n_%s(vm, 0x%04x);\n", t->profile, instruction);
+            emit_error_check(t, next, executed);
+            break;
+        case 0xF:
+            switch (LOW_BYTE(instruction)) {
+                case 0x07:
+                    fprintf(out, "    vm->reg_v[%d] = vm->reg_dt;\n", x);
+                    break;
+                case 0x15:
+                    fprintf(out, "    run_ld_dt_vx(vm, 0x%04x);\n", instruction);
+                    break;
+                case 0x18:
+                    fprintf(out, "    run_ld_st_vx(vm, 0x%04x);\n", instruction);
+                    break;
+                case 0x1E:
+                    fprintf(out, "    vm->reg_i += vm->reg_v[%d];\n", x);
+                    break;
+                case 0x29:
+                    fprintf(out, "    run_ld_f_vx(vm, 0x%04x);\n", instruction);
+                    break;
+                case 0x65:
+                    fprintf(out, "    ld_vx_i_%s(vm, 0x%04x);\n", t->profile, instruction);
+                    emit_error_check(t, next, executed);
+                    break;
+            }
+            break;
+    }
+}
+
+/*
+ * The instruction that ends a block, if it transfers control.
+ */
+static void emit_exit(struct translation *t, const struct cfg_block *block,
+        uint16_t instruction, uint16_t next) {
+    FILE *out = t->out;
+    int executed = block->length;
+
+    switch (block->exit) {
+        case CFG_NEXT:
+            emit_instruction(t, instruction, next, executed);
+            emit_successor(t, block->end, executed, "    ");
+            break;
+        case CFG_SKIP:
+            emit_skip(t, instruction, next, executed);
+            break;
+        case CFG_JUMP:
+            emit_successor(t, MEM_ADDR(instruction), executed, "    ");
+            break;
+        case CFG_CALL:
+            fprintf(out, "    vm->pc = 0x%03x;\n", next);
+            fprintf(out, "    run_call_addr(vm, 0x%04x);\n", instruction);
+            fprintf(out, "    if (vm->error) {\n        return executed + %d;\n    }\n", executed);
+            emit_successor(t, MEM_ADDR(instruction), executed, "    ");
+            break;
+        case CFG_RETURN:
+            fprintf(out, "    vm->pc = 0x%03x;\n", next);
+            fprintf(out, "    run_ret(vm);\n");
+            fprintf(out, "    return executed + %d;\n", executed);
+            break;
+        case CFG_COMPUTED:
+            fprintf(out, "    jp_v0_addr_%s(vm, 0x%04x);\n", t->profile, instruction);
+            fprintf(out, "    return executed + %d;\n", executed);
+            break;
+        case CFG_WAIT:
+            fprintf(out, "    vm->pc = 0x%03x;\n", next);
+            fprintf(out, "    run_ld_vx_k(vm, 0x%04x);\n", instruction);
+            fprintf(out, "    return executed + %d;\n", executed);
+            break;
+        case CFG_STORE:
+            fprintf(out, "    vm->pc = 0x%03x;\n", next);
+            if (LOW_BYTE(instruction) == 0x33) {
+                fprintf(out, "    run_ld_b_vx(vm, 0x%04x);\n", instruction);
+            } else {
+                fprintf(out, "    ld_i_vx_%s(vm, 0x%04x);\n", t->profile, instruction);
+            }
+            fprintf(out, "    return executed + %d;\n", executed);
+            break;
+        case CFG_INVALID:
+            break;
+    }
+}
+
+static void emit_block(struct translation *t, const struct cfg_block *block) {
+    int executed = 0;
+
+    fprintf(t->out, "\nstatic int block_%03x(struct chip8 *vm, int executed, int limit) {\n", block->start);
+    for (uint16_t address = block->start; address < block->end; address += 2) {
+        uint16_t instruction = fetch(t->ram, address);
+        ++executed;
+        if (address + 2 == block->end) {
+            emit_exit(t, block, instruction, address + 2);
+        } else {
+            emit_instruction(t, instruction, address + 2, executed);
+        }
+    }
+    fprintf(t->out, "}\n");
+}
+
+void translate(FILE *out, const struct chip8 *vm, const char *rom_filename) {
+    struct cfg cfg;
+    const char *profile = profile_name(vm->profile);
+    struct translation t = { out, &cfg, vm->image->ram, profile };
+
+    cfg_build(&cfg, vm->image->ram, PROG_MEM_START, PROG_MEM_START, vm->prog_mem_end);
+
+    fprintf(out, "/* Translated from %s by recompile. */\n", rom_filename);
+    fprintf(out, "#include <stdio.h>\n#include \"machine.h\"\n#include \"instructions.h\"\n"
+            "#include \"native.h\"\n#include \"trace.h\"\n\n");
+    fprintf(out, "#pragma GCC diagnostic ignored \"-Wunused-function\"\n");
+    fprintf(out, "#define PROFILE %s\n%s#include \"dispatch.h\"\n\n", profile, profile_quirks[vm->profile]);
+
+    for (size_t i = 0; i < cfg.block_count; ++i) {
+        fprintf(out, "static int block_%03x(struct chip8 *vm, int executed, int limit);\n",
+                cfg.blocks[i].start);
+    }
+    for (size_t i = 0; i < cfg.block_count; ++i) {
+        emit_block(&t, &cfg.blocks[i]);
+    }
+
+    fprintf(out, "\nstatic const struct native_block blocks[] = {\n");
+    for (size_t i = 0; i < cfg.block_count; ++i) {
+        const struct cfg_block *block = &cfg.blocks[i];
+        fprintf(out, "    { 0x%03x, 0x%03x, %d, 0x%04x, block_%03x },\n",
+                block->start, block->end, block->length, block_pages(block), block->start);
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "const struct native_header %s = {\n", NATIVE_SYMBOL);
+    fprintf(out, "    NATIVE_ABI_VERSION, sizeof(struct chip8), 0x%016" PRIx64 "u, %d, %zu, blocks\n",
+            vm->rom_hash, vm->profile, cfg.block_count);
+    fprintf(out, "};\n");
+
+    size_t written = 0;
+    for (size_t i = 0; i < cfg.block_count; ++i) {
+        written += cfg.blocks[i].written;
+    }
+    printf("Translated %zu blocks%s.\n", cfg.block_count,
+            cfg.computed_jumps ? "; Bnnn targets are interpreted" : "");
+    if (written || cfg.unknown_stores) {
+        printf("%zu blocks are store targets and %zu stores go to unknown addresses; "
+                "rewritten blocks are interpreted.\n", written, cfg.unknown_stores);
+    }
+    cfg_free(&cfg);
+}
+
+static double run_frames(struct chip8 *vm, uint32_t frames) {
+    clock_t start = clock();
+    uint64_t keys = 1;
+
+    for (uint32_t frame = 0; frame < frames && !vm->error; ++frame) {
+        vm_set_keypad(vm, scripted_keypad(&keys, frame));
+        vm_run_frame(vm);
+    }
+    return (clock() - start) / (double) CLOCKS_PER_SEC;
+}
+
+/*
+ * Runs both engines frame by frame with the same pseudo-random keypad
+ * input, then times each on its own.
+ */
+bool benchmark(const struct native_program *program, struct chip8 *vm, uint32_t frames) {
+    struct chip8 interpreted, native;
+
+    vm_fork(&interpreted, vm);
+    vm_fork(&native, vm);
+    if (!native_attach(&native, program)) {
+        printf("The shared object was translated from another ROM or profile.\n");
+        exit(1);
+    }
+
+    uint64_t keys = 1;
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+        uint16_t keypad = scripted_keypad(&keys, frame);
+        vm_set_keypad(&interpreted, keypad);
+        vm_set_keypad(&native, keypad);
+        vm_run_frame(&interpreted);
+        vm_run_frame(&native);
+        if (vm_state_hash(&interpreted) != vm_state_hash(&native) ||
+                interpreted.instructions != native.instructions) {
+            printf("State differs after frame %" PRIu32 " (pc %03x vs %03x).\n",
+                    frame, interpreted.pc, native.pc);
+            return false;
+        }
+        if (interpreted.error) {
+            printf("Stopped on VM error %d after frame %" PRIu32 ".\n", interpreted.error, frame);
+            frames = frame + 1;
+            break;
+        }
+    }
+    vm_release(&interpreted);
+    vm_release(&native);
+
+    vm_fork(&interpreted, vm);
+    vm_fork(&native, vm);
+    native_attach(&native, program);
+    double interpreted_seconds = run_frames(&interpreted, frames);
+    double native_seconds = run_frames(&native, frames);
+    printf("%" PRIu32 " frames of %d cycles match; interpreter %.3fs, native %.3fs (%.1fx).\n",
+            frames, vm->cycles_per_frame, interpreted_seconds, native_seconds,
+            interpreted_seconds / (native_seconds > 0 ? native_seconds : 1e-9));
+    vm_release(&interpreted);
+    vm_release(&native);
+
+    return true;
+}
+
+void print_usage(void) {
+    puts("Usage: recompile [-q profile] rom out.c");
+    puts("       recompile -b rom.so [-q profile] [-c cycles] [-f frames] rom");
+}
+
+int main(int argc, char **argv) {
+    enum quirk_profile profile = PROFILE_DEFAULT;
+    const char *library = NULL;
+    uint32_t frames = DEFAULT_BENCH_FRAMES;
+    int cycles_per_frame = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q:b:c:f:")) != -1) {
+        switch (opt) {
+            case 'q':
+                if (!parse_profile(optarg, &profile)) {
+                    printf("Unknown quirk profile %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'b':
+                library = optarg;
+                break;
+            case 'c':
+                cycles_per_frame = atoi(optarg);
+                break;
+            case 'f':
+                frames = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                print_usage();
+                exit(1);
+        }
+    }
+    if (optind + (library ? 1 : 2) > argc) {
+        print_usage();
+        exit(0);
+    }
+
+    struct chip8 vm;
+    vm_init_with_rom(&vm, argv[optind]);
+    vm.profile = profile;
+    if (cycles_per_frame > 0) {
+        vm.cycles_per_frame = cycles_per_frame;
+    }
+    vm_seed_random(&vm, 1);
+
+    bool ok = true;
+    if (library) {
+        struct native_program *program = malloc(sizeof(struct native_program));
+        if (!native_load(program, library)) {
+            exit(1);
+        }
+        ok = benchmark(program, &vm, frames);
+        native_unload(program);
+        free(program);
+    } else {
+        FILE *out = fopen(argv[optind + 1], "w");
+        if (out == NULL) {
+            printf("Cannot open file %s.\n", argv[optind + 1]);
+            exit(1);
+        }
+        translate(out, &vm, argv[optind]);
+        fclose(out);
+    }
+
+    vm_release(&vm);
+    return ok ? 0 : 1;
+}
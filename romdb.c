@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "romdb.h"
+
+#define MAX_LINE 256
+
+static int compare_entries(const void *a, const void *b) {
+    uint64_t hash_a = ((const struct rom_info *) a)->hash;
+    uint64_t hash_b = ((const struct rom_info *) b)->hash;
+    return (hash_a > hash_b) - (hash_a < hash_b);
+}
+
+static bool parse_line(const char *line, struct rom_info *info) {
+    char profile[MAX_LINE];
+    char keymap[MAX_LINE] = "";
+
+    int fields = sscanf(line, "%" SCNx64 " %255s %d %255s",
+            &info->hash, profile, &info->cycles_per_frame, keymap);
+    if (fields < 3 || !parse_profile(profile, &info->profile) ||
+            info->cycles_per_frame <= 0) {
+        return false;
+    }
+    if (fields == 4 && strlen(keymap) != KEYMAP_LEN) {
+        return false;
+    }
+    strcpy(info->keymap, keymap);
+
+    return true;
+}
+
+bool romdb_load(struct romdb *db, const char *const filename) {
+    size_t capacity = 64;
+    char line[MAX_LINE];
+    int line_number = 0;
+
+    db->entries = NULL;
+    db->count = 0;
+
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        return false;
+    }
+
+    db->entries = malloc(capacity * sizeof(struct rom_info));
+    while (fgets(line, sizeof(line), fp)) {
+        struct rom_info info;
+        ++line_number;
+
+        const char *start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0') {
+            continue;
+        }
+        if (!parse_line(start, &info)) {
+            fprintf(stderr, "%s:%d: skipping malformed ROM entry\n", filename, line_number);
+            continue;
+        }
+        if (db->count == capacity) {
+            capacity *= 2;
+            db->entries = realloc(db->entries, capacity * sizeof(struct rom_info));
+        }
+        db->entries[db->count++] = info;
+    }
+    fclose(fp);
+
+    qsort(db->entries, db->count, sizeof(struct rom_info), compare_entries);
+    return true;
+}
+
+const struct rom_info *romdb_lookup(const struct romdb *db, uint64_t hash) {
+    struct rom_info key = { .hash = hash };
+    if (db->count == 0) {
+        return NULL;
+    }
+    return bsearch(&key, db->entries, db->count, sizeof(struct rom_info), compare_entries);
+}
+
+void romdb_free(struct romdb *db) {
+    free(db->entries);
+    db->entries = NULL;
+    db->count = 0;
+}
+
+void vm_apply_rom_info(struct chip8 *vm, const struct rom_info *info) {
+    vm->profile = info->profile;
+    vm->cycles_per_frame = info->cycles_per_frame;
+}
@@ -0,0 +1,48 @@
+#ifndef ROMDB_H
+#define ROMDB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "machine.h"
+
+#define ROMDB_DEFAULT_FILE "romdb.txt"
+#define ROMDB_ENV "CHIP8_ROMDB"
+#define KEYMAP_LEN 16
+
+/*
+ * Per-ROM settings, keyed by hash_rom() of the image. The database is a
+ * text file with one ROM per line:
+ *
+ *   # hash           profile  cycles  keymap (optional)
+ *   8a3fb1e6f2c04d19 schip    15      x123qweasdzc4rfv
+ *
+ * The keymap lists the keyboard key for hex keys 0 through F.
+ */
+struct rom_info {
+    uint64_t hash;
+    enum quirk_profile profile;
+    int cycles_per_frame;
+    char keymap[KEYMAP_LEN + 1];
+};
+
+struct romdb {
+    struct rom_info *entries;
+    size_t count;
+};
+
+/*
+ * Loads a database file. Malformed lines are reported and skipped.
+ */
+bool romdb_load(struct romdb *db, const char *const filename);
+
+const struct rom_info *romdb_lookup(const struct romdb *db, uint64_t hash);
+
+void romdb_free(struct romdb *db);
+
+/*
+ * Applies the profile and speed of a known ROM to a loaded VM.
+ */
+void vm_apply_rom_info(struct chip8 *vm, const struct rom_info *info);
+
+#endif
@@ -3,25 +3,25 @@
 #include "machine.h"
 
 void clear_screen(struct screen *screen) {
-    memset(screen->screen, 0, SCREEN_WIDTH_PX * SCREEN_HEIGHT_PX);
-    screen->changed = true;
+    memset(screen->rows, 0, sizeof(screen->rows));
+    screen->pixel_hash = 0;
+    screen->dirty_rows = ALL_ROWS;
 }
 
-int get_coordinate(int x, int y) {
-    int wrapped_x = x % SCREEN_WIDTH_PX;
-    int wrapped_y = y % SCREEN_HEIGHT_PX;
-    return wrapped_y * SCREEN_WIDTH_PX + wrapped_x;
+static uint64_t pixel_mask(int x) {
+    return 1ull << (SCREEN_WIDTH_PX - 1 - x % SCREEN_WIDTH_PX);
 }
 
 bool xor_pixel(struct screen *screen, int x, int y, uint8_t value) {
     if (value) {
-        int coordinate = get_coordinate(x, y);
-        uint8_t old_value = screen->screen[coordinate];
-        screen->screen[coordinate] = old_value ^ value;
-
-        if (!screen->changed) {
-            screen->changed = true;
-        }
+        x %= SCREEN_WIDTH_PX;
+        y %= SCREEN_HEIGHT_PX;
+        uint64_t *row = &screen->rows[y];
+        uint64_t mask = pixel_mask(x);
+        bool old_value = *row & mask;
+        *row ^= mask;
+        screen->pixel_hash ^= pixel_key(x, y);
+        screen->dirty_rows |= 1u << y;
 
         return old_value;
     } else {
@@ -29,7 +29,62 @@ bool xor_pixel(struct screen *screen, int x, int y, uint8_t value) {
     }
 }
 
+void screen_view_init(struct screen_view *view) {
+    memset(view->rows, 0, sizeof(view->rows));
+    view->stale = true;
+}
+
+uint32_t screen_present(struct screen *screen, struct screen_view *view) {
+    uint32_t candidates = view->stale ? ALL_ROWS : screen->dirty_rows;
+    uint32_t changed = 0;
+
+    while (candidates) {
+        int y = __builtin_ctz(candidates);
+        candidates &= candidates - 1;
+        if (view->rows[y] != screen->rows[y] || view->stale) {
+            view->rows[y] = screen->rows[y];
+            changed |= 1u << y;
+        }
+    }
+    screen->dirty_rows = 0;
+    view->stale = false;
+    return changed;
+}
+
 bool get_pixel(const struct screen * const screen, int x, int y) {
-    int coordinate = get_coordinate(x, y);
-    return screen->screen[coordinate];
+    return screen->rows[y % SCREEN_HEIGHT_PX] & pixel_mask(x);
+}
+
+void pack_screen(const struct screen * const screen, uint64_t rows[SCREEN_HEIGHT_PX]) {
+    memcpy(rows, screen->rows, sizeof(screen->rows));
+}
+
+void unpack_screen(struct screen *screen, const uint64_t rows[SCREEN_HEIGHT_PX]) {
+    memcpy(screen->rows, rows, sizeof(screen->rows));
+    screen->pixel_hash = hash_pixels(screen);
+    screen->dirty_rows = ALL_ROWS;
+}
+
+uint64_t hash_screen(const struct screen * const screen) {
+    uint64_t rows[SCREEN_HEIGHT_PX];
+    uint64_t h = 0x9e3779b97f4a7c15u;
+
+    pack_screen(screen, rows);
+    for (int y = 0; y < SCREEN_HEIGHT_PX; ++y) {
+        h = mix64(h ^ rows[y]) + y;
+    }
+    return mix64(h);
+}
+
+uint64_t hash_pixels(const struct screen * const screen) {
+    uint64_t h = 0;
+
+    for (int y = 0; y < SCREEN_HEIGHT_PX; ++y) {
+        for (int x = 0; x < SCREEN_WIDTH_PX; ++x) {
+            if (get_pixel(screen, x, y)) {
+                h ^= pixel_key(x, y);
+            }
+        }
+    }
+    return h;
 }
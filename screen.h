@@ -7,15 +7,74 @@
 #define SCREEN_WIDTH_PX 64
 #define SCREEN_HEIGHT_PX 32
 
+/*
+ * One 64-bit word per row, leftmost pixel in the most significant bit.
+ * pixel_hash is the XOR of pixel_key() over the lit pixels, kept up to
+ * date as pixels flip. dirty_rows has a bit for each row written since
+ * the last screen_present().
+ */
 struct screen {
-    uint8_t screen[SCREEN_WIDTH_PX * SCREEN_HEIGHT_PX];
-    bool changed;
+    uint64_t rows[SCREEN_HEIGHT_PX];
+    uint64_t pixel_hash;
+    uint32_t dirty_rows;
 };
 
+#define ALL_ROWS 0xFFFFFFFFu
+
+/*
+ * The image a frontend last presented. A stale view (what the display
+ * shows is unknown) differs from every screen.
+ */
+struct screen_view {
+    uint64_t rows[SCREEN_HEIGHT_PX];
+    bool stale;
+};
+
+static inline uint64_t mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdu;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53u;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t pixel_key(int x, int y) {
+    return mix64((uint64_t) (y * SCREEN_WIDTH_PX + x) + 0x5c7ee4a1u);
+}
+
 void clear_screen(struct screen *screen);
 
 bool xor_pixel(struct screen *screen, int x, int y, uint8_t value);
 
 bool get_pixel(const struct screen * const screen, int x, int y);
 
+void screen_view_init(struct screen_view *view);
+
+/*
+ * Compares the rows written since the last call with the view, copies
+ * the ones that differ into it and returns them as a bitmask. 0 means
+ * the visible image is unchanged, e.g. when a sprite was drawn and
+ * erased in between, and there's nothing to present.
+ */
+uint32_t screen_present(struct screen *screen, struct screen_view *view);
+
+/*
+ * Copies the screen rows out of / into a struct screen.
+ */
+void pack_screen(const struct screen * const screen, uint64_t rows[SCREEN_HEIGHT_PX]);
+
+void unpack_screen(struct screen *screen, const uint64_t rows[SCREEN_HEIGHT_PX]);
+
+/*
+ * 64-bit hash of the visible image, for comparing frames against
+ * golden traces.
+ */
+uint64_t hash_screen(const struct screen * const screen);
+
+/*
+ * Recomputes pixel_hash from scratch.
+ */
+uint64_t hash_pixels(const struct screen * const screen);
+
 #endif
@@ -1,5 +1,8 @@
 #include <math.h>
+#include <string.h>
 #include "sdl_system.h"
+#include "machine.h"
+#include "phosphor.h"
 #include "screen.h"
 
 #define WAV_FILE "sound/316852__kwahmah-02__1khz-30-seconds.wav"
@@ -44,6 +47,12 @@ SDL_Keycode hex_key_keycode_map[] = {
 
 void audio_callback(void *userdata, Uint8 *stream, int len) {
     struct audio_data *data = (struct audio_data *)userdata;
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    if (data->last_callback && now - data->last_callback > 2 * data->period) {
+        __atomic_add_fetch(&data->underruns, 1, __ATOMIC_RELAXED);
+    }
+    data->last_callback = now;
 
     Uint32 len_remaining = data->wav_len_bytes - data->audio_pos;
     Uint32 copy_bytes = fmin(len, data->wav_len_bytes);
@@ -74,6 +83,14 @@ void init_window(struct io_state *state, int screen_width, int screen_height) {
         if (state->renderer == NULL) {
             printf("Failed to create SDL Renderer. Error: %s\n", SDL_GetError());
             state->quit = true;
+            return;
+        }
+        state->texture = SDL_CreateTexture(state->renderer, SDL_PIXELFORMAT_ARGB8888,
+                SDL_TEXTUREACCESS_STREAMING, screen_width * SCALE_MULTIPLIER,
+                screen_height * SCALE_MULTIPLIER);
+        if (state->texture == NULL) {
+            printf("Failed to create SDL texture. Error: %s\n", SDL_GetError());
+            state->quit = true;
         }
     }
 }
@@ -90,7 +107,8 @@ void init_sound(struct io_state *state) {
     } else {
         state->playing_sound = false;
 
-        SDL_zero(audio_spec);
+        // Keep the WAV's rate, format and channels: with no obtained spec
+        // SDL converts to exactly this, so the callback period is known.
         audio_spec.callback = audio_callback;
         audio_spec.userdata = &state->audio_data;
         audio_spec.samples = 128;
@@ -99,6 +117,8 @@ void init_sound(struct io_state *state) {
         state->audio_data.wav_buffer = wav_buffer;
         state->audio_data.audio_pos = 0;
         state->audio_data.wav_len_bytes = wav_length;
+        state->audio_data.period = (Uint64)audio_spec.samples *
+            SDL_GetPerformanceFrequency() / audio_spec.freq;
 
         if (SDL_OpenAudio(&audio_spec, NULL) < 0){
             printf("Couldn't open sound device: %s\n", SDL_GetError());
@@ -109,7 +129,17 @@ void init_sound(struct io_state *state) {
 
 void init_io(struct io_state *state, int screen_width, int screen_height) {
     state->window = NULL;
+    state->phosphor = NULL;
+    state->texture = NULL;
+    screen_view_init(&state->view);
     state->quit = false;
+    state->draw_ns = 0;
+    state->input_time = 0;
+    state->input_key = 0;
+    state->latency_ns = 0;
+    state->audio_data.last_callback = 0;
+    state->audio_data.period = 0;
+    state->audio_data.underruns = 0;
 
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
         printf("Failed to initialize SDL. Error: %s\n", SDL_GetError());
@@ -120,27 +150,53 @@ void init_io(struct io_state *state, int screen_width, int screen_height) {
     }
 }
 
+static int hex_key_of(SDL_Keycode keycode) {
+    for (int hex_key = 0; hex_key < 16; ++hex_key) {
+        if (hex_key_keycode_map[hex_key] == keycode) {
+            return hex_key;
+        }
+    }
+    return -1;
+}
+
 void handle_events(struct io_state *state, int *key_pressed) {
     SDL_Event e;
     *key_pressed = -1;
+    state->input_time = 0;
     while (SDL_PollEvent(&e) != 0) {
         if (e.type == SDL_QUIT) {
             state->quit = true;
-        } else if (e.type == SDL_KEYDOWN) {
-            int hex_key;
-            for (hex_key = 0; hex_key < 16; ++hex_key) {
-                if (hex_key_keycode_map[hex_key]) {
-                    break;
-                }
+        } else if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) {
+            int hex_key = hex_key_of(e.key.keysym.sym);
+            if (hex_key < 0) {
+                continue;
             }
-            if (hex_key < 16) {
+            if (e.type == SDL_KEYDOWN) {
                 *key_pressed = hex_key;
+                if (!e.key.repeat) {
+                    state->input_time = SDL_GetPerformanceCounter();
+                    state->input_key = hex_key;
+                }
             }
         }
     }
 }
 
+bool enable_phosphor(struct io_state *state, struct phosphor *phosphor) {
+    if (state->texture == NULL) {
+        return false;
+    }
+    state->phosphor = phosphor;
+    // The texture holds plain pixels; repaint all of it.
+    screen_view_init(&state->view);
+    return true;
+}
+
 void quit_io(struct io_state *state) {
+    if (state->texture) {
+        SDL_DestroyTexture(state->texture);
+        state->texture = NULL;
+    }
     if (state->window) {
         SDL_DestroyWindow(state->window);
         state->window = NULL;
@@ -166,31 +222,95 @@ bool is_key_down(uint8_t hex_key_code) {
     return keyboard_state[scancode];
 }
 
-void draw_screen(struct io_state *state, const struct screen * const screen) {
-    SDL_SetRenderDrawColor(state->renderer, 0, 0, 0, 0);
-    SDL_RenderClear(state->renderer);
+uint16_t read_keypad(void) {
+    uint16_t keypad = 0;
+    for (uint8_t hex_key = 0; hex_key < 16; ++hex_key) {
+        if (is_key_down(hex_key)) {
+            keypad |= 1 << hex_key;
+        }
+    }
+    return keypad;
+}
+
+void set_keymap(const char *keys) {
+    for (int hex_key = 0; hex_key < 16 && keys[hex_key]; ++hex_key) {
+        char name[2] = { keys[hex_key], '\0' };
+        SDL_Scancode scancode = SDL_GetScancodeFromName(name);
+        if (scancode != SDL_SCANCODE_UNKNOWN) {
+            hex_key_scancode_map[hex_key] = scancode;
+            hex_key_keycode_map[hex_key] = SDL_GetKeyFromScancode(scancode);
+        }
+    }
+}
+
+/*
+ * Writes pixel rows `first` to `last` to a texture locked over them.
+ */
+static void draw_pixels(struct io_state *state, const struct screen * const screen,
+        uint32_t *pixels, int pitch, int first, int last) {
+    size_t row_bytes = (size_t) state->screen_width * SCALE_MULTIPLIER * sizeof(uint32_t);
+
+    for (int y = first; y <= last; ++y) {
+        uint8_t *block = (uint8_t *) pixels + (size_t) (y - first) * SCALE_MULTIPLIER * pitch;
+        uint32_t *row = (uint32_t *) block;
 
-    for (int y = 0; y < state->screen_height; ++y) {
         for (int x = 0; x < state->screen_width; ++x) {
-            if (get_pixel(screen, x, y)) {
-                SDL_Rect fillRect = {
-                    x * SCALE_MULTIPLIER,
-                    y * SCALE_MULTIPLIER,
-                    SCALE_MULTIPLIER,
-                    SCALE_MULTIPLIER
-                };
-                SDL_SetRenderDrawColor(state->renderer, 0xFF, 0xFF, 0xFF, 0xFF);
-                SDL_RenderFillRect(state->renderer, &fillRect);
+            uint32_t color = get_pixel(screen, x, y) ? 0xFFFFFFFFu : 0xFF000000u;
+            for (int i = 0; i < SCALE_MULTIPLIER; ++i) {
+                row[x * SCALE_MULTIPLIER + i] = color;
             }
         }
+        for (int copy = 1; copy < SCALE_MULTIPLIER; ++copy) {
+            memcpy(block + (size_t) copy * pitch, row, row_bytes);
+        }
     }
+}
 
+/*
+ * The texture keeps the last image, so only the band from the lowest
+ * to the highest of `rows` is rewritten (plus any rows still fading
+ * through the phosphor buffer) before the whole texture is copied to
+ * the window.
+ */
+void draw_screen(struct io_state *state, const struct screen * const screen, uint32_t rows) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    void *pixels;
+    int pitch;
+
+    if (state->phosphor) {
+        rows |= state->phosphor->fading_rows;
+    }
+    if (rows) {
+        int first = __builtin_ctz(rows);
+        int last = 31 - __builtin_clz(rows);
+        SDL_Rect band = {
+            0,
+            first * SCALE_MULTIPLIER,
+            state->screen_width * SCALE_MULTIPLIER,
+            (last - first + 1) * SCALE_MULTIPLIER
+        };
+        if (SDL_LockTexture(state->texture, &band, &pixels, &pitch) == 0) {
+            if (state->phosphor) {
+                phosphor_render(state->phosphor, screen, rows, pixels, pitch, SCALE_MULTIPLIER);
+            } else {
+                draw_pixels(state, screen, pixels, pitch, first, last);
+            }
+            SDL_UnlockTexture(state->texture);
+        }
+    }
+    SDL_RenderCopy(state->renderer, state->texture, NULL, NULL);
     SDL_RenderPresent(state->renderer);
+    state->draw_ns += (SDL_GetPerformanceCounter() - start) * 1000000000ull /
+        SDL_GetPerformanceFrequency();
 }
 
 void play_sound(struct io_state *state) {
     if (!state->playing_sound && state->audio_data.loaded) {
         state->playing_sound = true;
+        // The pause isn't an underrun.
+        SDL_LockAudio();
+        state->audio_data.last_callback = 0;
+        SDL_UnlockAudio();
         SDL_PauseAudio(0);
     }
 }
@@ -199,6 +319,70 @@ void stop_sound(struct io_state *state) {
     if (state->playing_sound && state->audio_data.loaded) {
         state->playing_sound = false;
         SDL_PauseAudio(1);
+        SDL_LockAudio();
         state->audio_data.audio_pos = 0;
+        SDL_UnlockAudio();
     }
 }
+
+uint32_t audio_underruns(const struct io_state *state) {
+    return __atomic_load_n(&state->audio_data.underruns, __ATOMIC_RELAXED);
+}
+
+/*
+ * After a draw: if the program has read a key press and the screen has
+ * changed since, this frame is the answer to it.
+ */
+static void note_answer(struct chip8 *vm, struct io_state *io) {
+    if (!vm->read_input_time || vm->screen.pixel_hash == vm->read_screen_hash) {
+        return;
+    }
+    // A key can wait for an answer long enough for ticks * 1e9 to
+    // overflow, so divide first.
+    uint64_t ticks = SDL_GetPerformanceCounter() - vm->read_input_time;
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    io->latency_ns = ticks / frequency * 1000000000ull +
+        ticks % frequency * 1000000000ull / frequency;
+    vm->read_input_time = 0;
+}
+
+/*
+ * Presents the screen once per render interval if the image differs
+ * from the one in the window, or while the phosphor image is fading.
+ * Returns true when a frame boundary was crossed.
+ */
+bool vm_render(struct chip8 *vm, float dt, struct io_state *io) {
+    vm->sec_since_render += dt;
+    if (vm->sec_since_render < RENDER_INTERVAL_SECONDS) {
+        return false;
+    }
+
+    // A fading phosphor image changes even when the screen doesn't.
+    uint32_t rows = screen_present(&vm->screen, &io->view);
+    if (rows || (io->phosphor && io->phosphor->fading_rows)) {
+        draw_screen(io, &vm->screen, rows);
+        note_answer(vm, io);
+    }
+    vm->sec_since_render = 0;
+
+    return true;
+}
+
+bool vm_run(struct chip8 *vm, float dt, struct io_state *io) {
+    uint8_t old_st = vm->reg_st;
+
+    io->latency_ns = 0;
+
+    vm_run_instruction(vm, dt);
+    vm_update_timers(vm, dt);
+
+    if (vm->reg_st != old_st) {
+        if (vm->reg_st > 0) {
+            play_sound(io);
+        } else {
+            stop_sound(io);
+        }
+    }
+
+    return vm_render(vm, dt, io);
+}
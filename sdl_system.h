@@ -3,16 +3,28 @@
 
 #include <SDL.h>
 #include <stdbool.h>
+#include "screen.h"
 
 #define SCALE_MULTIPLIER 10
 
-struct screen;
+struct chip8;
+struct phosphor;
 
+/*
+ * The audio thread counts underruns: callbacks arriving more than
+ * twice the expected period (samples / freq, in performance counter
+ * ticks) after the previous one, i.e. the device starved. The main
+ * thread only touches the callback's state under SDL_LockAudio().
+ * Read them with audio_underruns().
+ */
 struct audio_data {
     bool loaded;
     Uint8 *wav_buffer;
     Uint32 audio_pos;
     Uint32 wav_len_bytes;
+    Uint64 last_callback;
+    Uint64 period;
+    Uint32 underruns;
 };
 
 struct io_state {
@@ -23,20 +35,65 @@ struct io_state {
     struct audio_data audio_data;
     int screen_width;
     int screen_height;
+    uint64_t draw_ns;   // total time spent in draw_screen()
+    // SDL_GetPerformanceCounter() at the last hex key press (not
+    // auto-repeat) of the last handle_events() call, or 0, and its key.
+    uint64_t input_time;
+    int input_key;
+    // Input latency answered by the frame the last vm_run() drew, or 0.
+    uint64_t latency_ns;
+    // Set by enable_phosphor(); draw_screen() then presents through it.
+    struct phosphor *phosphor;
+    SDL_Texture *texture;       // the window's image, updated by rows
+    struct screen_view view;    // what the window shows
 };
 
 void init_io(struct io_state *state, int screen_width, int screen_height);
 
+/*
+ * Polls SDL events. `key_pressed` gets the last hex key pressed, or -1.
+ */
 void handle_events(struct io_state *state, int *key_pressed);
 
 bool is_key_down(uint8_t hex_key_code);
 
+/*
+ * Returns the state of all hex keys, one bit per key.
+ */
+uint16_t read_keypad(void);
+
+/*
+ * Remaps the hex keypad. `keys` names the keyboard key for each hex
+ * key 0 through F, e.g. "x123qweasdzc4rfv".
+ */
+void set_keymap(const char *keys);
+
+/*
+ * Presents frames through a phosphor persistence buffer (see
+ * phosphor.h). Returns false if there is no texture to draw to.
+ */
+bool enable_phosphor(struct io_state *state, struct phosphor *phosphor);
+
 void quit_io(struct io_state *state);
 
-void draw_screen(struct io_state *state, const struct screen * const screen);
+/*
+ * Redraws `rows` (one bit per pixel row, as from screen_present()) and
+ * presents the window.
+ */
+void draw_screen(struct io_state *state, const struct screen * const screen, uint32_t rows);
 
 void play_sound(struct io_state *state);
 
 void stop_sound(struct io_state *state);
 
+uint32_t audio_underruns(const struct io_state *state);
+
+/*
+ * Advances the VM by dt seconds and presents its screen and sound.
+ * Returns true when a frame boundary (the render interval) was crossed.
+ * Pass key presses to the VM with vm_press_key(state->input_key,
+ * state->input_time) to have state->latency_ns measured.
+ */
+bool vm_run(struct chip8 *vm, float dt, struct io_state *io);
+
 #endif
@@ -0,0 +1,87 @@
+#include <string.h>
+#include <time.h>
+#include "telemetry.h"
+
+uint64_t telemetry_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void latency_record(struct latency_histogram *histogram, uint64_t ns) {
+    uint64_t bucket = ns / LATENCY_BUCKET_NS;
+    ++histogram->counts[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1];
+    ++histogram->samples;
+}
+
+uint64_t latency_percentile(const struct latency_histogram *histogram, double fraction) {
+    uint64_t rank = fraction * histogram->samples + 0.5;
+    uint64_t seen = 0;
+
+    if (histogram->samples == 0) {
+        return 0;
+    }
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            return (i + 1) * LATENCY_BUCKET_NS;
+        }
+    }
+    return LATENCY_BUCKETS * LATENCY_BUCKET_NS;
+}
+
+bool telemetry_open(struct telemetry *telemetry, const char *const path) {
+    memset(telemetry, 0, sizeof(*telemetry));
+    if (strcmp(path, "-") == 0) {
+        telemetry->out = stdout;
+    } else {
+        telemetry->out = fopen(path, "a");
+        telemetry->close_out = true;
+    }
+    telemetry->interval_start = telemetry_now();
+    return telemetry->out != NULL;
+}
+
+void telemetry_close(struct telemetry *telemetry) {
+    if (telemetry->close_out) {
+        fclose(telemetry->out);
+    }
+    telemetry->out = NULL;
+}
+
+void telemetry_update(struct telemetry *telemetry, uint64_t now) {
+    uint64_t elapsed = now - telemetry->interval_start;
+    struct timespec wall;
+
+    if (elapsed < TELEMETRY_INTERVAL_NS) {
+        return;
+    }
+
+    double seconds = elapsed / 1e9;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    fprintf(telemetry->out,
+            "{\"time\":%.3f,\"seconds\":%.3f,\"instructions_per_second\":%.1f,"
+            "\"frames_per_second\":%.2f,\"instructions_per_frame\":%.2f,"
+            "\"vm_ms\":%.3f,\"draw_ms\":%.3f,\"events_ms\":%.3f,\"idle_ms\":%.3f,"
+            "\"audio_underruns\":%u,\"input_latency_samples\":%u,"
+            "\"input_latency_p50_ms\":%.1f,\"input_latency_p99_ms\":%.1f}\n",
+            wall.tv_sec + wall.tv_nsec / 1e9, seconds,
+            telemetry->instructions / seconds, telemetry->frames / seconds,
+            telemetry->frames ? (double) telemetry->instructions / telemetry->frames : 0.0,
+            telemetry->phase_ns[TELEMETRY_VM] / 1e6, telemetry->phase_ns[TELEMETRY_DRAW] / 1e6,
+            telemetry->phase_ns[TELEMETRY_EVENTS] / 1e6, telemetry->phase_ns[TELEMETRY_IDLE] / 1e6,
+            telemetry->audio_underruns - telemetry->reported_underruns,
+            telemetry->latency.samples, latency_percentile(&telemetry->latency, 0.5) / 1e6,
+            latency_percentile(&telemetry->latency, 0.99) / 1e6);
+    fflush(telemetry->out);
+
+    telemetry->interval_start = now;
+    telemetry->instructions = 0;
+    telemetry->frames = 0;
+    telemetry->reported_underruns = telemetry->audio_underruns;
+    memset(telemetry->phase_ns, 0, sizeof(telemetry->phase_ns));
+    memset(&telemetry->latency, 0, sizeof(telemetry->latency));
+}
@@ -0,0 +1,85 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TELEMETRY_INTERVAL_NS 1000000000ull
+
+/*
+ * Where the main loop spends its time. TELEMETRY_IDLE is time in loop
+ * iterations that had nothing to do yet (the loop spins between
+ * instruction slots).
+ */
+enum telemetry_phase {
+    TELEMETRY_VM,
+    TELEMETRY_DRAW,
+    TELEMETRY_EVENTS,
+    TELEMETRY_IDLE,
+    TELEMETRY_PHASE_COUNT
+};
+
+#define LATENCY_BUCKET_NS 100000ull
+#define LATENCY_BUCKETS 5000
+
+/*
+ * Latencies in 0.1 ms buckets up to 500 ms; longer ones land in the
+ * last bucket.
+ */
+struct latency_histogram {
+    uint32_t counts[LATENCY_BUCKETS];
+    uint32_t samples;
+};
+
+void latency_record(struct latency_histogram *histogram, uint64_t ns);
+
+/*
+ * The upper edge of the bucket holding the given fraction (0 to 1) of
+ * the samples, in nanoseconds; 0 without samples.
+ */
+uint64_t latency_percentile(const struct latency_histogram *histogram, double fraction);
+
+/*
+ * Stats for the interval since the last report. Once a second,
+ * telemetry_update() writes them as one JSON object per line:
+ *
+ *   {"time":1700000000.000,"seconds":1.000,"instructions_per_second":...,
+ *    "frames_per_second":...,"instructions_per_frame":...,"vm_ms":...,
+ *    "draw_ms":...,"events_ms":...,"idle_ms":...,"audio_underruns":...,
+ *    "input_latency_samples":...,"input_latency_p50_ms":...,
+ *    "input_latency_p99_ms":...}
+ */
+struct telemetry {
+    FILE *out;
+    bool close_out;
+    uint64_t interval_start;
+    uint64_t instructions;
+    uint64_t frames;
+    uint64_t phase_ns[TELEMETRY_PHASE_COUNT];
+    uint32_t audio_underruns;       // running total, kept current by the caller
+    uint32_t reported_underruns;
+    struct latency_histogram latency;
+};
+
+uint64_t telemetry_now(void);
+
+/*
+ * Opens `path` for appending; "-" is stdout.
+ */
+bool telemetry_open(struct telemetry *telemetry, const char *const path);
+
+void telemetry_close(struct telemetry *telemetry);
+
+static inline void telemetry_add(struct telemetry *telemetry, enum telemetry_phase phase,
+        uint64_t ns) {
+    telemetry->phase_ns[phase] += ns;
+}
+
+/*
+ * Writes a report if a full interval has passed at `now`, then starts
+ * the next interval.
+ */
+void telemetry_update(struct telemetry *telemetry, uint64_t now);
+
+#endif
@@ -0,0 +1,178 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "term.h"
+
+#define CLEAR "\x1b[H\x1b[2J"
+
+// U+2580 upper half, U+2584 lower half, U+2588 full block
+static const char *const half_blocks[4] = { " ", "\xe2\x96\x80", "\xe2\x96\x84", "\xe2\x96\x88" };
+
+// Braille dot bits by pixel column and row within a cell.
+static const uint8_t braille_dots[2][4] = {
+    { 0x01, 0x02, 0x04, 0x40 },
+    { 0x08, 0x10, 0x20, 0x80 }
+};
+
+static const uint64_t blank_rows[SCREEN_HEIGHT_PX];
+
+void term_init(struct term_renderer *term, enum term_glyphs glyphs) {
+    memset(term, 0, sizeof(*term));
+    term->glyphs = glyphs;
+    term->cell_width = glyphs == TERM_BRAILLE ? 2 : 1;
+    term->cell_height = glyphs == TERM_BRAILLE ? 4 : 2;
+}
+
+void term_invalidate(struct term_renderer *term) {
+    term->painted = false;
+}
+
+static inline int pixel(const uint64_t *rows, int x, int y) {
+    return rows[y] >> (SCREEN_WIDTH_PX - 1 - x) & 1;
+}
+
+static int cell_pattern(const struct term_renderer *term, const uint64_t *rows, int row,
+        int column) {
+    int x = column * term->cell_width;
+    int y = row * term->cell_height;
+    int pattern = 0;
+
+    if (term->glyphs == TERM_HALF_BLOCKS) {
+        return pixel(rows, x, y) | pixel(rows, x, y + 1) << 1;
+    }
+    for (int dx = 0; dx < 2; ++dx) {
+        for (int dy = 0; dy < 4; ++dy) {
+            if (pixel(rows, x + dx, y + dy)) {
+                pattern |= braille_dots[dx][dy];
+            }
+        }
+    }
+    return pattern;
+}
+
+static size_t glyph_length(int pattern) {
+    return pattern ? 3 : 1;
+}
+
+static char *put_glyph(char *out, enum term_glyphs glyphs, int pattern) {
+    if (pattern == 0) {
+        *out++ = ' ';
+    } else if (glyphs == TERM_HALF_BLOCKS) {
+        memcpy(out, half_blocks[pattern], 3);
+        out += 3;
+    } else {
+        // UTF-8 for U+2800 + pattern
+        *out++ = '\xe2';
+        *out++ = 0xA0 | pattern >> 6;
+        *out++ = 0x80 | (pattern & 0x3F);
+    }
+    return out;
+}
+
+/*
+ * Gets the cursor from the end of the last glyph to `column` of `row`,
+ * reprinting the cells in between when that's shorter than a move.
+ */
+static char *move_cursor(const struct term_renderer *term, char *out, const uint64_t *rows,
+        int row, int column, int cursor_row, int cursor_column) {
+    char move[16];
+    int move_length = snprintf(move, sizeof(move), "\x1b[%d;%dH", row + 1, column + 1);
+
+    if (row == cursor_row && column > cursor_column) {
+        size_t gap = 0;
+        for (int c = cursor_column; c < column; ++c) {
+            gap += glyph_length(cell_pattern(term, rows, row, c));
+        }
+        if (gap <= (size_t) move_length) {
+            for (int c = cursor_column; c < column; ++c) {
+                out = put_glyph(out, term->glyphs, cell_pattern(term, rows, row, c));
+            }
+            return out;
+        }
+    }
+    memcpy(out, move, move_length);
+    return out + move_length;
+}
+
+size_t term_render(struct term_renderer *term, const struct screen *screen, uint32_t changed_rows) {
+    const uint64_t *old = term->rows;
+    char *out = term->buffer;
+    int columns = SCREEN_WIDTH_PX / term->cell_width;
+    int rows = SCREEN_HEIGHT_PX / term->cell_height;
+    int cursor_row = -1;
+    int cursor_column = 0;
+    uint32_t drawn = 0;
+
+    if (!term->painted) {
+        memcpy(out, CLEAR, sizeof(CLEAR) - 1);
+        out += sizeof(CLEAR) - 1;
+        old = blank_rows;
+        cursor_row = 0;
+        changed_rows = ALL_ROWS;
+    }
+
+    for (int row = 0; row < rows; ++row) {
+        uint32_t cell_rows = ((1u << term->cell_height) - 1) << row * term->cell_height;
+        if (!(changed_rows & cell_rows)) {
+            continue;
+        }
+        bool changed = false;
+        for (int dy = 0; dy < term->cell_height; ++dy) {
+            int y = row * term->cell_height + dy;
+            changed |= old[y] != screen->rows[y];
+        }
+        if (!changed) {
+            continue;
+        }
+        drawn |= cell_rows;
+
+        for (int column = 0; column < columns; ++column) {
+            int pattern = cell_pattern(term, screen->rows, row, column);
+            if (pattern == cell_pattern(term, old, row, column)) {
+                continue;
+            }
+            if (row != cursor_row || column != cursor_column) {
+                out = move_cursor(term, out, screen->rows, row, column, cursor_row, cursor_column);
+            }
+            out = put_glyph(out, term->glyphs, pattern);
+            cursor_row = row;
+            cursor_column = column + 1;
+        }
+    }
+
+    // Rows outside the mask may differ from what the terminal shows.
+    for (int y = 0; y < SCREEN_HEIGHT_PX; ++y) {
+        if (drawn >> y & 1) {
+            term->rows[y] = screen->rows[y];
+        }
+    }
+    if (!term->painted) {
+        memcpy(term->rows, screen->rows, sizeof(term->rows));
+    }
+    term->painted = true;
+    term->length = out - term->buffer;
+    return term->length;
+}
+
+void term_bell(struct term_renderer *term) {
+    term->buffer[term->length++] = '\a';
+}
+
+bool term_flush(struct term_renderer *term, int fd) {
+    size_t written = 0;
+
+    while (written < term->length) {
+        ssize_t result = write(fd, term->buffer + written, term->length - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            term->length = 0;
+            return false;
+        }
+        written += result;
+    }
+    term->length = 0;
+    return true;
+}
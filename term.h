@@ -0,0 +1,67 @@
+#ifndef TERM_H
+#define TERM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "screen.h"
+
+/*
+ * Text-mode rendering of the framebuffer for ANSI terminals. Each
+ * character cell shows 1x2 pixels with half blocks (64x16 cells) or 2x4
+ * pixels with braille patterns (32x8 cells).
+ *
+ * term_render() compares the screen with the last one rendered and
+ * writes escape sequences only for the cells that changed: a cursor
+ * move where the changed cells aren't contiguous (or reprinting the
+ * cells in between, when that's shorter), then the new glyphs. The
+ * first render clears the terminal. The output for a frame is collected
+ * in `buffer` so it goes out in one write().
+ */
+
+enum term_glyphs {
+    TERM_HALF_BLOCKS,
+    TERM_BRAILLE
+};
+
+// Enough for every cell of a frame with a cursor move before each, and a bell.
+#define TERM_BUFFER_SIZE 16384
+
+struct term_renderer {
+    enum term_glyphs glyphs;
+    int cell_width;
+    int cell_height;
+    uint64_t rows[SCREEN_HEIGHT_PX];    // the screen the terminal shows
+    bool painted;
+    size_t length;
+    char buffer[TERM_BUFFER_SIZE];
+};
+
+void term_init(struct term_renderer *term, enum term_glyphs glyphs);
+
+/*
+ * Makes the next term_render() clear and repaint everything, e.g. after
+ * the terminal was resized or another program wrote to it.
+ */
+void term_invalidate(struct term_renderer *term);
+
+/*
+ * Puts the output that brings the terminal from the last rendered
+ * screen to `screen` in term->buffer. Only the pixel rows in
+ * `changed_rows` (see screen_present()) are compared, unless the
+ * terminal is being repainted. Returns the output's length, 0 if
+ * nothing changed.
+ */
+size_t term_render(struct term_renderer *term, const struct screen *screen, uint32_t changed_rows);
+
+/*
+ * Adds a bell to the pending output.
+ */
+void term_bell(struct term_renderer *term);
+
+/*
+ * Writes the buffered output to `fd`. Returns false on a write error.
+ */
+bool term_flush(struct term_renderer *term, int fd);
+
+#endif
@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "machine.h"
+#include "instructions.h"
+#include "romdb.h"
+#include "screen.h"
+#include "term.h"
+#include "eventlog.h"
+#include "telemetry.h"
+
+/*
+ * Text-mode frontend: runs a ROM in the terminal it's started from,
+ * for SSH sessions and machines without a display. Nothing here links
+ * against SDL.
+ *
+ * Terminals report key presses but not releases, so a hex key counts
+ * as held for KEY_HOLD_FRAMES after its last character; keyboard
+ * auto-repeat keeps it down while it's held. The keymap is the SDL
+ * frontend's default, or the ROM's from the database. Esc or Ctrl-C
+ * quits. Diagnostics go to stderr; redirect it to keep them off the
+ * screen.
+ */
+
+#define DEFAULT_KEYMAP "n567tyughjbm8ik,"
+#define KEY_HOLD_FRAMES 8
+#define FRAME_NS (1000000000ull / 60)
+#define MAX_LAG_FRAMES 4
+
+static struct termios saved_termios;
+static bool raw_mode;
+static volatile sig_atomic_t quit;
+static volatile sig_atomic_t repaint;
+static struct event_log events;
+
+void print_usage(void) {
+    puts("Usage: termchip8 [options] path/to/rom");
+    puts("  -q profile  quirk profile: default, chip8, schip or xochip");
+    puts("  -c cycles   instructions per 60 Hz frame");
+    puts("  -d romdb    ROM database (default $" ROMDB_ENV " or " ROMDB_DEFAULT_FILE ")");
+    puts("  -b          draw with braille patterns (2x4 pixels per cell)");
+}
+
+static void on_signal(int signal) {
+    if (signal == SIGWINCH || signal == SIGCONT) {
+        repaint = 1;
+    } else {
+        quit = 1;
+    }
+}
+
+static void restore_terminal(void) {
+    if (raw_mode) {
+        // Show the cursor again, below the display.
+        printf("\x1b[%d;1H\x1b[?25h\n", SCREEN_HEIGHT_PX / 2 + 1);
+        fflush(stdout);
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+        raw_mode = false;
+    }
+}
+
+static void enter_raw_mode(void) {
+    struct termios raw;
+
+    if (tcgetattr(STDIN_FILENO, &saved_termios) != 0) {
+        return;
+    }
+    raw = saved_termios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0) {
+        raw_mode = true;
+        fputs("\x1b[?25l", stdout);
+        fflush(stdout);
+        atexit(restore_terminal);
+    }
+}
+
+static void close_events(void) {
+    event_log_close(&events);
+}
+
+/*
+ * Reads the characters typed since the last frame and returns the keys
+ * still held.
+ */
+static uint16_t read_keys(const char *keymap, uint8_t held[16]) {
+    char input[64];
+    uint16_t keypad = 0;
+    ssize_t length = read(STDIN_FILENO, input, sizeof(input));
+
+    for (ssize_t i = 0; i < length; ++i) {
+        if (input[i] == 0x1b) {
+            // A lone Esc quits; anything after it is an escape sequence.
+            if (i + 1 == length) {
+                quit = 1;
+            }
+            break;
+        }
+        const char *key = strchr(keymap, input[i]);
+        if (input[i] && key) {
+            held[key - keymap] = KEY_HOLD_FRAMES;
+        }
+    }
+    for (int hex_key = 0; hex_key < 16; ++hex_key) {
+        if (held[hex_key]) {
+            --held[hex_key];
+            keypad |= 1 << hex_key;
+        }
+    }
+    return keypad;
+}
+
+static void sleep_until(uint64_t deadline) {
+    struct timespec until = { deadline / 1000000000ull, deadline % 1000000000ull };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) != 0 && !quit) {
+    }
+}
+
+int main(int argc, char *argv[]) {
+    enum quirk_profile profile = PROFILE_DEFAULT;
+    bool profile_set = false;
+    int cycles_per_frame = 0;
+    const char *romdb_filename = getenv(ROMDB_ENV);
+    enum term_glyphs glyphs = TERM_HALF_BLOCKS;
+    char keymap[KEYMAP_LEN + 1] = DEFAULT_KEYMAP;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q:c:d:b")) != -1) {
+        switch (opt) {
+            case 'q':
+                if (!parse_profile(optarg, &profile)) {
+                    printf("Unknown quirk profile %s.\n", optarg);
+                    exit(1);
+                }
+                profile_set = true;
+                break;
+            case 'c':
+                cycles_per_frame = atoi(optarg);
+                break;
+            case 'd':
+                romdb_filename = optarg;
+                break;
+            case 'b':
+                glyphs = TERM_BRAILLE;
+                break;
+            default:
+                print_usage();
+                exit(1);
+        }
+    }
+    if (optind >= argc) {
+        print_usage();
+        exit(0);
+    }
+
+    struct chip8 vm;
+    struct romdb db;
+    static struct term_renderer term;
+    struct screen_view view;
+    uint8_t held[16] = { 0 };
+
+    vm_init_with_rom(&vm, argv[optind]);
+    if (romdb_load(&db, romdb_filename ? romdb_filename : ROMDB_DEFAULT_FILE)) {
+        const struct rom_info *info = romdb_lookup(&db, vm.rom_hash);
+        if (info) {
+            vm_apply_rom_info(&vm, info);
+            if (info->keymap[0]) {
+                memcpy(keymap, info->keymap, sizeof(keymap));
+            }
+        }
+        romdb_free(&db);
+    }
+    if (profile_set) {
+        vm.profile = profile;
+    }
+    if (cycles_per_frame > 0) {
+        vm.cycles_per_frame = cycles_per_frame;
+    }
+    vm_seed_random(&vm, time(NULL));
+
+    if (event_log_open(&events, stderr, EVENT_LOG_DEFAULT_CAPACITY, EVENT_LOG_DEFAULT_RATE)) {
+        vm.events = &events;
+        atexit(close_events);
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGWINCH, on_signal);
+    signal(SIGCONT, on_signal);
+    enter_raw_mode();
+    term_init(&term, glyphs);
+    screen_view_init(&view);
+
+    uint64_t deadline = telemetry_now();
+    while (!quit) {
+        uint8_t old_st = vm.reg_st;
+        uint16_t pc = vm.pc;
+
+        vm_set_keypad(&vm, read_keys(keymap, held));
+        // One at a time, to know which instruction failed.
+        for (int i = 0; i < vm.cycles_per_frame && !vm.error && !vm.awaiting_input; ++i) {
+            pc = vm.pc;
+            run_cycles(&vm, 1);
+        }
+        vm_end_frame(&vm);
+        if (vm.error) {
+            vm_report(&vm, EVENT_ERROR, pc, vm_read(&vm, pc) << 8 | vm_read(&vm, pc + 1));
+            break;
+        }
+
+        if (repaint) {
+            repaint = 0;
+            term_invalidate(&term);
+        }
+        uint32_t changed_rows = screen_present(&vm.screen, &view);
+        if (changed_rows || !term.painted) {
+            term_render(&term, &vm.screen, changed_rows);
+        }
+        if (vm.reg_st > 0 && old_st == 0) {
+            term_bell(&term);
+        }
+        if (!term_flush(&term, STDOUT_FILENO)) {
+            break;
+        }
+
+        deadline += FRAME_NS;
+        uint64_t now = telemetry_now();
+        if (now > deadline + MAX_LAG_FRAMES * FRAME_NS) {
+            deadline = now;
+        }
+        sleep_until(deadline);
+    }
+
+    restore_terminal();
+    vm_release(&vm);
+    return vm.error;
+}
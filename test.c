@@ -2,9 +2,44 @@
 #include <time.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
 #include "CuTest.h"
 #include "machine.h"
 #include "instructions.h"
+#include "movie.h"
+#include "romdb.h"
+#include "corpus.h"
+#include "batch.h"
+#include "env.h"
+#include "framering.h"
+#include "cfg.h"
+#include "native.h"
+#include "disasm.h"
+#include "debug.h"
+#include "trace.h"
+#include "telemetry.h"
+#include "perfctr.h"
+#include "eventlog.h"
+#include "term.h"
+#include "phosphor.h"
+#include "screen.h"
+
+/*
+ * Gives a hand-built test VM RAM holding just the font, leaving the
+ * rest of its state alone.
+ */
+void attach_empty_image(struct chip8 *vm) {
+    uint8_t none = 0;
+
+    vm->image = rom_image_create(&none, 0);
+    for (int i = 0; i < RAM_PAGE_COUNT; ++i) {
+        vm->pages[i] = &vm->image->ram[i * RAM_PAGE_SIZE];
+    }
+    vm->private_pages = 0;
+    vm->owned_pages = 0;
+    vm->ram_hash = vm->image->ram_hash;
+}
 
 void test_ret(CuTest* tc) {
     struct chip8 vm = { .pc = 0x255, .sp = 1 };
@@ -374,51 +409,56 @@ void test_ld_f_vx(CuTest* tc) {
 
 void test_ld_b_vx(CuTest* tc) {
     struct chip8 vm = { .reg_i = 100 };
+    attach_empty_image(&vm);
 
     vm.reg_v[0xA] = 240;
     run_ld_b_vx(&vm, 0xFA33);
-    CuAssertIntEquals(tc, 2, vm.ram[100]);
-    CuAssertIntEquals(tc, 4, vm.ram[101]);
-    CuAssertIntEquals(tc, 0, vm.ram[102]);
+    CuAssertIntEquals(tc, 2, vm_read(&vm, 100));
+    CuAssertIntEquals(tc, 4, vm_read(&vm, 101));
+    CuAssertIntEquals(tc, 0, vm_read(&vm, 102));
 
     vm.reg_v[0xA] = 91;
     run_ld_b_vx(&vm, 0xFA33);
-    CuAssertIntEquals(tc, 0, vm.ram[100]);
-    CuAssertIntEquals(tc, 9, vm.ram[101]);
-    CuAssertIntEquals(tc, 1, vm.ram[102]);
+    CuAssertIntEquals(tc, 0, vm_read(&vm, 100));
+    CuAssertIntEquals(tc, 9, vm_read(&vm, 101));
+    CuAssertIntEquals(tc, 1, vm_read(&vm, 102));
 
     vm.reg_v[0xA] = 6;
     run_ld_b_vx(&vm, 0xFA33);
-    CuAssertIntEquals(tc, 0, vm.ram[100]);
-    CuAssertIntEquals(tc, 0, vm.ram[101]);
-    CuAssertIntEquals(tc, 6, vm.ram[102]);
+    CuAssertIntEquals(tc, 0, vm_read(&vm, 100));
+    CuAssertIntEquals(tc, 0, vm_read(&vm, 101));
+    CuAssertIntEquals(tc, 6, vm_read(&vm, 102));
+    vm_release(&vm);
 }
 
 void test_ld_i_vx(CuTest* tc) {
     struct chip8 vm = { .reg_i = 100 };
+    attach_empty_image(&vm);
     for (int i = 0; i < 16; ++i) {
         vm.reg_v[i] = i + 1;
     }
 
     run_ld_i_vx(&vm, 0xF555);
-    CuAssertIntEquals(tc, 1, vm.ram[100]);
-    CuAssertIntEquals(tc, 2, vm.ram[101]);
-    CuAssertIntEquals(tc, 3, vm.ram[102]);
-    CuAssertIntEquals(tc, 4, vm.ram[103]);
-    CuAssertIntEquals(tc, 5, vm.ram[104]);
-    CuAssertIntEquals(tc, 6, vm.ram[105]);
-    CuAssertIntEquals(tc, 0, vm.ram[106]);
+    CuAssertIntEquals(tc, 1, vm_read(&vm, 100));
+    CuAssertIntEquals(tc, 2, vm_read(&vm, 101));
+    CuAssertIntEquals(tc, 3, vm_read(&vm, 102));
+    CuAssertIntEquals(tc, 4, vm_read(&vm, 103));
+    CuAssertIntEquals(tc, 5, vm_read(&vm, 104));
+    CuAssertIntEquals(tc, 6, vm_read(&vm, 105));
+    CuAssertIntEquals(tc, 0, vm_read(&vm, 106));
 
     run_ld_i_vx(&vm, 0xFF55);
     for (int j = 0; j < 16; ++j) {
-        CuAssertIntEquals(tc, j+1, vm.ram[100 + j]);
+        CuAssertIntEquals(tc, j+1, vm_read(&vm, 100 + j));
     }
+    vm_release(&vm);
 }
 
 void test_ld_vx_i(CuTest* tc) {
     struct chip8 vm = { .reg_i = 100 };
+    attach_empty_image(&vm);
     for (int i = 0; i < 16; ++i) {
-        vm.ram[100 + i] = i + 1;
+        vm_write(&vm, 100 + i, i + 1);
     }
 
     run_ld_vx_i(&vm, 0xF565);
@@ -434,6 +474,1083 @@ void test_ld_vx_i(CuTest* tc) {
     for (int j = 0; j < 16; ++j) {
         CuAssertIntEquals(tc, j+1, vm.reg_v[j]);
     }
+    vm_release(&vm);
+}
+
+#define TEST_MOVIE_FILE "test_movie.c8m"
+
+void draw_test_frame(struct screen *screen, int frame) {
+    clear_screen(screen);
+    for (int i = 0; i <= frame; ++i) {
+        xor_pixel(screen, i * 7, i * 3, 1);
+    }
+}
+
+void assert_screens_equal(CuTest *tc, const struct screen *expected, const struct screen *actual) {
+    for (int y = 0; y < SCREEN_HEIGHT_PX; ++y) {
+        for (int x = 0; x < SCREEN_WIDTH_PX; ++x) {
+            CuAssertIntEquals(tc, get_pixel(expected, x, y), get_pixel(actual, x, y));
+        }
+    }
+}
+
+void test_movie_seek(CuTest *tc) {
+    struct movie_writer writer;
+    struct movie_reader reader;
+    struct screen expected, actual;
+    int frames[] = { 9, 0, 3, 4, 5, 11, 2 };
+
+    CuAssertTrue(tc, movie_writer_open(&writer, TEST_MOVIE_FILE, 4));
+    for (int frame = 0; frame < 12; ++frame) {
+        draw_test_frame(&expected, frame);
+        movie_write_frame(&writer, &expected);
+    }
+    movie_writer_close(&writer);
+
+    CuAssertTrue(tc, movie_reader_open(&reader, TEST_MOVIE_FILE));
+    CuAssertIntEquals(tc, 12, reader.frame_count);
+    CuAssertIntEquals(tc, 3, reader.keyframe_count);
+    for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); ++i) {
+        draw_test_frame(&expected, frames[i]);
+        CuAssertTrue(tc, movie_seek(&reader, frames[i], &actual));
+        assert_screens_equal(tc, &expected, &actual);
+    }
+    CuAssertTrue(tc, !movie_seek(&reader, 12, &actual));
+    movie_reader_close(&reader);
+    remove(TEST_MOVIE_FILE);
+}
+
+void test_movie_without_index(CuTest *tc) {
+    struct movie_writer writer;
+    struct movie_reader reader;
+    struct screen expected, actual;
+
+    CuAssertTrue(tc, movie_writer_open(&writer, TEST_MOVIE_FILE, 3));
+    for (int frame = 0; frame < 7; ++frame) {
+        draw_test_frame(&expected, frame);
+        movie_write_frame(&writer, &expected);
+    }
+    // Simulate a crash: the index and trailer are never written.
+    fclose(writer.fp);
+    free(writer.keyframes);
+
+    CuAssertTrue(tc, movie_reader_open(&reader, TEST_MOVIE_FILE));
+    CuAssertIntEquals(tc, 7, reader.frame_count);
+    CuAssertIntEquals(tc, 3, reader.keyframe_count);
+    CuAssertTrue(tc, movie_seek(&reader, 6, &actual));
+    assert_screens_equal(tc, &expected, &actual);
+    movie_reader_close(&reader);
+    remove(TEST_MOVIE_FILE);
+}
+
+void test_memory_access_out_of_bounds(CuTest* tc) {
+    struct chip8 vm = { .reg_i = RAM_SIZE - 2 };
+    attach_empty_image(&vm);
+
+    run_ld_i_vx(&vm, 0xF255);
+    CuAssertIntEquals(tc, ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS, vm.error);
+
+    vm.error = NO_ERROR;
+    run_ld_vx_i(&vm, 0xF165);
+    CuAssertIntEquals(tc, NO_ERROR, vm.error);
+
+    run_ld_b_vx(&vm, 0xF033);
+    CuAssertIntEquals(tc, ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS, vm.error);
+
+    vm.error = NO_ERROR;
+    run_drw_vx_vy_n(&vm, 0xD013);
+    CuAssertIntEquals(tc, ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS, vm.error);
+    vm_release(&vm);
+}
+
+void test_skp_vx(CuTest* tc) {
+    struct chip8 vm = { .pc = 0x220, .keypad = 1 << 0xA };
+    vm.reg_v[0] = 0xA;
+    vm.reg_v[1] = 0xB;
+
+    run_skp_vx(&vm, 0xE09E);
+    CuAssertIntEquals(tc, 0x222, vm.pc);
+
+    run_skp_vx(&vm, 0xE19E);
+    CuAssertIntEquals(tc, 0x222, vm.pc);
+
+    run_sknp_vx(&vm, 0xE1A1);
+    CuAssertIntEquals(tc, 0x224, vm.pc);
+}
+
+void test_profile_shift_source(CuTest* tc) {
+    struct chip8 vm;
+    vm.reg_v[0xA] = 0b00000010;
+    vm.reg_v[0xB] = 0b10000001;
+
+    run_instruction_with_profile(&vm, PROFILE_SCHIP, 0x8AB6);
+    CuAssertIntEquals(tc, 0b00000001, vm.reg_v[0xA]);
+    CuAssertIntEquals(tc, 0, vm.reg_v[0xF]);
+
+    run_instruction_with_profile(&vm, PROFILE_CHIP8, 0x8AB6);
+    CuAssertIntEquals(tc, 0b01000000, vm.reg_v[0xA]);
+    CuAssertIntEquals(tc, 1, vm.reg_v[0xF]);
+
+    run_instruction_with_profile(&vm, PROFILE_XOCHIP, 0x8ABE);
+    CuAssertIntEquals(tc, 0b00000010, vm.reg_v[0xA]);
+    CuAssertIntEquals(tc, 1, vm.reg_v[0xF]);
+}
+
+void test_profile_flag_order(CuTest* tc) {
+    struct chip8 vm;
+
+    vm.reg_v[0xF] = 200;
+    vm.reg_v[1] = 100;
+    run_instruction_with_profile(&vm, PROFILE_DEFAULT, 0x8F14);
+    CuAssertIntEquals(tc, 44, vm.reg_v[0xF]);
+
+    vm.reg_v[0xF] = 200;
+    run_instruction_with_profile(&vm, PROFILE_CHIP8, 0x8F14);
+    CuAssertIntEquals(tc, 1, vm.reg_v[0xF]);
+
+    vm.reg_v[2] = 7;
+    vm.reg_v[3] = 7;
+    run_instruction_with_profile(&vm, PROFILE_DEFAULT, 0x8235);
+    CuAssertIntEquals(tc, 0, vm.reg_v[0xF]);
+    vm.reg_v[2] = 7;
+    run_instruction_with_profile(&vm, PROFILE_SCHIP, 0x8235);
+    CuAssertIntEquals(tc, 1, vm.reg_v[0xF]);
+
+    vm.reg_v[0xF] = 1;
+    run_instruction_with_profile(&vm, PROFILE_CHIP8, 0x8231);
+    CuAssertIntEquals(tc, 0, vm.reg_v[0xF]);
+}
+
+void test_profile_load_store_increment(CuTest* tc) {
+    struct chip8 vm = { .reg_i = 100 };
+    attach_empty_image(&vm);
+
+    run_instruction_with_profile(&vm, PROFILE_SCHIP, 0xF355);
+    CuAssertIntEquals(tc, 100, vm.reg_i);
+
+    run_instruction_with_profile(&vm, PROFILE_CHIP8, 0xF355);
+    CuAssertIntEquals(tc, 104, vm.reg_i);
+
+    run_instruction_with_profile(&vm, PROFILE_XOCHIP, 0xF165);
+    CuAssertIntEquals(tc, 106, vm.reg_i);
+    vm_release(&vm);
+}
+
+void test_profile_jump_offset(CuTest* tc) {
+    struct chip8 vm;
+    vm.reg_v[0] = 0x10;
+    vm.reg_v[3] = 0x20;
+
+    run_instruction_with_profile(&vm, PROFILE_CHIP8, 0xB300);
+    CuAssertIntEquals(tc, 0x310, vm.pc);
+
+    run_instruction_with_profile(&vm, PROFILE_SCHIP, 0xB300);
+    CuAssertIntEquals(tc, 0x320, vm.pc);
+}
+
+void test_profile_sprite_clipping(CuTest* tc) {
+    struct chip8 vm = { .reg_i = 0x300 };
+    attach_empty_image(&vm);
+    vm_write(&vm, 0x300, 0xFF);
+    vm_write(&vm, 0x301, 0xFF);
+    vm.reg_v[0] = SCREEN_WIDTH_PX - 4;
+    vm.reg_v[1] = SCREEN_HEIGHT_PX - 1;
+
+    clear_screen(&vm.screen);
+    run_instruction_with_profile(&vm, PROFILE_DEFAULT, 0xD012);
+    CuAssertTrue(tc, get_pixel(&vm.screen, 0, 0));
+    CuAssertTrue(tc, get_pixel(&vm.screen, 3, 31));
+
+    clear_screen(&vm.screen);
+    run_instruction_with_profile(&vm, PROFILE_SCHIP, 0xD012);
+    CuAssertTrue(tc, !get_pixel(&vm.screen, 0, 0));
+    CuAssertTrue(tc, !get_pixel(&vm.screen, 3, 31));
+    CuAssertTrue(tc, get_pixel(&vm.screen, 63, 31));
+    vm_release(&vm);
+}
+
+void test_set_keypad_receives_input(CuTest* tc) {
+    struct chip8 vm = { .keypad = 1 << 2 };
+
+    run_ld_vx_k(&vm, 0xF30A);
+    vm_set_keypad(&vm, 1 << 2);
+    CuAssertTrue(tc, vm.awaiting_input);
+
+    vm_set_keypad(&vm, 1 << 2 | 1 << 9 | 1 << 0xC);
+    CuAssertTrue(tc, !vm.awaiting_input);
+    CuAssertIntEquals(tc, 9, vm.reg_v[3]);
+}
+
+void test_run_frame(CuTest* tc) {
+    struct chip8 vm;
+    uint8_t program[] = { 0x60, 0x05, 0x70, 0x01, 0x12, 0x02 };
+    vm_init_with_image(&vm, program, sizeof(program));
+    vm.reg_dt = 5;
+
+    CuAssertIntEquals(tc, NO_ERROR, vm_run_frame(&vm));
+    CuAssertIntEquals(tc, 6, vm.reg_v[0]);
+    CuAssertIntEquals(tc, 0x204, vm.pc);
+    CuAssertTrue(tc, vm.reg_dt < 5);
+
+    vm.prog_mem_end = PROG_MEM_START + 4;
+    CuAssertIntEquals(tc, ERROR_OUT_OF_BOUNDS_MEMORY_ACCESS, vm_run_frame(&vm));
+    vm_release(&vm);
+}
+
+void test_hash_screen(CuTest* tc) {
+    struct screen a, b;
+
+    draw_test_frame(&a, 5);
+    draw_test_frame(&b, 5);
+    CuAssertTrue(tc, hash_screen(&a) == hash_screen(&b));
+
+    xor_pixel(&b, 63, 31, 1);
+    CuAssertTrue(tc, hash_screen(&a) != hash_screen(&b));
+
+    xor_pixel(&b, 63, 31, 1);
+    CuAssertTrue(tc, hash_screen(&a) == hash_screen(&b));
+}
+
+#define TEST_ROMDB_FILE "test_romdb.txt"
+
+void test_hash_rom(CuTest* tc) {
+    CuAssertTrue(tc, hash_rom((const uint8_t *) "a", 1) == 0xaf63dc4c8601ec8cu);
+    CuAssertTrue(tc, hash_rom(NULL, 0) == 0xcbf29ce484222325u);
+}
+
+void test_romdb_lookup(CuTest* tc) {
+    struct romdb db;
+    struct chip8 vm = { .cycles_per_frame = DEFAULT_CYCLES_PER_FRAME };
+    FILE *fp = fopen(TEST_ROMDB_FILE, "w");
+    fputs("# hash profile cycles keymap\n", fp);
+    fputs("00000000000000ff schip 15 x123qweasdzc4rfv\n", fp);
+    fputs("0000000000000010 chip8 9\n", fp);
+    fputs("0000000000000020 nosuchprofile 9\n", fp);
+    fclose(fp);
+
+    CuAssertTrue(tc, romdb_load(&db, TEST_ROMDB_FILE));
+    CuAssertIntEquals(tc, 2, db.count);
+    CuAssertPtrEquals(tc, NULL, (void *) romdb_lookup(&db, 0x20));
+
+    const struct rom_info *info = romdb_lookup(&db, 0xff);
+    CuAssertPtrNotNull(tc, info);
+    CuAssertStrEquals(tc, "x123qweasdzc4rfv", info->keymap);
+    vm_apply_rom_info(&vm, info);
+    CuAssertIntEquals(tc, PROFILE_SCHIP, vm.profile);
+    CuAssertIntEquals(tc, 15, vm.cycles_per_frame);
+
+    info = romdb_lookup(&db, 0x10);
+    CuAssertPtrNotNull(tc, info);
+    CuAssertStrEquals(tc, "", info->keymap);
+
+    romdb_free(&db);
+    remove(TEST_ROMDB_FILE);
+}
+
+#define TEST_CORPUS_FILE "test_corpus.c8a"
+
+void test_corpus_lookup(CuTest* tc) {
+    uint8_t pong[] = { 0x6A, 0x02, 0x6B, 0x0C };
+    uint8_t maze[] = { 0xA2, 0x1E, 0xC2, 0x01, 0x32, 0x01 };
+    struct corpus_rom roms[] = {
+        { "pong.ch8", hash_rom(pong, sizeof(pong)), pong, sizeof(pong) },
+        { "maze.ch8", hash_rom(maze, sizeof(maze)), maze, sizeof(maze) }
+    };
+    struct corpus corpus;
+    struct corpus_rom rom;
+    struct chip8 vm;
+
+    CuAssertTrue(tc, corpus_write(TEST_CORPUS_FILE, roms, 2));
+    CuAssertTrue(tc, corpus_open(&corpus, TEST_CORPUS_FILE));
+    CuAssertIntEquals(tc, 2, corpus.count);
+    CuAssertTrue(tc, !corpus_get(&corpus, 2, &rom));
+    CuAssertTrue(tc, !corpus_find(&corpus, 0, &rom));
+
+    CuAssertTrue(tc, corpus_find(&corpus, hash_rom(maze, sizeof(maze)), &rom));
+    CuAssertStrEquals(tc, "maze.ch8", rom.name);
+    CuAssertIntEquals(tc, sizeof(maze), rom.size);
+
+    vm_init_with_image(&vm, rom.data, rom.size);
+    CuAssertTrue(tc, vm.rom_hash == rom.hash);
+    CuAssertIntEquals(tc, PROG_MEM_START + sizeof(maze), vm.prog_mem_end);
+    CuAssertIntEquals(tc, 0x32, vm_read(&vm, PROG_MEM_START + 4));
+    vm_release(&vm);
+    corpus_close(&corpus);
+
+    // A truncated archive is rejected rather than read past its end.
+    CuAssertTrue(tc, truncate(TEST_CORPUS_FILE, 40) == 0);
+    CuAssertTrue(tc, !corpus_open(&corpus, TEST_CORPUS_FILE));
+    remove(TEST_CORPUS_FILE);
+}
+
+void test_shared_pages_copy_on_write(CuTest* tc) {
+    uint8_t program[] = { 0x60, 0x07, 0xA3, 0x00, 0xF0, 0x55, 0x12, 0x06 };
+    struct rom_image *image = rom_image_create(program, sizeof(program));
+    struct chip8 a, b;
+
+    vm_init_shared(&a, image);
+    vm_init_shared(&b, image);
+    rom_image_release(image);
+    CuAssertIntEquals(tc, 2, image->refs);
+    CuAssertPtrEquals(tc, a.pages[2], b.pages[2]);
+
+    run_cycles(&a, 3);
+    CuAssertIntEquals(tc, NO_ERROR, a.error);
+    CuAssertIntEquals(tc, 1 << 3, a.private_pages);
+    CuAssertIntEquals(tc, 1 << 3, a.owned_pages);
+    CuAssertIntEquals(tc, 7, vm_read(&a, 0x300));
+    CuAssertIntEquals(tc, 0, vm_read(&b, 0x300));
+    CuAssertIntEquals(tc, 0, image->ram[0x300]);
+    CuAssertIntEquals(tc, 0xF0, vm_read(&a, HEX_SPRITE_START_ADDR));
+
+    vm_release(&a);
+    CuAssertIntEquals(tc, 1, image->refs);
+    vm_release(&b);
+}
+
+void test_fork_shares_pages(CuTest* tc) {
+    uint8_t program[] = { 0xA3, 0x00, 0xF0, 0x55, 0x70, 0x01, 0x12, 0x02 };
+    struct chip8 parent, child, grandchild;
+
+    vm_init_with_image(&parent, program, sizeof(program));
+    run_cycles(&parent, 2);
+    CuAssertIntEquals(tc, 1 << 3, parent.owned_pages);
+
+    vm_fork(&child, &parent);
+    CuAssertIntEquals(tc, 2, parent.image->refs);
+    CuAssertPtrEquals(tc, parent.pages[3], child.pages[3]);
+    CuAssertIntEquals(tc, 0, parent.private_pages | child.private_pages);
+
+    run_cycles(&child, 3);
+    CuAssertTrue(tc, parent.pages[3] != child.pages[3]);
+    CuAssertIntEquals(tc, 1, vm_read(&child, 0x300));
+    CuAssertIntEquals(tc, 0, vm_read(&parent, 0x300));
+    CuAssertIntEquals(tc, 0, parent.reg_v[0]);
+
+    vm_fork(&grandchild, &child);
+    vm_release(&child);
+    CuAssertIntEquals(tc, 1, vm_read(&grandchild, 0x300));
+    run_cycles(&grandchild, 3);
+    CuAssertIntEquals(tc, 2, vm_read(&grandchild, 0x300));
+
+    vm_release(&grandchild);
+    vm_release(&parent);
+}
+
+void test_state_hash(CuTest* tc) {
+    uint8_t program[] = { 0x60, 0xF3, 0xA3, 0x00, 0xF0, 0x33, 0xD0, 0x03, 0x12, 0x08 };
+    struct chip8 a, b;
+
+    vm_init_with_image(&a, program, sizeof(program));
+    vm_init_with_image(&b, program, sizeof(program));
+    CuAssertTrue(tc, vm_state_hash(&a) == vm_state_hash(&b));
+
+    run_cycles(&a, 4);
+    CuAssertTrue(tc, vm_state_hash(&a) != vm_state_hash(&b));
+    CuAssertTrue(tc, a.ram_hash == vm_hash_ram(&a));
+    CuAssertTrue(tc, a.screen.pixel_hash == hash_pixels(&a.screen));
+
+    run_cycles(&b, 4);
+    CuAssertTrue(tc, vm_state_hash(&a) == vm_state_hash(&b));
+
+    vm_release(&b);
+    vm_fork(&b, &a);
+    CuAssertTrue(tc, vm_state_hash(&a) == vm_state_hash(&b));
+    vm_release(&a);
+    vm_release(&b);
+}
+
+void test_cycle_detector(CuTest* tc) {
+    uint64_t sequence[] = { 1, 2, 3, 4, 5, 6, 4, 5, 6, 4 };
+    struct cycle_detector detector;
+    uint32_t period = 0;
+    int steps = 0;
+
+    cycle_detector_reset(&detector, 0);
+    while (!period && steps < 10) {
+        period = cycle_detector_update(&detector, sequence[steps++]);
+    }
+    CuAssertIntEquals(tc, 3, period);
+
+    cycle_detector_reset(&detector, 7);
+    CuAssertIntEquals(tc, 1, cycle_detector_update(&detector, 7));
+}
+
+void test_batch_matches_independent_vms(CuTest* tc) {
+    uint8_t program[] = {
+        0x61, 0x05, 0xE1, 0xA1, 0x71, 0x01, 0x81, 0x14, 0xF1, 0x15, 0x12, 0x0A
+    };
+    struct rom_image *image = rom_image_create(program, sizeof(program));
+    struct batch batch;
+    struct chip8 vm;
+    size_t lanes = 40;
+
+    batch_init(&batch, image, lanes, PROFILE_DEFAULT);
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        batch_set_keypad(&batch, lane, lane % 3 ? 1 << 5 : 0);
+    }
+    for (int frame = 0; frame < 4; ++frame) {
+        batch_run_frame(&batch);
+    }
+
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        const struct chip8 *actual = batch_vm(&batch, lane);
+
+        vm_init_shared(&vm, image);
+        vm_set_keypad(&vm, lane % 3 ? 1 << 5 : 0);
+        for (int frame = 0; frame < 4; ++frame) {
+            vm_run_frame(&vm);
+        }
+        CuAssertIntEquals(tc, vm.pc, actual->pc);
+        CuAssertIntEquals(tc, vm.reg_v[1], actual->reg_v[1]);
+        CuAssertIntEquals(tc, vm.reg_v[0xF], actual->reg_v[0xF]);
+        CuAssertIntEquals(tc, vm.reg_dt, actual->reg_dt);
+        vm_release(&vm);
+    }
+
+    batch_free(&batch);
+    rom_image_release(image);
+}
+
+void test_step_batch(CuTest* tc) {
+    // Moves V0 right by 8 while key 0 is down, draws the 0 glyph at
+    // (V0, 0) and stores V0 as BCD at 0x300.
+    uint8_t program[] = {
+        0x00, 0xE0, 0xF2, 0x29, 0xE1, 0xA1, 0x70, 0x08, 0xD0, 0x15,
+        0xA3, 0x00, 0xF0, 0x33, 0x12, 0x0E
+    };
+    struct rom_image *image = rom_image_create(program, sizeof(program));
+    struct env env;
+    size_t handles[40];
+    uint16_t actions[40];
+    float rewards[40];
+    bool done[40];
+
+    env_init(&env, image, 40, 3);
+    rom_image_release(image);
+    env_add_watch(&env, 0x302, 1.f);
+    for (size_t i = 0; i < 40; ++i) {
+        env.vms[i].cycles_per_frame = 8;
+        handles[i] = 39 - i;
+        actions[i] = i % 2 ? 0 : 1;
+    }
+    uint8_t *obs = env_alloc_observations(40, OBS_PACKED);
+    CuAssertIntEquals(tc, 0, (uintptr_t) obs % ENV_ALIGNMENT);
+
+    step_batch(&env, handles, actions, 40, 1, obs, OBS_PACKED, rewards, done);
+    for (size_t i = 0; i < 40; ++i) {
+        const uint8_t *slot = obs + i * env_observation_size(OBS_PACKED);
+        CuAssertIntEquals(tc, i % 2 ? 0xF0 : 0, slot[0]);
+        CuAssertIntEquals(tc, i % 2 ? 0 : 0xF0, slot[1]);
+        CuAssertTrue(tc, rewards[i] == (i % 2 ? 0.f : 8.f));
+        CuAssertTrue(tc, !done[i]);
+    }
+    free(obs);
+
+    obs = env_alloc_observations(1, OBS_BYTES);
+    step_batch(&env, handles, actions, 1, 1, obs, OBS_BYTES, NULL, NULL);
+    CuAssertIntEquals(tc, 0, obs[0]);
+    CuAssertIntEquals(tc, 0xFF, obs[8]);
+    CuAssertIntEquals(tc, 0, obs[12]);
+    free(obs);
+
+    env_free(&env);
+}
+
+#define TEST_TRACE_FILE "test_trace.c8t"
+
+void test_trace_records_every_cycle(CuTest* tc) {
+    uint8_t program[] = { 0x60, 0x05, 0xA3, 0x00, 0xF0, 0x15, 0x70, 0x01, 0x12, 0x06 };
+    struct chip8 vm;
+    struct trace trace;
+    struct trace_reader reader;
+    struct trace_record record;
+    uint64_t count = 0;
+
+    vm_init_with_image(&vm, program, sizeof(program));
+    // A tiny ring makes the VM wait for the flush thread.
+    CuAssertTrue(tc, trace_open(&trace, TEST_TRACE_FILE, PROFILE_SCHIP, 3));
+    vm.trace = &trace;
+    CuAssertIntEquals(tc, 101, run_cycles(&vm, 101));
+    CuAssertTrue(tc, trace_close(&trace));
+    vm.trace = NULL;
+
+    CuAssertTrue(tc, trace_reader_open(&reader, TEST_TRACE_FILE));
+    CuAssertIntEquals(tc, PROFILE_SCHIP, reader.profile);
+    while (trace_read(&reader, &record)) {
+        CuAssertTrue(tc, reader.cycle == count);
+        CuAssertIntEquals(tc, 0, record.padding);
+        switch (count) {
+            case 0:
+                CuAssertIntEquals(tc, 0x6005, record.opcode);
+                CuAssertIntEquals(tc, 0, record.reg);
+                CuAssertIntEquals(tc, 5, record.value);
+                break;
+            case 1:
+                CuAssertIntEquals(tc, TRACE_I, record.reg);
+                CuAssertIntEquals(tc, 0x300, record.value);
+                break;
+            case 2:
+                CuAssertIntEquals(tc, TRACE_DT, record.reg);
+                break;
+            default:
+                CuAssertIntEquals(tc, count % 2 ? 0x206 : 0x208, record.pc);
+                CuAssertIntEquals(tc, count % 2 ? 0 : TRACE_NONE, record.reg);
+                if (count % 2) {
+                    CuAssertIntEquals(tc, (uint8_t) (5 + (count - 1) / 2), record.value);
+                }
+        }
+        ++count;
+    }
+    CuAssertTrue(tc, count == 101);
+
+    trace_reader_close(&reader);
+    vm_release(&vm);
+    remove(TEST_TRACE_FILE);
+}
+
+#define TEST_TELEMETRY_FILE "test_telemetry.jsonl"
+
+void test_telemetry_reports_per_interval(CuTest* tc) {
+    struct telemetry telemetry;
+    char line[512];
+
+    remove(TEST_TELEMETRY_FILE);
+    CuAssertTrue(tc, telemetry_open(&telemetry, TEST_TELEMETRY_FILE));
+    uint64_t start = telemetry.interval_start;
+    telemetry.instructions = 240;
+    telemetry.frames = 120;
+    telemetry.audio_underruns = 3;
+    telemetry_add(&telemetry, TELEMETRY_DRAW, 1500000);
+    telemetry_update(&telemetry, start + TELEMETRY_INTERVAL_NS / 2);
+    telemetry_update(&telemetry, start + 2 * TELEMETRY_INTERVAL_NS);
+    telemetry.audio_underruns = 4;
+    telemetry_update(&telemetry, start + 3 * TELEMETRY_INTERVAL_NS);
+    telemetry_close(&telemetry);
+
+    FILE *fp = fopen(TEST_TELEMETRY_FILE, "r");
+    CuAssertPtrNotNull(tc, fp);
+    CuAssertPtrNotNull(tc, fgets(line, sizeof(line), fp));
+    CuAssertPtrNotNull(tc, strstr(line, "\"seconds\":2.000,\"instructions_per_second\":120.0,"
+            "\"frames_per_second\":60.00,\"instructions_per_frame\":2.00,"));
+    CuAssertPtrNotNull(tc, strstr(line, "\"draw_ms\":1.500,"));
+    CuAssertPtrNotNull(tc, strstr(line, "\"audio_underruns\":3,\"input_latency_samples\":0,"));
+    CuAssertPtrNotNull(tc, fgets(line, sizeof(line), fp));
+    CuAssertPtrNotNull(tc, strstr(line, "\"instructions_per_second\":0.0,"));
+    CuAssertPtrNotNull(tc, strstr(line, "\"audio_underruns\":1,"));
+    CuAssertPtrEquals(tc, NULL, fgets(line, sizeof(line), fp));
+    fclose(fp);
+    remove(TEST_TELEMETRY_FILE);
+}
+
+void test_latency_percentiles(CuTest* tc) {
+    struct latency_histogram histogram = { { 0 }, 0 };
+
+    CuAssertTrue(tc, latency_percentile(&histogram, 0.5) == 0);
+    for (int i = 1; i <= 100; ++i) {
+        latency_record(&histogram, i * 1000000ull - 1);
+    }
+    latency_record(&histogram, 10000000000ull);
+    CuAssertIntEquals(tc, 101, histogram.samples);
+    CuAssertTrue(tc, latency_percentile(&histogram, 0.5) == 51000000);
+    CuAssertTrue(tc, latency_percentile(&histogram, 0.99) == 100000000);
+    CuAssertTrue(tc, latency_percentile(&histogram, 1) == LATENCY_BUCKETS * LATENCY_BUCKET_NS);
+}
+
+void test_input_latency_starts_when_key_read(CuTest* tc) {
+    uint8_t program[] = { 0x60, 0x05, 0x61, 0x03, 0xE1, 0x9E, 0xE0, 0x9E, 0xF2, 0x0A };
+    struct chip8 vm;
+
+    vm_init_with_image(&vm, program, sizeof(program));
+    vm_press_key(&vm, 5, 1234);
+    // Testing another key doesn't read the press.
+    run_cycles(&vm, 3);
+    CuAssertTrue(tc, vm.input_time == 1234);
+    CuAssertTrue(tc, vm.read_input_time == 0);
+
+    xor_pixel(&vm.screen, 0, 0, 1);
+    run_cycles(&vm, 1);
+    CuAssertTrue(tc, vm.input_time == 0);
+    CuAssertTrue(tc, vm.read_input_time == 1234);
+    CuAssertTrue(tc, vm.read_screen_hash == vm.screen.pixel_hash);
+
+    // Fx0A reads the key it receives.
+    vm.read_input_time = 0;
+    run_cycles(&vm, 1);
+    vm_press_key(&vm, 7, 5678);
+    vm_receive_input(&vm, 7);
+    CuAssertIntEquals(tc, 7, vm.reg_v[2]);
+    CuAssertTrue(tc, vm.read_input_time == 5678);
+    vm_release(&vm);
+}
+
+void test_perf_counters_degrade(CuTest* tc) {
+    struct perf_counters counters;
+    struct perf_sample before, after, delta;
+    volatile uint64_t sum = 0;
+
+    bool opened = perf_counters_open(&counters);
+    CuAssertTrue(tc, opened == (counters.open_count > 0));
+    perf_counters_read(&counters, &before);
+    for (int i = 0; i < 100000; ++i) {
+        sum += i;
+    }
+    perf_counters_read(&counters, &after);
+    perf_sample_delta(&before, &after, &delta);
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        CuAssertTrue(tc, delta.valid[i] == (counters.slots[i] >= 0));
+    }
+    if (delta.valid[PERF_INSTRUCTIONS]) {
+        CuAssertTrue(tc, delta.values[PERF_INSTRUCTIONS] >= 100000);
+    } else {
+        CuAssertTrue(tc, perf_ratio(&delta, PERF_INSTRUCTIONS, PERF_CYCLES) < 0);
+    }
+    perf_counters_close(&counters);
+}
+
+void test_event_log_rate_limits(CuTest* tc) {
+    uint8_t program[] = { 0x51, 0x21, 0x51, 0x22, 0x51, 0x23, 0x51, 0x24, 0x51, 0x25 };
+    struct event_log log;
+    struct chip8 vm;
+    char line[128];
+    FILE *out = tmpfile();
+
+    vm_init_with_image(&vm, program, sizeof(program));
+    CuAssertTrue(tc, event_log_open(&log, out, 16, 2));
+    vm.events = &log;
+    // Running off the end of the program is an error.
+    CuAssertIntEquals(tc, 5, run_cycles(&vm, 6));
+    CuAssertTrue(tc, vm.instructions == 4);
+    vm_report(&vm, EVENT_ERROR, 0x208, 0x5125);
+    event_log_close(&log);
+
+    rewind(out);
+    CuAssertTrue(tc, fgets(line, sizeof(line), out) != NULL);
+    CuAssertStrEquals(tc, "Skipping unknown instruction 5121 at 200 (cycle 0)\n", line);
+    CuAssertTrue(tc, fgets(line, sizeof(line), out) != NULL);
+    CuAssertStrEquals(tc, "Skipping unknown instruction 5122 at 202 (cycle 1)\n", line);
+    CuAssertTrue(tc, fgets(line, sizeof(line), out) != NULL);
+    CuAssertStrEquals(tc, "Error: Out of bounds memory access at 0208 (cycle 4)\n", line);
+    CuAssertTrue(tc, fgets(line, sizeof(line), out) != NULL);
+    CuAssertStrEquals(tc, "(3 more events suppressed)\n", line);
+    CuAssertTrue(tc, fgets(line, sizeof(line), out) != NULL);
+    CuAssertTrue(tc, log.counts[EVENT_UNKNOWN_INSTRUCTION] == 5);
+    CuAssertTrue(tc, log.counts[EVENT_ERROR] == 1);
+    fclose(out);
+    vm_release(&vm);
+
+    // With no writer draining it, unknown instructions leave the last
+    // slot for an error.
+    struct vm_event slots[4];
+    struct vm_event unknown = { 0, 0x200, 0x5121, EVENT_UNKNOWN_INSTRUCTION, 0, 0 };
+    struct vm_event error = { 0, 0x202, 0x00EE, EVENT_ERROR, ERROR_STACK_UNDERFLOW, 0 };
+    memset(&log, 0, sizeof(log));
+    log.events = slots;
+    log.mask = 3;
+    for (int i = 0; i < 4; ++i) {
+        CuAssertTrue(tc, event_log_push(&log, &unknown) == (i < 3));
+    }
+    CuAssertTrue(tc, event_log_push(&log, &error));
+    CuAssertTrue(tc, !event_log_push(&log, &error));
+    CuAssertTrue(tc, log.dropped == 1);
+}
+
+void test_term_renders_changed_cells(CuTest* tc) {
+    static struct term_renderer term;
+    struct screen screen;
+
+    clear_screen(&screen);
+    term_init(&term, TERM_HALF_BLOCKS);
+    CuAssertIntEquals(tc, 7, term_render(&term, &screen, ALL_ROWS));
+    CuAssertTrue(tc, memcmp(term.buffer, "\x1b[H\x1b[2J", 7) == 0);
+    CuAssertIntEquals(tc, 0, term_render(&term, &screen, ALL_ROWS));
+
+    // Pixels on the lower half of row 2, columns 10 and 14: one move,
+    // then the gap is cheaper to reprint than to skip.
+    xor_pixel(&screen, 10, 5, 1);
+    xor_pixel(&screen, 14, 5, 1);
+    term_render(&term, &screen, ALL_ROWS);
+    term.buffer[term.length] = '\0';
+    CuAssertStrEquals(tc, "\x1b[3;11H\xe2\x96\x84   \xe2\x96\x84", term.buffer);
+
+    // Completing the cell above turns it into a full block.
+    xor_pixel(&screen, 10, 4, 1);
+    term_render(&term, &screen, ALL_ROWS);
+    term.buffer[term.length] = '\0';
+    CuAssertStrEquals(tc, "\x1b[3;11H\xe2\x96\x88", term.buffer);
+
+    // Rows left out of the mask aren't looked at, nor taken as shown.
+    xor_pixel(&screen, 20, 9, 1);
+    CuAssertIntEquals(tc, 0, term_render(&term, &screen, 1u << 12));
+    CuAssertTrue(tc, term.rows[9] == 0);
+    xor_pixel(&screen, 20, 9, 1);
+
+    term_init(&term, TERM_BRAILLE);
+    term_render(&term, &screen, ALL_ROWS);
+    term.buffer[term.length] = '\0';
+    // x 10 and 14 are the left dots of cells 5 and 7, y 4 and 5 the
+    // top two dots of cell row 1.
+    CuAssertStrEquals(tc, "\x1b[H\x1b[2J\x1b[2;6H\xe2\xa0\x83 \xe2\xa0\x82", term.buffer);
+}
+
+void test_phosphor_fades_and_upscales(CuTest* tc) {
+    static struct phosphor scalar, vector;
+    static uint32_t pixels[SCREEN_HEIGHT_PX * 3][SCREEN_WIDTH_PX * 3];
+    struct screen screen;
+
+    clear_screen(&screen);
+    phosphor_init(&scalar, 128);
+    phosphor_init(&vector, 128);
+    scalar.use_avx2 = false;
+
+    xor_pixel(&screen, 0, 0, 1);
+    xor_pixel(&screen, 33, 7, 1);
+    xor_pixel(&screen, 63, 31, 1);
+    CuAssertTrue(tc, phosphor_update(&scalar, &screen, ALL_ROWS) == ALL_ROWS);
+    CuAssertTrue(tc, scalar.fading_rows == 0);
+    phosphor_update(&vector, &screen, ALL_ROWS);
+    CuAssertIntEquals(tc, 0xFF, scalar.intensity[7][33]);
+
+    // Erased pixels halve each frame until they're gone, updated while
+    // they fade even though the screen row only changed once.
+    xor_pixel(&screen, 33, 7, 1);
+    for (int frame = 1; frame <= 8; ++frame) {
+        uint32_t changed = frame == 1 ? 1u << 7 : 0;
+        CuAssertTrue(tc, phosphor_update(&scalar, &screen, changed) == 1u << 7);
+        CuAssertTrue(tc, scalar.fading_rows == (frame < 8 ? 1u << 7 : 0));
+        phosphor_update(&vector, &screen, changed);
+        CuAssertIntEquals(tc, 0xFF >> frame, scalar.intensity[7][33]);
+        CuAssertTrue(tc, memcmp(scalar.intensity, vector.intensity, sizeof(scalar.intensity)) == 0);
+    }
+    CuAssertTrue(tc, phosphor_update(&scalar, &screen, 0) == 0);
+    CuAssertIntEquals(tc, 0xFF, scalar.intensity[31][63]);
+
+    phosphor_upscale(&scalar, &pixels[0][0], sizeof(pixels[0]), 3, ALL_ROWS);
+    CuAssertTrue(tc, pixels[2][2] == 0xFFFFFFFFu);
+    CuAssertTrue(tc, pixels[2][3] == 0xFF000000u);
+    CuAssertTrue(tc, pixels[95][191] == 0xFFFFFFFFu);
+
+    // A band of rows goes at the top of the buffer.
+    memset(pixels, 0, sizeof(pixels));
+    phosphor_upscale(&scalar, &pixels[0][0], sizeof(pixels[0]), 3, 1u << 30 | 1u << 31);
+    CuAssertTrue(tc, pixels[5][191] == 0xFFFFFFFFu);
+    CuAssertTrue(tc, pixels[6][0] == 0);
+}
+
+void test_screen_present_skips_erased_sprites(CuTest* tc) {
+    struct screen screen;
+    struct screen_view view;
+
+    clear_screen(&screen);
+    screen_view_init(&view);
+    CuAssertTrue(tc, screen_present(&screen, &view) == ALL_ROWS);
+    CuAssertTrue(tc, screen_present(&screen, &view) == 0);
+
+    // Drawn and erased before the frame boundary: nothing to present.
+    xor_pixel(&screen, 3, 7, 1);
+    xor_pixel(&screen, 3, 7, 1);
+    CuAssertTrue(tc, screen.dirty_rows == 1u << 7);
+    CuAssertTrue(tc, screen_present(&screen, &view) == 0);
+    CuAssertTrue(tc, screen.dirty_rows == 0);
+
+    xor_pixel(&screen, 3, 7, 1);
+    xor_pixel(&screen, 60, 31, 1);
+    CuAssertTrue(tc, screen_present(&screen, &view) == (1u << 7 | 1u << 31));
+    CuAssertTrue(tc, memcmp(view.rows, screen.rows, sizeof(view.rows)) == 0);
+
+    // Clearing marks every row, but only the lit ones differ.
+    clear_screen(&screen);
+    CuAssertTrue(tc, screen_present(&screen, &view) == (1u << 7 | 1u << 31));
+}
+
+void test_frame_ring_skips_lapped_frames(CuTest* tc) {
+    char name[64];
+    struct frame_ring ring;
+    struct frame_ring_reader reader;
+    struct frame_ring_frame frame;
+    struct chip8 vm;
+
+    snprintf(name, sizeof(name), "/chip8-test-%d", (int) getpid());
+    vm_init_with_image(&vm, NULL, 0);
+    CuAssertTrue(tc, frame_ring_create(&ring, name, 4));
+    CuAssertTrue(tc, frame_ring_open(&reader, name));
+    CuAssertTrue(tc, !frame_ring_read(&reader, &frame));
+
+    for (int i = 0; i < 7; ++i) {
+        vm.screen.rows[0] = i;
+        vm.keypad = 1 << i;
+        frame_ring_publish(&ring, &vm);
+    }
+
+    // Frames 0-2 were overwritten before the reader got to them.
+    for (int i = 3; i < 7; ++i) {
+        CuAssertTrue(tc, frame_ring_read(&reader, &frame));
+        CuAssertIntEquals(tc, i, frame.frame);
+        CuAssertIntEquals(tc, i, frame.rows[0]);
+        CuAssertIntEquals(tc, 1 << i, frame.keypad);
+    }
+    CuAssertIntEquals(tc, 3, reader.dropped);
+    CuAssertTrue(tc, !frame_ring_read(&reader, &frame));
+
+    // Frames 7-10 fill the ring, and the writer is halfway through
+    // frame 11 in frame 7's slot.
+    for (int i = 7; i < 11; ++i) {
+        frame_ring_publish(&ring, &vm);
+    }
+    ring.shared->slots[11 % 4].sequence = 2 * 11 + 1;
+    CuAssertTrue(tc, frame_ring_read(&reader, &frame));
+    CuAssertIntEquals(tc, 8, frame.frame);
+    CuAssertIntEquals(tc, 4, reader.dropped);
+
+    frame_ring_close(&ring);
+    frame_ring_reader_close(&reader);
+    vm_release(&vm);
+}
+
+void test_cfg_skips_data(CuTest* tc) {
+    uint8_t program[] = {
+        0x22, 0x06, 0x12, 0x02, 0xFF, 0xFF, 0x60, 0x01,
+        0x30, 0x01, 0x70, 0x01, 0x00, 0xEE, 0xFF, 0xFF
+    };
+    struct chip8 vm;
+    struct cfg cfg;
+
+    vm_init_with_image(&vm, program, sizeof(program));
+    cfg_build(&cfg, vm.image->ram, PROG_MEM_START, PROG_MEM_START, vm.prog_mem_end);
+
+    CuAssertIntEquals(tc, 5, cfg.block_count);
+    CuAssertIntEquals(tc, CFG_CALL, cfg_block_at(&cfg, 0x200)->exit);
+    CuAssertIntEquals(tc, CFG_JUMP, cfg_block_at(&cfg, 0x202)->exit);
+    CuAssertIntEquals(tc, 2, cfg_block_at(&cfg, 0x206)->length);
+    CuAssertIntEquals(tc, CFG_SKIP, cfg_block_at(&cfg, 0x206)->exit);
+    CuAssertIntEquals(tc, 0x20C, cfg_block_at(&cfg, 0x20A)->end);
+    CuAssertIntEquals(tc, CFG_RETURN, cfg_block_at(&cfg, 0x20C)->exit);
+    CuAssertTrue(tc, !(cfg.flags[0x204] & CFG_INSTRUCTION));
+    CuAssertTrue(tc, !(cfg.flags[0x20E] & CFG_INSTRUCTION));
+    CuAssertTrue(tc, cfg_block_at(&cfg, 0x208) == NULL);
+    CuAssertIntEquals(tc, 2, cfg_block_index(&cfg, 0x208));
+
+    CuAssertIntEquals(tc, 2, cfg.function_count);
+    CuAssertIntEquals(tc, 0x206, cfg.functions[0].callees[0]);
+    CuAssertIntEquals(tc, 2, cfg.functions[0].block_count);
+    CuAssertIntEquals(tc, 3, cfg.functions[1].block_count);
+
+    cfg_free(&cfg);
+    vm_release(&vm);
+}
+
+void test_cfg_store_targets(CuTest* tc) {
+    // Stores BCD over the loop at 0x208, going through a jump first.
+    uint8_t program[] = {
+        0xA2, 0x08, 0x12, 0x06, 0xFF, 0xFF, 0xF0, 0x33,
+        0x60, 0x01, 0x12, 0x08
+    };
+    struct chip8 vm;
+    struct cfg cfg;
+
+    vm_init_with_image(&vm, program, sizeof(program));
+    cfg_build(&cfg, vm.image->ram, PROG_MEM_START, PROG_MEM_START, vm.prog_mem_end);
+
+    const struct cfg_block *store = cfg_block_at(&cfg, 0x206);
+    CuAssertIntEquals(tc, CFG_STORE, store->exit);
+    CuAssertIntEquals(tc, 0x208, store->store_address);
+    CuAssertIntEquals(tc, 3, store->store_length);
+    CuAssertTrue(tc, cfg_block_at(&cfg, 0x208)->written);
+    CuAssertTrue(tc, !cfg_block_at(&cfg, 0x200)->written);
+    CuAssertIntEquals(tc, CFG_NO_STORE, cfg_block_at(&cfg, 0x200)->store_address);
+    CuAssertTrue(tc, cfg.flags[0x20A] & CFG_WRITTEN);
+    CuAssertTrue(tc, !(cfg.flags[0x20B] & CFG_WRITTEN));
+    CuAssertTrue(tc, !(cfg.flags[0x204] & CFG_CODE));
+    CuAssertIntEquals(tc, 0, cfg.unknown_stores);
+
+    cfg_free(&cfg);
+    vm_release(&vm);
+}
+
+void test_disassemble(CuTest* tc) {
+    char line[DISASM_LINE_MAX + 64];
+    char name[32];
+
+    *format_instruction(line, 0x8AEE, 0x200) = '\0';
+    CuAssertStrEquals(tc, "(0200) 8aee: SHL Va, Ve\n", line);
+    *format_instruction(line, 0xF315, 0x202) = '\0';
+    CuAssertStrEquals(tc, "(0202) f315: LD DT, V3\n", line);
+    *format_instruction(line, 0x5121, 0x204) = '\0';
+    CuAssertStrEquals(tc, "(0204) 5121: unknown instruction or byte of data\n", line);
+
+    json_escape(name, "a\"b\\c\n");
+    CuAssertStrEquals(tc, "a\\\"b\\\\c\\u000a", name);
+    *format_instruction_json(line, "x", 0xD12F, 0x300) = '\0';
+    CuAssertStrEquals(tc, "{\"file\":\"x\",\"address\":768,\"opcode\":\"d12f\","
+            "\"mnemonic\":\"DRW\",\"operands\":\"V1, V2, f\"}\n", line);
+}
+
+/*
+ * Stands in for a translated "7001 1200" loop, marking V1 so the test
+ * can tell it apart from the interpreter.
+ */
+static int native_test_block(struct chip8 *vm, int executed, int limit) {
+    (void) limit;
+    vm->reg_v[0] += 1;
+    vm->reg_v[1] = 0xAA;
+    vm->pc = 0x200;
+    return executed + 2;
+}
+
+void test_native_falls_back_on_modified_code(CuTest* tc) {
+    uint8_t program[] = { 0x70, 0x01, 0x12, 0x00 };
+    static const struct native_block block = { 0x200, 0x204, 2, 1 << 2, native_test_block };
+    static const struct native_header header = {
+        NATIVE_ABI_VERSION, sizeof(struct chip8), 0, PROFILE_DEFAULT, 1, &block
+    };
+    struct native_program *native = calloc(1, sizeof(struct native_program));
+    struct chip8 vm;
+
+    native->header = &header;
+    native->by_address[0x200] = &block;
+    vm_init_with_image(&vm, program, sizeof(program));
+    CuAssertTrue(tc, !native_attach(&vm, native));
+    vm.rom_hash = 0;
+    CuAssertTrue(tc, native_attach(&vm, native));
+
+    // The last cycle doesn't fit the block and is interpreted.
+    CuAssertIntEquals(tc, 5, run_cycles(&vm, 5));
+    CuAssertIntEquals(tc, 3, vm.reg_v[0]);
+    CuAssertIntEquals(tc, 0xAA, vm.reg_v[1]);
+    CuAssertIntEquals(tc, 0x202, vm.pc);
+
+    // Rewriting the block's code sends it back to the interpreter.
+    vm.reg_v[1] = 0;
+    vm.pc = 0x200;
+    vm_write(&vm, 0x201, 0x02);
+    CuAssertIntEquals(tc, 4, run_cycles(&vm, 4));
+    CuAssertIntEquals(tc, 7, vm.reg_v[0]);
+    CuAssertIntEquals(tc, 0, vm.reg_v[1]);
+
+    // Writing the original bytes back re-enables it.
+    vm_write(&vm, 0x201, 0x01);
+    run_cycles(&vm, 2);
+    CuAssertIntEquals(tc, 0xAA, vm.reg_v[1]);
+
+    vm_release(&vm);
+    free(native);
+}
+
+void test_debugger_breakpoints(CuTest* tc) {
+    uint8_t program[] = {
+        0x60, 0x05, 0xF0, 0x15, 0x71, 0x01, 0x82, 0x10, 0xF0, 0x07, 0x12, 0x04
+    };
+    struct chip8 reference;
+    struct chip8 vm;
+    struct debugger debugger;
+    int hits = 0;
+
+    vm_init_with_image(&reference, program, sizeof(program));
+    vm_init_with_image(&vm, program, sizeof(program));
+    vm.cycles_per_frame = reference.cycles_per_frame = 3;
+    for (int i = 0; i < 10; ++i) {
+        vm_run_frame(&reference);
+    }
+
+    debugger_attach(&debugger, &vm);
+    CuAssertTrue(tc, !debugger_set_breakpoint(&debugger, 0x100));
+    CuAssertTrue(tc, debugger_set_breakpoint(&debugger, 0x204));
+    CuAssertTrue(tc, !debugger_set_breakpoint(&debugger, 0x205));
+    CuAssertIntEquals(tc, 0x00, vm_read(&vm, 0x204));
+    CuAssertIntEquals(tc, 0x71, debugger_read(&debugger, 0x204));
+
+    CuAssertIntEquals(tc, DEBUG_BREAKPOINT, debugger_continue(&debugger, 10));
+    CuAssertIntEquals(tc, 0x204, vm.pc);
+    CuAssertIntEquals(tc, 0, vm.reg_v[1]);
+    CuAssertIntEquals(tc, DEBUG_STEPPED, debugger_step(&debugger));
+    CuAssertIntEquals(tc, 0x206, vm.pc);
+    CuAssertIntEquals(tc, 1, vm.reg_v[1]);
+    CuAssertIntEquals(tc, DEBUG_BREAKPOINT, debugger_continue(&debugger, 10));
+    CuAssertIntEquals(tc, 0x204, vm.pc);
+    CuAssertIntEquals(tc, 1, vm.reg_v[1]);
+
+    // Stopping and resuming doesn't change where the VM ends up.
+    while (debugger_continue(&debugger, 10 - debugger.frame) == DEBUG_BREAKPOINT) {
+        ++hits;
+    }
+    CuAssertIntEquals(tc, 10, debugger.frame);
+    CuAssertIntEquals(tc, reference.reg_v[1] - 2, hits);
+    debugger_detach(&debugger);
+    CuAssertTrue(tc, !vm.breakpoints_armed);
+    CuAssertIntEquals(tc, 0x71, vm_read(&vm, 0x204));
+    CuAssertTrue(tc, vm_hash_ram(&vm) == vm.ram_hash);
+    CuAssertTrue(tc, vm_state_hash(&vm) == vm_state_hash(&reference));
+
+    vm_release(&reference);
+    vm_release(&vm);
+}
+
+void test_debugger_stops_waiting_for_a_key(CuTest* tc) {
+    uint8_t program[] = { 0xF0, 0x0A, 0x12, 0x00 };
+    struct chip8 vm;
+    struct debugger debugger;
+
+    vm_init_with_image(&vm, program, sizeof(program));
+    debugger_attach(&debugger, &vm);
+    CuAssertIntEquals(tc, DEBUG_WAITING, debugger_continue(&debugger, UINT64_MAX));
+    CuAssertIntEquals(tc, 1, debugger.frame);
+    CuAssertIntEquals(tc, DEBUG_WAITING, debugger_continue(&debugger, UINT64_MAX));
+    CuAssertIntEquals(tc, 1, debugger.frame);
+
+    vm_set_keypad(&vm, 1 << 5);
+    CuAssertIntEquals(tc, 5, vm.reg_v[0]);
+    CuAssertIntEquals(tc, DEBUG_WAITING, debugger_continue(&debugger, UINT64_MAX));
+    CuAssertIntEquals(tc, 0x202, vm.pc);
+    debugger_detach(&debugger);
+    vm_release(&vm);
+}
+
+void test_debugger_watchpoints(CuTest* tc) {
+    uint8_t program[] = {
+        0xA3, 0x00, 0x60, 0x07, 0xF0, 0x55, 0xA2, 0x0E,
+        0xD0, 0x01, 0x12, 0x0A, 0x00, 0x00, 0xFF, 0x00
+    };
+    struct chip8 vm;
+    struct debugger debugger;
+
+    vm_init_with_image(&vm, program, sizeof(program));
+    debugger_attach(&debugger, &vm);
+    CuAssertTrue(tc, !debugger_watch(&debugger, 0xFFF, 2, WATCH_WRITE));
+    CuAssertTrue(tc, debugger_watch(&debugger, 0x300, 1, WATCH_WRITE));
+    CuAssertTrue(tc, debugger_watch(&debugger, 0x20E, 1, WATCH_READ));
+    CuAssertIntEquals(tc, 1 << 3 | 1 << 2, vm.watched_pages);
+
+    // The store completes before the VM stops.
+    CuAssertIntEquals(tc, DEBUG_WATCHPOINT, debugger_continue(&debugger, 10));
+    CuAssertIntEquals(tc, 0x204, debugger.watches.hit.pc);
+    CuAssertIntEquals(tc, 0x300, debugger.watches.hit.address);
+    CuAssertIntEquals(tc, WATCH_WRITE, debugger.watches.hit.access);
+    CuAssertIntEquals(tc, 0x206, vm.pc);
+    CuAssertIntEquals(tc, 7, vm_read(&vm, 0x300));
+
+    CuAssertIntEquals(tc, DEBUG_WATCHPOINT, debugger_continue(&debugger, 10));
+    CuAssertIntEquals(tc, 0x208, debugger.watches.hit.pc);
+    CuAssertIntEquals(tc, WATCH_READ, debugger.watches.hit.access);
+
+    // A write watch on the sprite doesn't fire for DRW.
+    CuAssertTrue(tc, debugger_unwatch(&debugger, 0x20E));
+    CuAssertTrue(tc, debugger_watch(&debugger, 0x20E, 1, WATCH_WRITE));
+    CuAssertTrue(tc, debugger_unwatch(&debugger, 0x300));
+    CuAssertIntEquals(tc, 1 << 2, vm.watched_pages);
+    vm.pc = 0x206;
+    CuAssertIntEquals(tc, DEBUG_FRAMES_DONE, debugger_continue(&debugger, 10));
+
+    // A fork runs without the debugger's watchpoints.
+    struct chip8 child;
+    vm_fork(&child, &vm);
+    CuAssertPtrEquals(tc, NULL, child.watches);
+    CuAssertIntEquals(tc, 0, child.watched_pages);
+    vm_release(&child);
+
+    debugger_detach(&debugger);
+    CuAssertIntEquals(tc, 0, vm.watched_pages);
+    CuAssertPtrEquals(tc, NULL, vm.watches);
+    vm_release(&vm);
 }
 
 CuSuite* get_instruction_test_suite(void)
@@ -470,22 +1587,108 @@ CuSuite* get_instruction_test_suite(void)
     SUITE_ADD_TEST(suite, test_ld_b_vx);
     SUITE_ADD_TEST(suite, test_ld_i_vx);
     SUITE_ADD_TEST(suite, test_ld_vx_i);
+    SUITE_ADD_TEST(suite, test_memory_access_out_of_bounds);
+    SUITE_ADD_TEST(suite, test_skp_vx);
+
+    return suite;
+}
+
+CuSuite* get_profile_test_suite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, test_profile_shift_source);
+    SUITE_ADD_TEST(suite, test_profile_flag_order);
+    SUITE_ADD_TEST(suite, test_profile_load_store_increment);
+    SUITE_ADD_TEST(suite, test_profile_jump_offset);
+    SUITE_ADD_TEST(suite, test_profile_sprite_clipping);
 
     return suite;
 }
 
-void run_tests(void)
+CuSuite* get_machine_test_suite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, test_set_keypad_receives_input);
+    SUITE_ADD_TEST(suite, test_run_frame);
+    SUITE_ADD_TEST(suite, test_hash_screen);
+    SUITE_ADD_TEST(suite, test_hash_rom);
+    SUITE_ADD_TEST(suite, test_romdb_lookup);
+    SUITE_ADD_TEST(suite, test_corpus_lookup);
+    SUITE_ADD_TEST(suite, test_shared_pages_copy_on_write);
+    SUITE_ADD_TEST(suite, test_fork_shares_pages);
+    SUITE_ADD_TEST(suite, test_state_hash);
+    SUITE_ADD_TEST(suite, test_cycle_detector);
+    SUITE_ADD_TEST(suite, test_batch_matches_independent_vms);
+    SUITE_ADD_TEST(suite, test_step_batch);
+    SUITE_ADD_TEST(suite, test_cfg_skips_data);
+    SUITE_ADD_TEST(suite, test_cfg_store_targets);
+    SUITE_ADD_TEST(suite, test_disassemble);
+    SUITE_ADD_TEST(suite, test_native_falls_back_on_modified_code);
+    SUITE_ADD_TEST(suite, test_debugger_breakpoints);
+    SUITE_ADD_TEST(suite, test_debugger_stops_waiting_for_a_key);
+    SUITE_ADD_TEST(suite, test_debugger_watchpoints);
+
+    return suite;
+}
+
+CuSuite* get_movie_test_suite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, test_movie_seek);
+    SUITE_ADD_TEST(suite, test_movie_without_index);
+    SUITE_ADD_TEST(suite, test_frame_ring_skips_lapped_frames);
+
+    return suite;
+}
+
+CuSuite* get_diagnostics_test_suite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, test_trace_records_every_cycle);
+    SUITE_ADD_TEST(suite, test_telemetry_reports_per_interval);
+    SUITE_ADD_TEST(suite, test_latency_percentiles);
+    SUITE_ADD_TEST(suite, test_input_latency_starts_when_key_read);
+    SUITE_ADD_TEST(suite, test_perf_counters_degrade);
+    SUITE_ADD_TEST(suite, test_event_log_rate_limits);
+
+    return suite;
+}
+
+CuSuite* get_display_test_suite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, test_screen_present_skips_erased_sprites);
+    SUITE_ADD_TEST(suite, test_term_renders_changed_cells);
+    SUITE_ADD_TEST(suite, test_phosphor_fades_and_upscales);
+
+    return suite;
+}
+
+int run_tests(void)
 {
     CuString *output = CuStringNew();
     CuSuite* suite = get_instruction_test_suite();
 
+    CuSuiteAddSuite(suite, get_profile_test_suite());
+    CuSuiteAddSuite(suite, get_machine_test_suite());
+    CuSuiteAddSuite(suite, get_movie_test_suite());
+    CuSuiteAddSuite(suite, get_diagnostics_test_suite());
+    CuSuiteAddSuite(suite, get_display_test_suite());
+
     CuSuiteRun(suite);
     CuSuiteSummary(suite, output);
     CuSuiteDetails(suite, output);
     printf("%s\n", output->buffer);
+
+    return suite->failCount;
 }
 
 int main(void)
 {
-    run_tests();
+    return run_tests() ? 1 : 0;
 }
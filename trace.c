@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include "trace.h"
+
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 16
+#define TRACE_OUT_SIZE (1 << 16)
+#define TRACE_POLL_NANOSECONDS 100000
+
+/*
+ * Runs deflate over the pending input and writes what it produces.
+ * After a failed write the output is dropped, but input is still
+ * consumed so the VM never waits on a dead trace.
+ */
+static void deflate_out(struct trace *trace, int flush) {
+    int result;
+
+    do {
+        trace->stream.next_out = trace->out;
+        trace->stream.avail_out = TRACE_OUT_SIZE;
+        result = deflate(&trace->stream, flush);
+        size_t length = TRACE_OUT_SIZE - trace->stream.avail_out;
+        if (!trace->failed && length && fwrite(trace->out, 1, length, trace->file) != length) {
+            trace->failed = true;
+        }
+    } while (trace->stream.avail_out == 0 || (flush == Z_FINISH && result == Z_OK));
+}
+
+static void *flush_thread(void *arg) {
+    struct trace *trace = arg;
+    const struct timespec poll = { 0, TRACE_POLL_NANOSECONDS };
+    uint64_t capacity = trace->mask + 1;
+
+    for (;;) {
+        // Read stop first: once it's set, head is final.
+        bool stop = __atomic_load_n(&trace->stop, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = trace->tail;
+
+        if (tail == head) {
+            if (stop) {
+                break;
+            }
+            nanosleep(&poll, NULL);
+            continue;
+        }
+
+        uint64_t count = head - tail;
+        uint64_t start = tail & trace->mask;
+        if (start + count > capacity) {
+            count = capacity - start;
+        }
+        trace->stream.next_in = (uint8_t *) &trace->records[start];
+        trace->stream.avail_in = count * sizeof(struct trace_record);
+        deflate_out(trace, Z_NO_FLUSH);
+        __atomic_store_n(&trace->tail, tail + count, __ATOMIC_RELEASE);
+    }
+
+    deflate_out(trace, Z_FINISH);
+    return NULL;
+}
+
+bool trace_open(struct trace *trace, const char *const path, enum quirk_profile profile,
+        size_t capacity) {
+    uint8_t header[TRACE_HEADER_SIZE] = { 0 };
+    size_t size = 1;
+
+    memset(trace, 0, sizeof(*trace));
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    trace->file = fopen(path, "wb");
+    if (trace->file == NULL) {
+        return false;
+    }
+    memcpy(header, TRACE_MAGIC, 4);
+    header[4] = TRACE_VERSION;
+    header[8] = profile;
+    if (fwrite(header, 1, sizeof(header), trace->file) != sizeof(header) ||
+            deflateInit(&trace->stream, Z_BEST_SPEED) != Z_OK) {
+        fclose(trace->file);
+        return false;
+    }
+
+    trace->records = malloc(size * sizeof(struct trace_record));
+    trace->out = malloc(TRACE_OUT_SIZE);
+    trace->mask = size - 1;
+    if (pthread_create(&trace->thread, NULL, flush_thread, trace) != 0) {
+        deflateEnd(&trace->stream);
+        fclose(trace->file);
+        free(trace->records);
+        free(trace->out);
+        return false;
+    }
+    return true;
+}
+
+bool trace_close(struct trace *trace) {
+    __atomic_store_n(&trace->stop, true, __ATOMIC_RELEASE);
+    pthread_join(trace->thread, NULL);
+
+    deflateEnd(&trace->stream);
+    if (fclose(trace->file) != 0) {
+        trace->failed = true;
+    }
+    free(trace->records);
+    free(trace->out);
+    trace->records = NULL;
+    return !trace->failed;
+}
+
+void trace_wait(struct trace *trace) {
+    for (;;) {
+        trace->tail_cache = __atomic_load_n(&trace->tail, __ATOMIC_ACQUIRE);
+        if (trace->head - trace->tail_cache <= trace->mask) {
+            return;
+        }
+        sched_yield();
+    }
+}
+
+bool trace_reader_open(struct trace_reader *reader, const char *const path) {
+    uint8_t header[TRACE_HEADER_SIZE];
+
+    memset(&reader->stream, 0, sizeof(reader->stream));
+    reader->cycle = 0;
+    reader->count = 0;
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        return false;
+    }
+    if (fread(header, 1, sizeof(header), reader->file) != sizeof(header) ||
+            memcmp(header, TRACE_MAGIC, 4) != 0 || header[4] != TRACE_VERSION ||
+            header[8] >= PROFILE_COUNT || inflateInit(&reader->stream) != Z_OK) {
+        fclose(reader->file);
+        return false;
+    }
+    reader->profile = header[8];
+    return true;
+}
+
+bool trace_read(struct trace_reader *reader, struct trace_record *record) {
+    reader->stream.next_out = (uint8_t *) record;
+    reader->stream.avail_out = sizeof(*record);
+
+    while (reader->stream.avail_out) {
+        if (reader->stream.avail_in == 0) {
+            reader->stream.avail_in = fread(reader->in, 1, sizeof(reader->in), reader->file);
+            reader->stream.next_in = reader->in;
+            if (reader->stream.avail_in == 0) {
+                return false;
+            }
+        }
+        int result = inflate(&reader->stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END && reader->stream.avail_out) {
+            return false;
+        }
+        if (result != Z_OK && result != Z_STREAM_END) {
+            return false;
+        }
+    }
+    reader->cycle = reader->count++;
+    return true;
+}
+
+void trace_reader_close(struct trace_reader *reader) {
+    inflateEnd(&reader->stream);
+    fclose(reader->file);
+}
@@ -0,0 +1,144 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "instructions.h"
+#include "machine.h"
+
+#define TRACE_DEFAULT_CAPACITY (1 << 20)
+
+/*
+ * Execution trace. While vm->trace is set, the interpreter runs a copy
+ * of its loop that appends one record per executed instruction to a
+ * ring buffer; the VM never blocks on I/O. A background thread deflates
+ * the ring into the trace file. The ring only fills up when the VM
+ * outruns compression, and then the VM waits, so traces are complete.
+ * Translated code is bypassed while tracing.
+ *
+ * File: "C8TR", u32 version, u8 profile, 7 bytes padding, then a zlib
+ * stream of trace_records. Record n is cycle n of the trace.
+ */
+
+/*
+ * `reg` is the register the instruction writes (0-15 for V0-VF, or one
+ * of TRACE_I, TRACE_DT, TRACE_ST) with its value afterwards in `value`,
+ * or TRACE_NONE. Instructions that write more than one register record
+ * the main one: Vx rather than VF, and Vx for Fx65.
+ */
+struct trace_record {
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t value;
+    uint8_t reg;
+    uint8_t padding;
+};
+
+#define TRACE_I 16
+#define TRACE_DT 17
+#define TRACE_ST 18
+#define TRACE_NONE 0xFF
+
+struct trace {
+    struct trace_record *records;
+    uint64_t mask;
+    uint64_t head;          // written by the VM thread
+    uint64_t tail;          // written by the flush thread
+    uint64_t tail_cache;    // the VM thread's last view of tail
+    bool stop;
+    bool failed;
+    FILE *file;
+    z_stream stream;
+    uint8_t *out;
+    pthread_t thread;
+};
+
+/*
+ * Creates the trace file and starts the flush thread. `capacity` is
+ * rounded up to a power of two. Attach it with vm->trace = trace.
+ */
+bool trace_open(struct trace *trace, const char *const path, enum quirk_profile profile,
+        size_t capacity);
+
+/*
+ * Drains the ring and finishes the file. Returns false if any write
+ * failed.
+ */
+bool trace_close(struct trace *trace);
+
+/*
+ * Waits for the flush thread to free a slot.
+ */
+void trace_wait(struct trace *trace);
+
+static inline uint8_t trace_destination(uint16_t opcode) {
+    switch (HIGH_NIBBLE(opcode)) {
+        case 6:
+        case 7:
+        case 8:
+        case 0xC:
+            return REG_1(opcode);
+        case 0xA:
+            return TRACE_I;
+        case 0xD:
+            return 0xF;
+        case 0xF:
+            switch (LOW_BYTE(opcode)) {
+                case 0x07:
+                case 0x0A:
+                case 0x65:
+                    return REG_1(opcode);
+                case 0x15:
+                    return TRACE_DT;
+                case 0x18:
+                    return TRACE_ST;
+                case 0x1E:
+                case 0x29:
+                    return TRACE_I;
+            }
+    }
+    return TRACE_NONE;
+}
+
+static inline void trace_record(struct trace *trace, const struct chip8 *vm, uint16_t pc,
+        uint16_t opcode) {
+    uint64_t head = trace->head;
+    if (head - trace->tail_cache > trace->mask) {
+        trace_wait(trace);
+    }
+
+    struct trace_record *record = &trace->records[head & trace->mask];
+    uint8_t reg = trace_destination(opcode);
+    record->pc = pc;
+    record->opcode = opcode;
+    record->reg = reg;
+    record->padding = 0;
+    record->value = reg < 16 ? vm->reg_v[reg] : reg == TRACE_I ? vm->reg_i :
+        reg == TRACE_DT ? vm->reg_dt : reg == TRACE_ST ? vm->reg_st : 0;
+    __atomic_store_n(&trace->head, head + 1, __ATOMIC_RELEASE);
+}
+
+struct trace_reader {
+    FILE *file;
+    z_stream stream;
+    uint8_t in[1 << 16];
+    enum quirk_profile profile;
+    uint64_t cycle;
+    uint64_t count;
+};
+
+bool trace_reader_open(struct trace_reader *reader, const char *const path);
+
+/*
+ * Reads the next record, setting reader->cycle to its cycle. Returns
+ * false at the end of the trace.
+ */
+bool trace_read(struct trace_reader *reader, struct trace_record *record);
+
+void trace_reader_close(struct trace_reader *reader);
+
+#endif